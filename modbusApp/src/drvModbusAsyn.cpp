@@ -17,8 +17,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
 
+#include <algorithm>
+
 /* EPICS includes */
 #include <dbAccess.h>
 #include <epicsStdio.h>
@@ -28,6 +31,7 @@
 #include <epicsEvent.h>
 #include <epicsTime.h>
 #include <epicsEndian.h>
+#include <epicsAtomic.h>
 #include <epicsExit.h>
 #include <cantProceed.h>
 #include <errlog.h>
@@ -41,7 +45,14 @@
 
 #include <epicsExport.h>
 #include "modbus.h"
+#include "modbusInterpose.h"
 #include "drvModbusAsyn.h"
+#include "modbusPollEngine.h"
+#include "modbusCoalesce.h"
+#include "modbusBackoff.h"
+#include "modbusConnectionPool.h"
+#include "modbusScheduler.h"
+#include "modbusDiff.h"
 
 // Windows can define macros min() and max() that interfere with std::min() and std::max()
 #ifdef _WIN32
@@ -51,11 +62,12 @@
 
 /* Defined constants */
 
-#define MAX_READ_WORDS       125        /* Modbus limit on number of words to read */
-#define MAX_WRITE_WORDS      123        /* Modbus limit on number of words to write */
 #define MODBUS_READ_TIMEOUT  2.0        /* Timeout for asynOctetSyncIO->writeRead */
                                         /* Note: this value actually has no effect, the real
                                          * timeout is set in modbusInterposeConfig */
+#define MODBUS_DEMAND_TIMEOUT 10.0      /* Time after a synchronous read that a block is read in demand mode */
+#define MODBUS_DELTA_MAX_GAP 8          /* Unchanged registers between two changed runs that are still sent with them,
+                                         * less than the overhead of another function 16 transaction */
 
 #define WAGO_ID_STRING      "Wago"      /* If the plcName parameter to drvModbusAsynConfigure contains
                                          * this substring then the driver will do the initial readback
@@ -82,6 +94,7 @@ typedef struct {
 struct modbusDrvUser_t {
     modbusDataType_t dataType;
     int              len;
+    bool             onChange;  /* Only do scalar and Float64Array callbacks when the data change */
 };
 
 static modbusDataTypeStruct modbusDataTypes[MAX_MODBUS_DATA_TYPES] = {
@@ -135,6 +148,22 @@ static EPICS_ALWAYS_INLINE epicsUInt16 bswap16(epicsUInt16 value)
 static const char *driverName = "drvModbusAsyn";           /* String for asynPrint */
 
 static void readPollerC(void *drvPvt);
+static void writeFlusherC(void *drvPvt);
+static void imageUpdateCallbackC(CALLBACK *pCallback);
+static int dataTypeWords(modbusDataType_t dataType);
+static int stringWords(modbusDataType_t dataType, int len);
+
+/* The ports with a poller, used to spread the polls of the ports on the same octet port over the period */
+static std::vector<drvModbusAsyn *> pollPorts;
+/* All of the ports, used to find the data_ images that a write changes.  Both lists are protected by pollPortsMutex */
+static std::vector<drvModbusAsyn *> imagePorts;
+static epicsMutexId pollPortsMutex;
+static epicsThreadOnceId pollPortsOnceId = EPICS_THREAD_ONCE_INIT;
+
+static void pollPortsInit(void *arg)
+{
+    pollPortsMutex = epicsMutexMustCreate();
+}
 
 
 /********************************************************************
@@ -145,6 +174,7 @@ static void readPollerC(void *drvPvt);
 static void modbusExitCallback(void *pPvt) {
     drvModbusAsyn *pDriver = (drvModbusAsyn*)pPvt;
     pDriver->modbusExiting_ = true;
+    pDriver->stopWriteFlusher();
 }
 
 drvModbusAsyn::drvModbusAsyn(const char *portName, const char *octetPortName,
@@ -178,7 +208,10 @@ drvModbusAsyn::drvModbusAsyn(const char *portName, const char *octetPortName,
     dataType_(dataType),
     drvUser_(NULL),
     data_(0),
+    modbusRequest_(requestFrame_ + MODBUS_FRAME_HEADROOM),
+    modbusReply_(replyFrame_ + MODBUS_FRAME_HEADROOM),
     pollDelay_(pollMsec/1000.),
+    pollPortsDelay_(pollMsec/1000.),
     forceCallback_(false),
     readOnceFunction_(0),
     readOnceDone_(false),
@@ -190,15 +223,112 @@ drvModbusAsyn::drvModbusAsyn(const char *portName, const char *octetPortName,
     lastIOMsec_(0),
     enableHistogram_(false),
     histogramMsPerBin_(1),
-    readbackOffset_(0)
+    readbackOffset_(0),
+    udpStatistics_(false),
+    tcpStatistics_(false),
+    prevData_(NULL),
+    int32Data_(NULL),
+    float64Data_(NULL),
+    firstPollDone_(false),
+    pollFixedRate_(false),
+    pollStart_(0.),
+    pollDeadline_(0.),
+    pollOverruns_(0),
+    numPollPeriods_(0),
+    pollPeriodMean_(0.),
+    pollPeriodM2_(0.),
+    pollJitterMin_(0.),
+    pollJitterMax_(0.),
+    pollPhase_(-1.),
+    pollPhaseDone_(false),
+    pollIdleDelay_(0.),
+    readCacheTTL_(0.),
+    readCacheSize_(0),
+    readCache_(NULL),
+    readCacheFunction_(0),
+    readCacheStart_(0),
+    readCacheLength_(0),
+    readCacheTime_(0.),
+    readCacheHits_(0),
+    writeWindow_(0.),
+    writeDeadline_(0.),
+    numPendingWrites_(0),
+    writesCoalesced_(0),
+    writeFlushThreadId_(0),
+    writeFlushEventId_(0),
+    writeFlushDoneEventId_(0),
+    maskWrite_(false),
+    modbusException_(0),
+    writeThrough_(false),
+    imageUpdateMutex_(0),
+    imageUpdateQueued_(false),
+    writeDelta_(false),
+    writeDeltaSkipped_(0),
+    pollEntry_(NULL),
+    scheduler_(NULL),
+    scheduleEntry_(NULL),
+    coalesceGroup_(NULL),
+    coalesceMember_(0),
+    backoff_(NULL),
+    linkError_(false),
+    connectionPool_(NULL),
+    interruptGeneration_(0),
+    pollInterestGeneration_(-1)
 
 {
     int status;
     char readThreadName[100];
     int needReadThread=0;
     int maxLength=0;
+    int udpRetransmits;
+    double udpRTO;
+    int tcpStaleReplies;
+    int tcpFramingErrors;
+    int i;
     static const char *functionName="drvModbusAsyn";
 
+    /* Replace the interfaces that have interrupt users with copies that tell us when interrupt users
+     * are added or removed, so readPollerCycle() knows when to rebuild the callback tables and
+     * which poll blocks have clients */
+    int32Interface_ = *(asynInt32 *)asynStdInterfaces.int32.pinterface;
+    pInt32Base_ = (asynInt32 *)asynStdInterfaces.int32.pinterface;
+    int32Interface_.registerInterruptUser = registerInterruptUserInt32;
+    int32Interface_.cancelInterruptUser = cancelInterruptUserInt32;
+    asynStdInterfaces.int32.pinterface = &int32Interface_;
+    int64Interface_ = *(asynInt64 *)asynStdInterfaces.int64.pinterface;
+    pInt64Base_ = (asynInt64 *)asynStdInterfaces.int64.pinterface;
+    int64Interface_.registerInterruptUser = registerInterruptUserInt64;
+    int64Interface_.cancelInterruptUser = cancelInterruptUserInt64;
+    asynStdInterfaces.int64.pinterface = &int64Interface_;
+    float64Interface_ = *(asynFloat64 *)asynStdInterfaces.float64.pinterface;
+    pFloat64Base_ = (asynFloat64 *)asynStdInterfaces.float64.pinterface;
+    float64Interface_.registerInterruptUser = registerInterruptUserFloat64;
+    float64Interface_.cancelInterruptUser = cancelInterruptUserFloat64;
+    asynStdInterfaces.float64.pinterface = &float64Interface_;
+    uInt32DigitalInterface_ = *(asynUInt32Digital *)asynStdInterfaces.uInt32Digital.pinterface;
+    pUInt32DigitalBase_ = (asynUInt32Digital *)asynStdInterfaces.uInt32Digital.pinterface;
+    uInt32DigitalInterface_.registerInterruptUser = registerInterruptUserUInt32Digital;
+    uInt32DigitalInterface_.cancelInterruptUser = cancelInterruptUserUInt32Digital;
+    asynStdInterfaces.uInt32Digital.pinterface = &uInt32DigitalInterface_;
+    int32ArrayInterface_ = *(asynInt32Array *)asynStdInterfaces.int32Array.pinterface;
+    pInt32ArrayBase_ = (asynInt32Array *)asynStdInterfaces.int32Array.pinterface;
+    int32ArrayInterface_.registerInterruptUser = registerInterruptUserInt32Array;
+    int32ArrayInterface_.cancelInterruptUser = cancelInterruptUserInt32Array;
+    asynStdInterfaces.int32Array.pinterface = &int32ArrayInterface_;
+    float64ArrayInterface_ = *(asynFloat64Array *)asynStdInterfaces.float64Array.pinterface;
+    pFloat64ArrayBase_ = (asynFloat64Array *)asynStdInterfaces.float64Array.pinterface;
+    float64ArrayInterface_.registerInterruptUser = registerInterruptUserFloat64Array;
+    float64ArrayInterface_.cancelInterruptUser = cancelInterruptUserFloat64Array;
+    asynStdInterfaces.float64Array.pinterface = &float64ArrayInterface_;
+    octetInterface_ = *(asynOctet *)asynStdInterfaces.octet.pinterface;
+    pOctetBase_ = (asynOctet *)asynStdInterfaces.octet.pinterface;
+    octetInterface_.registerInterruptUser = registerInterruptUserOctet;
+    octetInterface_.cancelInterruptUser = cancelInterruptUserOctet;
+    asynStdInterfaces.octet.pinterface = &octetInterface_;
+    int32Callbacks_.generation = -1;
+    int64Callbacks_.generation = -1;
+    float64Callbacks_.generation = -1;
+
     if (plcType == NULL) plcType = "";
     plcType_ = epicsStrDup(plcType);
     if (modbusStartAddress == -1) {
@@ -222,12 +352,54 @@ drvModbusAsyn::drvModbusAsyn(const char *portName, const char *octetPortName,
     createParam(MODBUS_IO_ERRORS_STRING,            asynParamInt32,       &P_IOErrors);
     createParam(MODBUS_LAST_IO_TIME_STRING,         asynParamInt32,       &P_LastIOTime);
     createParam(MODBUS_MAX_IO_TIME_STRING,          asynParamInt32,       &P_MaxIOTime);
+    createParam(MODBUS_UDP_RETRANSMITS_STRING,      asynParamInt32,       &P_UDPRetransmits);
+    createParam(MODBUS_UDP_RTO_STRING,              asynParamFloat64,     &P_UDPRTO);
+    createParam(MODBUS_TCP_STALE_REPLIES_STRING,    asynParamInt32,       &P_TCPStaleReplies);
+    createParam(MODBUS_TCP_FRAMING_ERRORS_STRING,   asynParamInt32,       &P_TCPFramingErrors);
+    createParam(MODBUS_POLL_FIXED_RATE_STRING,      asynParamInt32,       &P_PollFixedRate);
+    createParam(MODBUS_POLL_PERIOD_STRING,          asynParamFloat64,     &P_PollPeriod);
+    createParam(MODBUS_POLL_JITTER_MIN_STRING,      asynParamFloat64,     &P_PollJitterMin);
+    createParam(MODBUS_POLL_JITTER_MAX_STRING,      asynParamFloat64,     &P_PollJitterMax);
+    createParam(MODBUS_POLL_JITTER_STDDEV_STRING,   asynParamFloat64,     &P_PollJitterStdDev);
+    createParam(MODBUS_POLL_OVERRUNS_STRING,        asynParamInt32,       &P_PollOverruns);
+    createParam(MODBUS_POLL_PHASE_STRING,           asynParamFloat64,     &P_PollPhase);
+    createParam(MODBUS_POLL_IDLE_DELAY_STRING,      asynParamFloat64,     &P_PollIdleDelay);
+    createParam(MODBUS_POLL_IDLE_BLOCKS_STRING,     asynParamInt32,       &P_PollIdleBlocks);
+    createParam(MODBUS_READ_CACHE_TTL_STRING,       asynParamFloat64,     &P_ReadCacheTTL);
+    createParam(MODBUS_READ_CACHE_SIZE_STRING,      asynParamInt32,       &P_ReadCacheSize);
+    createParam(MODBUS_READ_CACHE_HITS_STRING,      asynParamInt32,       &P_ReadCacheHits);
+    createParam(MODBUS_WRITE_WINDOW_STRING,         asynParamFloat64,     &P_WriteWindow);
+    createParam(MODBUS_WRITE_COALESCED_STRING,      asynParamInt32,       &P_WriteCoalesced);
+    createParam(MODBUS_WRITE_ERROR_STRING,          asynParamInt32,       &P_WriteError);
+    createParam(MODBUS_MASK_WRITE_STRING,           asynParamInt32,       &P_MaskWrite);
+    createParam(MODBUS_WRITE_THROUGH_STRING,        asynParamInt32,       &P_WriteThrough);
+    createParam(MODBUS_WRITE_DELTA_STRING,          asynParamInt32,       &P_WriteDelta);
+    createParam(MODBUS_WRITE_DELTA_SKIPPED_STRING,  asynParamInt32,       &P_WriteDeltaSkipped);
 
     setIntegerParam(P_ReadOK, 0);
     setIntegerParam(P_WriteOK, 0);
     setIntegerParam(P_IOErrors, 0);
     setIntegerParam(P_LastIOTime, 0);
     setIntegerParam(P_MaxIOTime, 0);
+    setIntegerParam(P_UDPRetransmits, 0);
+    setDoubleParam(P_UDPRTO, 0.);
+    setIntegerParam(P_TCPStaleReplies, 0);
+    setIntegerParam(P_TCPFramingErrors, 0);
+    setIntegerParam(P_PollFixedRate, 0);
+    setDoubleParam(P_PollPhase, -1.);
+    setDoubleParam(P_PollIdleDelay, 0.);
+    setIntegerParam(P_PollIdleBlocks, 0);
+    setDoubleParam(P_ReadCacheTTL, 0.);
+    setIntegerParam(P_ReadCacheSize, 0);
+    setIntegerParam(P_ReadCacheHits, 0);
+    setDoubleParam(P_WriteWindow, 0.);
+    setIntegerParam(P_WriteCoalesced, 0);
+    setIntegerParam(P_WriteError, 0);
+    setIntegerParam(P_MaskWrite, 0);
+    setIntegerParam(P_WriteThrough, 0);
+    setIntegerParam(P_WriteDelta, 0);
+    setIntegerParam(P_WriteDeltaSkipped, 0);
+    resetPollStatistics();
 
     switch(modbusFunction_) {
         case MODBUS_READ_COILS:
@@ -284,12 +456,20 @@ drvModbusAsyn::drvModbusAsyn(const char *portName, const char *octetPortName,
      * This is needed even for write operations because we need a buffer to convert
      * data for asynInt32Array writes. */
     data_ = (epicsUInt16 *) callocMustSucceed(modbusLength_, sizeof(epicsUInt16), functionName);
+    if (absoluteAddressing_) {
+        readCache_ = (epicsUInt16 *) callocMustSucceed(modbusLength_, sizeof(epicsUInt16), functionName);
+    }
 
     /* Allocate and initialize the default drvUser structure */
     drvUser_ = (modbusDrvUser_t *) callocMustSucceed(1, sizeof(modbusDrvUser_t), functionName);
     drvUser_->dataType = dataType_;
     drvUser_->len = -1;
 
+    /* If the octet port name is a connection pool then connect to the first connection here,
+     * the others are connected below */
+    connectionPool_ = modbusConnectionPool::find(octetPortName);
+    if (connectionPool_) octetPortName = connectionPool_->octetPortName(0);
+
     /* Connect to asyn octet port with asynOctetSyncIO */
     status = pasynOctetSyncIO->connect(octetPortName, 0, &pasynUserOctet_, 0);
     if (status != asynSuccess) {
@@ -298,6 +478,12 @@ drvModbusAsyn::drvModbusAsyn(const char *portName, const char *octetPortName,
             driverName, functionName, portName, octetPortName);
         return;
     }
+    /* The request and reply buffers have space in front of them for the Modbus/TCP header,
+     * tell the interpose driver so it can build and parse frames in place */
+    modbusInterposeSetFrameBuffers(pasynUserOctet_, requestFrame_, replyFrame_);
+    /* For a pool this is the first connection, the statistics of all of them are summed */
+    udpStatistics_ = (modbusInterposeGetUDPStatistics(octetPortName, &udpRetransmits, &udpRTO) == 0);
+    tcpStatistics_ = (modbusInterposeGetTCPStatistics(octetPortName, &tcpStaleReplies, &tcpFramingErrors) == 0);
 
     /* Connect to asyn octet port with asynCommonSyncIO */
     status = pasynCommonSyncIO->connect(octetPortName, 0, &pasynUserCommon_, 0);
@@ -308,6 +494,28 @@ drvModbusAsyn::drvModbusAsyn(const char *portName, const char *octetPortName,
         return;
      }
 
+    /* Connect to each connection in the pool.  doModbusIO selects one of them for each transaction. */
+    if (connectionPool_) {
+        poolOctetUsers_.push_back(pasynUserOctet_);
+        poolCommonUsers_.push_back(pasynUserCommon_);
+        for (i=1; i<connectionPool_->numConnections(); i++) {
+            asynUser *pasynUserOctet, *pasynUserCommon;
+            status = pasynOctetSyncIO->connect(connectionPool_->octetPortName(i), 0, &pasynUserOctet, 0);
+            if (status == asynSuccess) {
+                status = pasynCommonSyncIO->connect(connectionPool_->octetPortName(i), 0, &pasynUserCommon, 0);
+            }
+            if (status != asynSuccess) {
+                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s::%s port %s can't connect to Octet server %s in connection pool %s.\n",
+                    driverName, functionName, portName, connectionPool_->octetPortName(i), octetPortName_);
+                return;
+            }
+            modbusInterposeSetFrameBuffers(pasynUserOctet, requestFrame_, replyFrame_);
+            poolOctetUsers_.push_back(pasynUserOctet);
+            poolCommonUsers_.push_back(pasynUserCommon);
+        }
+    }
+
     /* If this is an output function do a readOnce operation if required. */
     if (readOnceFunction_ && !absoluteAddressing_ && (pollDelay_ != 0)) {
          ioStatus_ = doModbusIO(modbusSlave_, readOnceFunction_,
@@ -319,18 +527,51 @@ drvModbusAsyn::drvModbusAsyn(const char *portName, const char *octetPortName,
     /* Create the epicsEvent to wake up the readPoller.
      * We do this even if there is no poller. */
     readPollerEventId_ = epicsEventCreate(epicsEventEmpty);
+    writeFlushEventId_ = epicsEventCreate(epicsEventEmpty);
+    writeFlushDoneEventId_ = epicsEventCreate(epicsEventEmpty);
+
+    /* The ports that use the same octet port back off together when it fails */
+    backoff_ = modbusBackoff::join(this, octetPortName_);
 
-    /* Create the thread to read registers if this is a read function code */
+    /* Create the thread to read registers if this is a read function code,
+     * or add this port to the scheduler for the octet port or the shared poll engine if they have been configured */
     if (needReadThread) {
-        epicsSnprintf(readThreadName, 100, "%sRead", this->portName);
-        readPollerThreadId_ = epicsThreadCreate(readThreadName,
-           epicsThreadPriorityMedium,
-           epicsThreadGetStackSize(epicsThreadStackSmall),
-           (EPICSTHREADFUNC)readPollerC,
-           this);
+        prevData_ = (epicsUInt16 *) callocMustSucceed(modbusLength_, sizeof(epicsUInt16), functionName);
+        int32Data_ = (epicsInt32 *) callocMustSucceed(modbusLength_, sizeof(epicsInt32), functionName);
+        float64Data_ = (epicsFloat64 *) callocMustSucceed(modbusLength_, sizeof(epicsFloat64), functionName);
         forceCallback_ = true;
+        addPollBlock(modbusFunction_, modbusStartAddress_, 0);
+        coalesceGroup_ = modbusCoalesceGroup::join(this, octetPortName_, modbusSlave_, modbusFunction_,
+                                                   modbusStartAddress_, modbusLength_, &coalesceMember_);
+        epicsThreadOnce(&pollPortsOnceId, pollPortsInit, NULL);
+        epicsMutexLock(pollPortsMutex);
+        pollPorts.push_back(this);
+        epicsMutexUnlock(pollPortsMutex);
+        scheduler_ = modbusScheduler::find(octetPortName_);
+        if (scheduler_) {
+            scheduleEntry_ = scheduler_->addPort(this, pollDelay_);
+        } else if (modbusPollEngine::getInstance()) {
+            pollEntry_ = modbusPollEngine::getInstance()->addPort(this, pollDelay_);
+        } else {
+            epicsSnprintf(readThreadName, 100, "%sRead", this->portName);
+            readPollerThreadId_ = epicsThreadCreate(readThreadName,
+               epicsThreadPriorityMedium,
+               epicsThreadGetStackSize(epicsThreadStackSmall),
+               (EPICSTHREADFUNC)readPollerC,
+               this);
+        }
     }
 
+    /* Writes from this port or others can update data_ without waiting for the next poll */
+    imageUpdateMutex_ = epicsMutexMustCreate();
+    callbackSetCallback(imageUpdateCallbackC, &imageUpdateCallback_);
+    callbackSetPriority(priorityMedium, &imageUpdateCallback_);
+    callbackSetUser(this, &imageUpdateCallback_);
+    epicsThreadOnce(&pollPortsOnceId, pollPortsInit, NULL);
+    epicsMutexLock(pollPortsMutex);
+    imagePorts.push_back(this);
+    epicsMutexUnlock(pollPortsMutex);
+
     epicsAtExit(modbusExitCallback, this);
 
     initialized_ = true;
@@ -376,14 +617,9 @@ asynStatus drvModbusAsyn::drvUserCreate(asynUser *pasynUser,
         pstring = modbusDataTypes[i].dataTypeString;
         if (epicsStrCaseCmp(local_drvInfo, pstring) == 0) {
             pasynManager->getAddr(pasynUser, &offset);
-            if (checkOffset(offset)) {
-                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                          "%s::%s port %s invalid offset %d\n",
-                          driverName, functionName, this->portName, offset);
-                return asynError;
-            }
             modbusDataType_t dataType = modbusDataTypes[i].dataType;
             int len = -1;
+            bool onChange = false;
             if (equal_sign) {
                 switch (dataType) {
                     case dataTypeStringHigh:
@@ -405,6 +641,10 @@ asynStatus drvModbusAsyn::drvUserCreate(asynUser *pasynUser,
                         break;
 
                     default:
+                        if (epicsStrCaseCmp(equal_sign + 1, MODBUS_ONCHANGE_STRING) == 0) {
+                            onChange = true;
+                            break;
+                        }
                         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                                   "%s::%s port %s invalid drvUser: %s\n",
                                   driverName, functionName, this->portName, drvInfo);
@@ -412,11 +652,21 @@ asynStatus drvModbusAsyn::drvUserCreate(asynUser *pasynUser,
                 }
             }
 
+            /* A value must not cross the end of its poll block, because the next block is not
+             * contiguous in the device.  Strings are only checked if their length is given. */
+            if (checkOffset(offset, (len > 0) ? stringWords(dataType, len) : valueWords(offset, dataType))) {
+                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                          "%s::%s port %s invalid offset %d for data type %s\n",
+                          driverName, functionName, this->portName, offset, pstring);
+                return asynError;
+            }
+
             /* Update pasynUser->drvUser if needed */
-            if (dataType != dataType_ || len != -1) {
+            if (dataType != dataType_ || len != -1 || onChange) {
                 modbusDrvUser_t *drvUser = (modbusDrvUser_t *) callocMustSucceed(1, sizeof(modbusDrvUser_t), functionName);
                 drvUser->dataType = dataType;
                 drvUser->len = len;
+                drvUser->onChange = onChange;
                 pasynUser->drvUser = drvUser;
             }
             pasynUser->reason = P_Data;
@@ -429,6 +679,25 @@ asynStatus drvModbusAsyn::drvUserCreate(asynUser *pasynUser,
         }
     }
 
+    /* MODBUS_DATA=ONCHANGE uses the default data type with callbacks on change only */
+    if (equal_sign && (epicsStrCaseCmp(local_drvInfo, MODBUS_DATA_STRING) == 0)) {
+        if (epicsStrCaseCmp(equal_sign + 1, MODBUS_ONCHANGE_STRING) != 0) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s::%s port %s invalid drvUser: %s\n",
+                      driverName, functionName, this->portName, drvInfo);
+            return asynError;
+        }
+        modbusDrvUser_t *drvUser = (modbusDrvUser_t *) callocMustSucceed(1, sizeof(modbusDrvUser_t), functionName);
+        drvUser->dataType = dataType_;
+        drvUser->len = -1;
+        drvUser->onChange = true;
+        pasynUser->drvUser = drvUser;
+        pasynUser->reason = P_Data;
+        if (pptypeName) *pptypeName = epicsStrDup(MODBUS_DATA_STRING);
+        if (psize) *psize = sizeof(MODBUS_DATA_STRING);
+        return asynSuccess;
+    }
+
     // If we get to here we call the base class
     return asynPortDriver::drvUserCreate(pasynUser, drvInfo, pptypeName, psize);
 
@@ -487,6 +756,31 @@ void drvModbusAsyn::report(FILE *fp, int details)
         fprintf(fp, "    Read OK:            %d\n", readOK_);
         fprintf(fp, "    Write OK:           %d\n", writeOK_);
         fprintf(fp, "    pollDelay:          %f\n", pollDelay_);
+        fprintf(fp, "    pollPhase:          %s\n", (pollPhase_ >= 0.) ? "explicit" : "automatic");
+        fprintf(fp, "    pollIdleDelay:      %f\n", pollIdleDelay_);
+        if (absoluteAddressing_) {
+            fprintf(fp, "    readCacheTTL:       %f\n", readCacheTTL_);
+            fprintf(fp, "    readCacheSize:      %d\n", readCacheSize_);
+            fprintf(fp, "    readCacheHits:      %d\n", readCacheHits_);
+        }
+        if (modbusFunction_ == MODBUS_WRITE_MULTIPLE_REGISTERS) {
+            fprintf(fp, "    writeWindow:        %f\n", writeWindow_);
+            fprintf(fp, "    writesCoalesced:    %d\n", writesCoalesced_);
+            fprintf(fp, "    writeDelta:         %s\n", writeDelta_ ? "true" : "false");
+            fprintf(fp, "    writeDeltaSkipped:  %d\n", writeDeltaSkipped_);
+        }
+        fprintf(fp, "    maskWrite:          %s\n", maskWrite_ ? "true" : "false");
+        fprintf(fp, "    writeThrough:       %s\n", writeThrough_ ? "true" : "false");
+        fprintf(fp, "    Shared poll engine: %s\n", pollEntry_ ? "true" : "false");
+        fprintf(fp, "    Bus scheduler:      %s\n", scheduleEntry_ ? "true" : "false");
+        fprintf(fp, "    Coalesced reads:    %s\n", (coalesceGroup_ && (pollBlocks_.size() == 1)) ? "true" : "false");
+        if (pollBlocks_.size() > 1) {
+            for (size_t i=0; i<pollBlocks_.size(); i++) {
+                fprintf(fp, "    Poll block %d:       function=%d, start=0%o, length=0%o, offset=0%o\n",
+                        (int)i, pollBlocks_[i].function, pollBlocks_[i].start,
+                        pollBlocks_[i].length, pollBlocks_[i].offset);
+            }
+        }
         fprintf(fp, "    Time for last I/O   %d msec\n", lastIOMsec_);
         fprintf(fp, "    Max. I/O time:      %d msec\n", maxIOMsec_);
         fprintf(fp, "    Time per hist. bin: %d msec\n", histogramMsPerBin_);
@@ -509,29 +803,32 @@ asynStatus drvModbusAsyn::readUInt32Digital(asynUser *pasynUser, epicsUInt32 *va
 {
     int offset;
     int modbusFunction;
+    int blockFunction;
+    asynStatus status;
     static const char *functionName = "readUInt32D";
 
     if (pasynUser->reason == P_Data) {
         pasynManager->getAddr(pasynUser, &offset);
-        if (checkOffset(offset)) {
+        if (checkOffset(offset, 1)) {
             asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                       "%s::%s port %s invalid offset %d\n",
                       driverName, functionName, this->portName, offset);
             return asynError;
         }
+        blockFunction = pollBlockFunction(offset);
         if (absoluteAddressing_) {
             /* If absolute addressing then there is no poller running */
             if (checkModbusFunction(&modbusFunction)) return asynError;
-            ioStatus_ = doModbusIO(modbusSlave_, modbusFunction,
-                                   offset, data_, std::min(1, modbusLength_));
+            ioStatus_ = readAbsolute(modbusFunction, offset, std::min(1, modbusLength_));
             if (ioStatus_ != asynSuccess) return(ioStatus_);
             offset = 0;
             readOnceDone_ = true;
         } else {
-            if (ioStatus_ != asynSuccess) return(ioStatus_);
+            status = pollDemanded(offset);
+            if (status != asynSuccess) return(status);
         }
         *value = 0;
-        switch(modbusFunction_) {
+        switch(blockFunction) {
             case MODBUS_READ_COILS:
             case MODBUS_READ_DISCRETE_INPUTS:
             case MODBUS_READ_HOLDING_REGISTERS:
@@ -554,13 +851,13 @@ asynStatus drvModbusAsyn::readUInt32Digital(asynUser *pasynUser, epicsUInt32 *va
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s invalid request for Modbus"
                           " function %d\n",
-                          driverName, functionName, this->portName, modbusFunction_);
+                          driverName, functionName, this->portName, blockFunction);
                 return asynError;
         }
         asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
                   "%s::%s port %s function=0x%x,"
                   " offset=0%o, mask=0x%x, value=0x%x\n",
-                  driverName, functionName, this->portName, modbusFunction_,
+                  driverName, functionName, this->portName, blockFunction,
                   offset, mask, *value);
         return asynSuccess;
     }
@@ -576,12 +873,14 @@ asynStatus drvModbusAsyn::writeUInt32Digital(asynUser *pasynUser, epicsUInt32 va
     int modbusAddress;
     int i;
     epicsUInt16 data = value;
+    epicsUInt16 maskData[2];
+    bool readModifyWrite;
     asynStatus status;
     static const char *functionName = "writeUInt32D";
 
     if (pasynUser->reason == P_Data) {
         pasynManager->getAddr(pasynUser, &offset);
-        if (checkOffset(offset)) {
+        if (checkOffset(offset, 1)) {
             asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                       "%s::%s port %s invalid offset %d\n",
                       driverName, functionName, this->portName, offset);
@@ -602,18 +901,37 @@ asynStatus drvModbusAsyn::writeUInt32Digital(asynUser *pasynUser, epicsUInt32 va
             case MODBUS_WRITE_MULTIPLE_REGISTERS:
                 /* Do this as a read/modify/write if mask is not all 0 or all 1 */
                 if ((mask == 0) || (mask == 0xFFFF)) {
-                    status = doModbusIO(modbusSlave_, modbusFunction_,
-                                        modbusAddress, &data, 1);
+                    status = writeMultipleRegisters(modbusAddress, &data, 1);
                 } else {
-                    status = doModbusIO(modbusSlave_, MODBUS_READ_HOLDING_REGISTERS,
-                                        modbusAddress + readbackOffset_, &data, 1);
-                    if (status != asynSuccess) return(status);
-                    /* Set bits that are set in the value and set in the mask */
-                    data |=  (value & mask);
-                    /* Clear bits that are clear in the value and set in the mask */
-                    data  &= (value | ~mask);
-                    status = doModbusIO(modbusSlave_, modbusFunction_,
-                                        modbusAddress, &data, 1);
+                    readModifyWrite = !maskWrite_;
+                    if (maskWrite_) {
+                        /* Mask Write Register changes the bits in the mask on the device in one transaction.
+                         * If the device does not support it use read/modify/write from now on. */
+                        maskData[0] = ~mask;
+                        maskData[1] = value & mask;
+                        status = doModbusIO(modbusSlave_, MODBUS_MASK_WRITE_REGISTER,
+                                            modbusAddress, maskData, 2);
+                        if ((status != asynSuccess) && (modbusException_ == MODBUS_EXCEPTION_ILLEGAL_FUNCTION)) {
+                            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+                                      "%s::%s port %s device does not support Mask Write Register,"
+                                      " using read/modify/write\n",
+                                      driverName, functionName, this->portName);
+                            maskWrite_ = false;
+                            setIntegerParam(P_MaskWrite, 0);
+                            readModifyWrite = true;
+                        }
+                    }
+                    if (readModifyWrite) {
+                        status = doModbusIO(modbusSlave_, MODBUS_READ_HOLDING_REGISTERS,
+                                            modbusAddress + readbackOffset_, &data, 1);
+                        if (status != asynSuccess) return(status);
+                        /* Set bits that are set in the value and set in the mask */
+                        data |=  (value & mask);
+                        /* Clear bits that are clear in the value and set in the mask */
+                        data  &= (value | ~mask);
+                        status = doModbusIO(modbusSlave_, modbusFunction_,
+                                            modbusAddress, &data, 1);
+                    }
                 }
                 if (status != asynSuccess) return(status);
                 break;
@@ -657,30 +975,32 @@ asynStatus drvModbusAsyn::readInt32 (asynUser *pasynUser, epicsInt32 *value)
     asynStatus status;
     int bufferLen;
     int modbusFunction;
+    int blockFunction;
     static const char *functionName = "readInt32";
 
     *value = 0;
 
     if (pasynUser->reason == P_Data) {
         pasynManager->getAddr(pasynUser, &offset);
-        if (checkOffset(offset)) {
+        if (checkOffset(offset, valueWords(offset, dataType))) {
             asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                       "%s::%s port %s invalid offset %d\n",
                       driverName, functionName, this->portName, offset);
             return asynError;
         }
+        blockFunction = pollBlockFunction(offset);
         if (absoluteAddressing_) {
             /* If absolute addressing then there is no poller running */
             if (checkModbusFunction(&modbusFunction)) return asynError;
-            ioStatus_ = doModbusIO(modbusSlave_, modbusFunction,
-                                        offset, data_, std::min(2, modbusLength_));
+            ioStatus_ = readAbsolute(modbusFunction, offset, std::min(2, modbusLength_));
             if (ioStatus_ != asynSuccess) return(ioStatus_);
             offset = 0;
             readOnceDone_ = true;
         } else {
-            if (ioStatus_ != asynSuccess) return(ioStatus_);
+            status = pollDemanded(offset);
+            if (status != asynSuccess) return(status);
         }
-        switch(modbusFunction_) {
+        switch(blockFunction) {
             case MODBUS_READ_COILS:
             case MODBUS_READ_DISCRETE_INPUTS:
                 *value = data_[offset];
@@ -708,13 +1028,13 @@ asynStatus drvModbusAsyn::readInt32 (asynUser *pasynUser, epicsInt32 *value)
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s invalid request for Modbus"
                           " function %d\n",
-                          driverName, functionName, this->portName, modbusFunction_);
+                          driverName, functionName, this->portName, blockFunction);
                 return asynError;
         }
         asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
               "%s::%s port %s function=0x%x,"
               " offset=0%o, value=0x%x\n",
-              driverName, functionName, this->portName, modbusFunction_,
+              driverName, functionName, this->portName, blockFunction,
               offset, *value);
         return asynSuccess;
     }
@@ -738,7 +1058,7 @@ asynStatus drvModbusAsyn::writeInt32(asynUser *pasynUser, epicsInt32 value)
 
     if (function == P_Data) {
         pasynManager->getAddr(pasynUser, &offset);
-        if (checkOffset(offset)) {
+        if (checkOffset(offset, valueWords(offset, dataType))) {
             asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                       "%s::%s port %s invalid offset %d\n",
                       driverName, functionName, this->portName, offset);
@@ -760,18 +1080,14 @@ asynStatus drvModbusAsyn::writeInt32(asynUser *pasynUser, epicsInt32 value)
             case MODBUS_WRITE_SINGLE_REGISTER:
                 status = writePlcInt32(dataType, offset, value, buffer, &bufferLen);
                 if (status != asynSuccess) return(status);
-                for (i=0; i<bufferLen; i++) {
-                    status = doModbusIO(modbusSlave_, modbusFunction_,
-                                        modbusAddress+i, buffer+i, bufferLen);
-                }
+                status = writeSingleRegisters(modbusAddress, buffer, bufferLen);
                 if (status != asynSuccess) return(status);
                 break;
             case MODBUS_WRITE_MULTIPLE_REGISTERS:
             case MODBUS_WRITE_MULTIPLE_REGISTERS_F23:
                 status = writePlcInt32(dataType, offset, value, buffer, &bufferLen);
                 if (status != asynSuccess) return(status);
-                status = doModbusIO(modbusSlave_, modbusFunction_,
-                                    modbusAddress, buffer, bufferLen);
+                status = writeMultipleRegisters(modbusAddress, buffer, bufferLen);
                 if (status != asynSuccess) return(status);
                 break;
             default:
@@ -789,7 +1105,7 @@ asynStatus drvModbusAsyn::writeInt32(asynUser *pasynUser, epicsInt32 value)
     }
     else if (function == P_Read) {
         /* Read the data for this driver.  This can be used when the poller is disabled. */
-        epicsEventSignal(readPollerEventId_);
+        wakeReadPoller();
     }
     else if (function == P_HistogramBinTime) {
         /* Set the time per histogram bin in ms */
@@ -801,6 +1117,36 @@ asynStatus drvModbusAsyn::writeInt32(asynUser *pasynUser, epicsInt32 value)
             histogramTimeAxis_[i] = i *histogramMsPerBin_;
         }
     }
+    else if (function == P_PollFixedRate) {
+        pollFixedRate_ = (value != 0);
+        setIntegerParam(P_PollFixedRate, value);
+        resetPollStatistics();
+    }
+    else if (function == P_WriteDelta) {
+        writeDelta_ = (value != 0);
+        setIntegerParam(P_WriteDelta, value);
+        deltaImages_.clear();
+    }
+    else if (function == P_WriteThrough) {
+        writeThrough_ = (value != 0);
+        setIntegerParam(P_WriteThrough, value);
+    }
+    else if (function == P_WriteError) {
+        /* Only 0 can be written, to clear the error */
+        if (value != 0) return asynError;
+        setIntegerParam(P_WriteError, 0);
+        callParamCallbacks();
+    }
+    else if (function == P_MaskWrite) {
+        maskWrite_ = (value != 0);
+        setIntegerParam(P_MaskWrite, value);
+    }
+    else if (function == P_ReadCacheSize) {
+        readCacheSize_ = std::max(0, std::min(value, modbusLength_));
+        setIntegerParam(P_ReadCacheSize, readCacheSize_);
+        readCacheLength_ = 0;
+        readCacheNoReadAhead_.clear();
+    }
     else {
         return asynPortDriver::writeInt32(pasynUser, value);
     }
@@ -818,30 +1164,32 @@ asynStatus drvModbusAsyn::readInt64 (asynUser *pasynUser, epicsInt64 *value)
     asynStatus status;
     int bufferLen;
     int modbusFunction;
+    int blockFunction;
     static const char *functionName = "readInt64";
 
     *value = 0;
 
     if (pasynUser->reason == P_Data) {
         pasynManager->getAddr(pasynUser, &offset);
-        if (checkOffset(offset)) {
+        if (checkOffset(offset, valueWords(offset, dataType))) {
             asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                       "%s::%s port %s invalid offset %d\n",
                       driverName, functionName, this->portName, offset);
             return asynError;
         }
+        blockFunction = pollBlockFunction(offset);
         if (absoluteAddressing_) {
             /* If absolute addressing then there is no poller running */
             if (checkModbusFunction(&modbusFunction)) return asynError;
-            ioStatus_ = doModbusIO(modbusSlave_, modbusFunction,
-                                   offset, data_, std::min(4, modbusLength_));
+            ioStatus_ = readAbsolute(modbusFunction, offset, std::min(4, modbusLength_));
             if (ioStatus_ != asynSuccess) return(ioStatus_);
             offset = 0;
             readOnceDone_ = true;
         } else {
-            if (ioStatus_ != asynSuccess) return(ioStatus_);
+            status = pollDemanded(offset);
+            if (status != asynSuccess) return(status);
         }
-        switch(modbusFunction_) {
+        switch(blockFunction) {
             case MODBUS_READ_COILS:
             case MODBUS_READ_DISCRETE_INPUTS:
                 *value = data_[offset];
@@ -868,13 +1216,13 @@ asynStatus drvModbusAsyn::readInt64 (asynUser *pasynUser, epicsInt64 *value)
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s invalid request for Modbus"
                           " function %d\n",
-                          driverName, functionName, this->portName, modbusFunction_);
+                          driverName, functionName, this->portName, blockFunction);
                 return asynError;
         }
         asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
               "%s::%s port %s function=0x%x,"
               " offset=0%o, value=0x%llx\n",
-              driverName, functionName, this->portName, modbusFunction_,
+              driverName, functionName, this->portName, blockFunction,
               offset, *value);
         return asynSuccess;
     }
@@ -892,13 +1240,12 @@ asynStatus drvModbusAsyn::writeInt64(asynUser *pasynUser, epicsInt64 value)
     int function = pasynUser->reason;
     epicsUInt16 buffer[4];
     int bufferLen=0;
-    int i;
     asynStatus status;
     static const char *functionName = "writeInt64";
 
     if (function == P_Data) {
         pasynManager->getAddr(pasynUser, &offset);
-        if (checkOffset(offset)) {
+        if (checkOffset(offset, valueWords(offset, dataType))) {
             asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                       "%s::%s port %s invalid offset %d\n",
                       driverName, functionName, this->portName, offset);
@@ -920,18 +1267,14 @@ asynStatus drvModbusAsyn::writeInt64(asynUser *pasynUser, epicsInt64 value)
             case MODBUS_WRITE_SINGLE_REGISTER:
                 status = writePlcInt64(dataType, offset, value, buffer, &bufferLen);
                 if (status != asynSuccess) return(status);
-                for (i=0; i<bufferLen; i++) {
-                    status = doModbusIO(modbusSlave_, modbusFunction_,
-                                        modbusAddress+i, buffer+i, bufferLen);
-                }
+                status = writeSingleRegisters(modbusAddress, buffer, bufferLen);
                 if (status != asynSuccess) return(status);
                 break;
             case MODBUS_WRITE_MULTIPLE_REGISTERS:
             case MODBUS_WRITE_MULTIPLE_REGISTERS_F23:
                 status = writePlcInt64(dataType, offset, value, buffer, &bufferLen);
                 if (status != asynSuccess) return(status);
-                status = doModbusIO(modbusSlave_, modbusFunction_,
-                                    modbusAddress, buffer, bufferLen);
+                status = writeMultipleRegisters(modbusAddress, buffer, bufferLen);
                 if (status != asynSuccess) return(status);
                 break;
             default:
@@ -963,6 +1306,7 @@ asynStatus drvModbusAsyn::readFloat64 (asynUser *pasynUser, epicsFloat64 *value)
     int offset;
     int bufferLen;
     int modbusFunction;
+    int blockFunction;
     asynStatus status = asynSuccess;
     static const char *functionName="readFloat64";
 
@@ -970,24 +1314,25 @@ asynStatus drvModbusAsyn::readFloat64 (asynUser *pasynUser, epicsFloat64 *value)
 
     if (pasynUser->reason == P_Data) {
         pasynManager->getAddr(pasynUser, &offset);
-        if (checkOffset(offset)) {
+        if (checkOffset(offset, valueWords(offset, dataType))) {
             asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                       "%s::%s port %s invalid offset %d\n",
                       driverName, functionName, this->portName, offset);
             return asynError;
         }
+        blockFunction = pollBlockFunction(offset);
         if (absoluteAddressing_) {
             /* If absolute addressing then there is no poller running */
             if (checkModbusFunction(&modbusFunction)) return asynError;
-            ioStatus_ = doModbusIO(modbusSlave_, modbusFunction,
-                                        offset, data_, std::min(4, modbusLength_));
+            ioStatus_ = readAbsolute(modbusFunction, offset, std::min(4, modbusLength_));
             if (ioStatus_ != asynSuccess) return(ioStatus_);
             offset = 0;
             readOnceDone_ = true;
         } else {
-            if (ioStatus_ != asynSuccess) return(ioStatus_);
+            status = pollDemanded(offset);
+            if (status != asynSuccess) return(status);
         }
-        switch(modbusFunction_) {
+        switch(blockFunction) {
             case MODBUS_READ_COILS:
             case MODBUS_READ_DISCRETE_INPUTS:
                 *value = data_[offset];
@@ -1013,13 +1358,13 @@ asynStatus drvModbusAsyn::readFloat64 (asynUser *pasynUser, epicsFloat64 *value)
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s invalid request for Modbus"
                           " function %d\n",
-                          driverName, functionName, this->portName, modbusFunction_);
+                          driverName, functionName, this->portName, blockFunction);
                 return asynError;
         }
         asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
               "%s::%s port %s function=0x%x,"
               " offset=0%o, value=%f, status=%d\n",
-              driverName, functionName, this->portName, modbusFunction_,
+              driverName, functionName, this->portName, blockFunction,
               offset, *value, status);
     }
     else {
@@ -1037,14 +1382,13 @@ asynStatus drvModbusAsyn::writeFloat64 (asynUser *pasynUser, epicsFloat64 value)
     int modbusAddress;
     epicsUInt16 buffer[4];
     int bufferLen;
-    int i;
     asynStatus status;
     static const char *functionName="writeFloat64";
 
 
     if (pasynUser->reason == P_Data) {
         pasynManager->getAddr(pasynUser, &offset);
-        if (checkOffset(offset)) {
+        if (checkOffset(offset, valueWords(offset, dataType))) {
             asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                       "%s::%s port %s invalid offset %d\n",
                       driverName, functionName, this->portName, offset);
@@ -1065,17 +1409,15 @@ asynStatus drvModbusAsyn::writeFloat64 (asynUser *pasynUser, epicsFloat64 value)
                 break;
             case MODBUS_WRITE_SINGLE_REGISTER:
                 status = writePlcFloat(dataType, offset, value, buffer, &bufferLen);
-                for (i=0; i<bufferLen; i++) {
-                    status = doModbusIO(modbusSlave_, modbusFunction_,
-                                        modbusAddress+i, buffer+i, 1);
-                    if (status != asynSuccess) return(status);
-                }
+                if (status != asynSuccess) return(status);
+                status = writeSingleRegisters(modbusAddress, buffer, bufferLen);
+                if (status != asynSuccess) return(status);
                 break;
             case MODBUS_WRITE_MULTIPLE_REGISTERS:
             case MODBUS_WRITE_MULTIPLE_REGISTERS_F23:
                 status = writePlcFloat(dataType, offset, value, buffer, &bufferLen);
-                status = doModbusIO(modbusSlave_, modbusFunction_,
-                                    modbusAddress, buffer, bufferLen);
+                if (status != asynSuccess) return(status);
+                status = writeMultipleRegisters(modbusAddress, buffer, bufferLen);
                 if (status != asynSuccess) return(status);
                 break;
             default:
@@ -1093,9 +1435,48 @@ asynStatus drvModbusAsyn::writeFloat64 (asynUser *pasynUser, epicsFloat64 value)
     }
     else if (pasynUser->reason == P_PollDelay) {
         pollDelay_ = value;
+        epicsMutexLock(pollPortsMutex);
+        pollPortsDelay_ = value;
+        epicsMutexUnlock(pollPortsMutex);
+        pollPhaseDone_ = false;
+        resetPollStatistics();
         /* Send an event to the poller, because it might have a long poll time, or
          * not be polling at all */
-        epicsEventSignal(readPollerEventId_);
+        wakeReadPoller();
+    }
+    else if (pasynUser->reason == P_PollIdleDelay) {
+        pollIdleDelay_ = value;
+        setDoubleParam(P_PollIdleDelay, value);
+        wakeReadPoller();
+    }
+    else if (pasynUser->reason == P_ReadCacheTTL) {
+        readCacheTTL_ = (value > 0.) ? value : 0.;
+        setDoubleParam(P_ReadCacheTTL, readCacheTTL_);
+        readCacheLength_ = 0;
+    }
+    else if (pasynUser->reason == P_WriteWindow) {
+        /* The window is in ms */
+        writeWindow_ = (value > 0.) ? value/1000. : 0.;
+        setDoubleParam(P_WriteWindow, writeWindow_ * 1000.);
+        if (writeWindow_ == 0.) {
+            if (!pendingWrites_.empty()) return flushWrites();
+        } else if (!writeFlushThreadId_ && (modbusFunction_ == MODBUS_WRITE_MULTIPLE_REGISTERS)) {
+            char writeThreadName[100];
+            epicsSnprintf(writeThreadName, 100, "%sWrite", this->portName);
+            writeFlushThreadId_ = epicsThreadCreate(writeThreadName,
+               epicsThreadPriorityMedium,
+               epicsThreadGetStackSize(epicsThreadStackSmall),
+               (EPICSTHREADFUNC)writeFlusherC,
+               this);
+        }
+    }
+    else if (pasynUser->reason == P_PollPhase) {
+        /* The phase is in ms, < 0 to compute it automatically.  It is applied at the next poll. */
+        pollPhase_ = (value < 0.) ? -1. : value/1000.;
+        setDoubleParam(P_PollPhase, (value < 0.) ? -1. : value);
+        pollPhaseDone_ = false;
+        resetPollStatistics();
+        wakeReadPoller();
     }
     return asynSuccess;
 }
@@ -1113,23 +1494,25 @@ asynStatus drvModbusAsyn::readFloat64Array (asynUser *pasynUser, epicsFloat64 *d
     size_t i;
     int bufferLen;
     int modbusFunction;
+    int blockFunction;
     asynStatus status;
     static const char *functionName="readFloat64Array";
 
     *nactual = 0;
     pasynManager->getAddr(pasynUser, &offset);
     if (function == P_Data) {
+        blockFunction = pollBlockFunction(offset);
         if (absoluteAddressing_) {
             /* If absolute addressing then there is no poller running */
             if (checkModbusFunction(&modbusFunction)) return asynError;
-            ioStatus_ = doModbusIO(modbusSlave_, modbusFunction,
-                                   offset, data_, modbusLength_);
+            ioStatus_ = readAbsolute(modbusFunction, offset, modbusLength_);
             if (ioStatus_ != asynSuccess) return(ioStatus_);
             offset = 0;
         } else {
-            if (ioStatus_ != asynSuccess) return(ioStatus_);
+            status = pollDemanded(offset);
+            if (status != asynSuccess) return(status);
         }
-        switch(modbusFunction_) {
+        switch(blockFunction) {
             case MODBUS_READ_COILS:
             case MODBUS_READ_DISCRETE_INPUTS:
                 for (i=0; i<maxChans && offset<modbusLength_; i++) {
@@ -1170,13 +1553,13 @@ asynStatus drvModbusAsyn::readFloat64Array (asynUser *pasynUser, epicsFloat64 *d
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s invalid request for Modbus"
                           " function %d\n",
-                          driverName, functionName, this->portName, modbusFunction_);
+                          driverName, functionName, this->portName, blockFunction);
                 return asynError;
         }
         asynPrintIO(pasynUserSelf, ASYN_TRACEIO_DRIVER,
                     (char *)data_, i*2,
                     "%s::%sArray port %s, function=0x%x\n",
-                    driverName, functionName, this->portName, modbusFunction_);
+                    driverName, functionName, this->portName, blockFunction);
     }
     else if (function == P_ReadHistogram) {
         for (i=0; i<maxChans && i<HISTOGRAM_LENGTH; i++) {
@@ -1245,8 +1628,7 @@ asynStatus drvModbusAsyn::writeFloat64Array(asynUser *pasynUser, epicsFloat64 *d
                     outIndex += bufferLen;
                     nwrite += bufferLen;
                 }
-                status = doModbusIO(modbusSlave_, modbusFunction_,
-                                    modbusAddress, dataAddress, nwrite);
+                status = writeArrayRegisters(modbusAddress, dataAddress, nwrite);
                 if (status != asynSuccess) return(status);
                 break;
             default:
@@ -1282,23 +1664,25 @@ asynStatus drvModbusAsyn::readInt32Array (asynUser *pasynUser, epicsInt32 *data,
     size_t i;
     int bufferLen;
     int modbusFunction;
+    int blockFunction;
     asynStatus status;
     static const char *functionName="readInt32Array";
 
     *nactual = 0;
     pasynManager->getAddr(pasynUser, &offset);
     if (function == P_Data) {
+        blockFunction = pollBlockFunction(offset);
         if (absoluteAddressing_) {
             /* If absolute addressing then there is no poller running */
             if (checkModbusFunction(&modbusFunction)) return asynError;
-            ioStatus_ = doModbusIO(modbusSlave_, modbusFunction,
-                                   offset, data_, std::min((int)maxChans, modbusLength_));
+            ioStatus_ = readAbsolute(modbusFunction, offset, std::min((int)maxChans, modbusLength_));
             if (ioStatus_ != asynSuccess) return(ioStatus_);
             offset = 0;
         } else {
-            if (ioStatus_ != asynSuccess) return(ioStatus_);
+            status = pollDemanded(offset);
+            if (status != asynSuccess) return(status);
         }
-        switch(modbusFunction_) {
+        switch(blockFunction) {
             case MODBUS_READ_COILS:
             case MODBUS_READ_DISCRETE_INPUTS:
                 for (i=0; i<maxChans && offset<modbusLength_; i++) {
@@ -1339,13 +1723,13 @@ asynStatus drvModbusAsyn::readInt32Array (asynUser *pasynUser, epicsInt32 *data,
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s invalid request for Modbus"
                           " function %d\n",
-                          driverName, functionName, this->portName, modbusFunction_);
+                          driverName, functionName, this->portName, blockFunction);
                 return asynError;
         }
         asynPrintIO(pasynUserSelf, ASYN_TRACEIO_DRIVER,
                     (char *)data_, i*2,
                     "%s::%sArray port %s, function=0x%x\n",
-                    driverName, functionName, this->portName, modbusFunction_);
+                    driverName, functionName, this->portName, blockFunction);
     }
     else if (function == P_ReadHistogram) {
         for (i=0; i<maxChans && i<HISTOGRAM_LENGTH; i++) {
@@ -1415,8 +1799,7 @@ asynStatus drvModbusAsyn::writeInt32Array(asynUser *pasynUser, epicsInt32 *data,
                     outIndex += bufferLen;
                     nwrite += bufferLen;
                 }
-                status = doModbusIO(modbusSlave_, modbusFunction_,
-                                    modbusAddress, dataAddress, nwrite);
+                status = writeArrayRegisters(modbusAddress, dataAddress, nwrite);
                 if (status != asynSuccess) return(status);
                 break;
             default:
@@ -1451,6 +1834,8 @@ asynStatus drvModbusAsyn::readOctet(asynUser *pasynUser, char *data, size_t maxC
     int offset;
     int bufferLen;
     int modbusFunction;
+    int blockFunction;
+    asynStatus status;
     static const char *functionName="readOctet";
 
     maxChars = getStringLen(pasynUser, maxChars);
@@ -1458,17 +1843,24 @@ asynStatus drvModbusAsyn::readOctet(asynUser *pasynUser, char *data, size_t maxC
     *nactual = 0;
     pasynManager->getAddr(pasynUser, &offset);
     if (function == P_Data) {
+        if (checkOffset(offset, 1)) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s::%s port %s invalid offset %d\n",
+                      driverName, functionName, this->portName, offset);
+            return asynError;
+        }
+        blockFunction = pollBlockFunction(offset);
         if (absoluteAddressing_) {
             /* If absolute addressing then there is no poller running */
             if (checkModbusFunction(&modbusFunction)) return asynError;
-            ioStatus_ = doModbusIO(modbusSlave_, modbusFunction,
-                                   offset, data_, std::min((int)maxChars, modbusLength_));
+            ioStatus_ = readAbsolute(modbusFunction, offset, std::min((int)maxChars, modbusLength_));
             if (ioStatus_ != asynSuccess) return(ioStatus_);
             offset = 0;
         } else {
-            if (ioStatus_ != asynSuccess) return(ioStatus_);
+            status = pollDemanded(offset);
+            if (status != asynSuccess) return(status);
         }
-        switch(modbusFunction_) {
+        switch(blockFunction) {
             case MODBUS_WRITE_MULTIPLE_REGISTERS:
             case MODBUS_WRITE_MULTIPLE_REGISTERS_F23:
                 if (!readOnceDone_) return asynError;
@@ -1484,13 +1876,13 @@ asynStatus drvModbusAsyn::readOctet(asynUser *pasynUser, char *data, size_t maxC
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s invalid request for Modbus"
                           " function %d\n",
-                          driverName, functionName, this->portName, modbusFunction_);
+                          driverName, functionName, this->portName, blockFunction);
                 return asynError;
         }
         asynPrintIO(pasynUserSelf, ASYN_TRACEIO_DRIVER,
                     (char *)data_, *nactual,
                     "%s::%s port %s, function=0x%x\n",
-                    driverName, functionName, this->portName, modbusFunction_);
+                    driverName, functionName, this->portName, blockFunction);
     }
     else {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
@@ -1584,141 +1976,267 @@ static void readPollerC(void *drvPvt)
 }
 
 
+static void writeFlusherC(void *drvPvt)
+{
+    drvModbusAsyn *pPvt = (drvModbusAsyn *)drvPvt;
+
+    pPvt->writeFlusher();
+}
+
+/* Thread that does the writes queued by writeMultipleRegisters() when the write window expires.
+ * Only created if the WRITE_WINDOW parameter is set on a function 16 port. */
+void drvModbusAsyn::writeFlusher()
+{
+    double wait;
+
+    lock();
+    while (!modbusExiting_) {
+        wait = 0.;
+        if (!pendingWrites_.empty()) {
+            wait = writeDeadline_ - modbusPollEngine::now();
+            if (wait <= 0.) {
+                flushWrites();
+                continue;
+            }
+        }
+        unlock();
+        if (wait > 0.) {
+            epicsEventWaitWithTimeout(writeFlushEventId_, wait);
+        } else {
+            epicsEventWait(writeFlushEventId_);
+        }
+        lock();
+    }
+    if (!pendingWrites_.empty()) flushWrites();
+    unlock();
+    epicsEventSignal(writeFlushDoneEventId_);
+}
+
+/* Called at exit, after modbusExiting_ is set.  Wakes up the write flusher, if there is one,
+ * and waits for it to write the registers that are still queued. */
+void drvModbusAsyn::stopWriteFlusher()
+{
+    if (!writeFlushThreadId_) return;
+    epicsEventSignal(writeFlushEventId_);
+    epicsEventWait(writeFlushDoneEventId_);
+}
+
+
 /*
 ****************************************************************************
 ** Poller thread for port reads
-   One instance spawned per asyn port
+   One instance spawned per asyn port, unless the octet port scheduler or the shared poll engine is used
 ****************************************************************************
 */
 
 void drvModbusAsyn::readPoller()
 {
-
-    ELLLIST *pclientList;
-    interruptNode *pnode;
-    int offset;
-    int bufferLen;
-    int anyChanged;
-    asynStatus prevIOStatus=asynSuccess;
-    asynUser *pasynUser;
-    int i;
-    epicsUInt16 newValue, prevValue, mask;
-    epicsUInt32 uInt32Value;
-    epicsInt32 int32Value;
-    epicsInt64 int64Value;
-    epicsFloat64 float64Value;
-    modbusDataType_t dataType;
-    char stringBuffer[MAX_READ_WORDS * 2];
-    epicsUInt16 *prevData;     /* Previous contents of memory buffer */
-    epicsInt32 *int32Data;     /* Buffer used for asynInt32Array callbacks */
-    epicsFloat64 *float64Data; /* Buffer used for asynFloat64Array callbacks */
-    static const char *functionName="readPoller";
-
-    prevData = (epicsUInt16 *) callocMustSucceed(modbusLength_, sizeof(epicsUInt16),
-                                 "drvModbusAsyn::readPoller");
-    int32Data = (epicsInt32 *) callocMustSucceed(modbusLength_, sizeof(epicsInt32),
-                                 "drvModbusAsyn::readPoller");
-    float64Data = (epicsFloat64 *) callocMustSucceed(modbusLength_, sizeof(epicsFloat64),
-                                 "drvModbusAsyn::readPoller");
-
-    lock();
+    double delay = pollDelay_;
 
     /* Loop forever */
     while (1)
     {
-        /* Sleep for the poll delay or waiting for epicsEvent with the port unlocked */
-        unlock();
-        if (pollDelay_ > 0.0) {
-            epicsEventWaitWithTimeout(readPollerEventId_, pollDelay_);
+        /* Sleep for the poll delay or waiting for epicsEvent */
+        if (delay > 0.0) {
+            epicsEventWaitWithTimeout(readPollerEventId_, delay);
         } else {
             epicsEventWait(readPollerEventId_);
         }
 
         if (modbusExiting_) break;
 
-        /* Lock the port.  It is important that the port be locked so other threads cannot access the pPlc
-         * structure while the poller thread is running. */
-        lock();
+        delay = readPollerCycle();
+    }
+}
 
-        /* Read the data */
-        ioStatus_ = doModbusIO(modbusSlave_, modbusFunction_,
-                               modbusStartAddress_, data_, modbusLength_);
-        /* If we have an I/O error this time and the previous time, just try again */
-        if (ioStatus_ != asynSuccess &&
-            ioStatus_ == prevIOStatus) {
-            epicsThreadSleep(1.0);
-            continue;
+/** Runs one poll cycle: reads the data from the device and does callbacks to device support.
+  * This is called from the poller thread for this port, from the scheduler for the octet port,
+  * or from a thread in the shared poll engine.
+  * Returns the time in seconds until the next cycle should be run, or a negative number if the next
+  * cycle should only run when the poller is woken with wakeReadPoller(). */
+double drvModbusAsyn::readPollerCycle()
+{
+    double nextDelay;
+    double backoffWait;
+    double phaseWait;
+    int numActive;
+    bool probe;
+    bool anyCallbacks;
+    size_t i, j;
+
+    if (modbusExiting_) return -1.;
+
+    /* Lock the port.  It is important that the port be locked so other threads cannot access the pPlc
+     * structure while the poller is running. */
+    lock();
+    nextDelay = (pollDelay_ > 0.0) ? pollDelay_ : -1.;
+
+    /* Don't do callbacks until EPICS interruptAccept flag is set,
+     * because they go to device support.  The data are only read once before that. */
+    if (!interruptAccept && firstPollDone_) {
+        unlock();
+        return 0.1;
+    }
+
+    /* Delay the first poll after iocInit, or after the poll delay or phase is changed, to the phase of this port,
+     * so that ports with the same poll delay do not all poll at the same time */
+    if (!pollPhaseDone_ && interruptAccept && (pollDelay_ > 0.0)) {
+        pollPhaseDone_ = true;
+        resetPollStatistics();
+        phaseWait = pollPhaseDelay();
+        if (phaseWait > 0.) {
+            unlock();
+            return phaseWait;
         }
+    }
 
-        /* If the I/O status has changed then force callbacks */
-        if (ioStatus_ != prevIOStatus) forceCallback_ = true;
+    /* If the octet port is failing only one port tries the I/O when the backoff delay expires */
+    if (!backoff_->acquire(&probe, &backoffWait)) {
+        unlock();
+        return ((nextDelay > 0.0) && (nextDelay < backoffWait)) ? backoffWait : nextDelay;
+    }
 
-        /* See if any memory location has actually changed.
-         * If not, no need to do callbacks. */
-        anyChanged = memcmp(data_, prevData,
-                            modbusLength_*sizeof(epicsUInt16));
+    updatePollStatistics(modbusPollEngine::now());
 
-        /* Don't start polling until EPICS interruptAccept flag is set,
-         * because it does callbacks to device support. */
-        while (!interruptAccept) {
+    /* In demand mode only the blocks that clients are interested in are read.  The attempt after
+     * a backoff delay reads all of them, because the result must be reported to the backoff. */
+    numActive = (int)pollTransactions_.size();
+    if (pollIdleDelay_ != 0.0) {
+        numActive = selectPollBlocks(pollStart_, probe);
+        if (numActive == 0) {
+            nextDelay = nextPollDelay();
             unlock();
-            epicsThreadSleep(0.1);
-            lock();
-        }
-
-        /* Process callbacks to device support. */
-
-        /* See if there are any asynUInt32Digital callbacks registered to be called
-         * when data changes.  These callbacks only happen if the value has changed */
-        if (forceCallback_ || anyChanged){
-            pasynManager->interruptStart(asynStdInterfaces.uInt32DigitalInterruptPvt, &pclientList);
-            pnode = (interruptNode *)ellFirst(pclientList);
-            asynUInt32DigitalInterrupt *pUInt32D;
-            while (pnode) {
-                pUInt32D = (asynUInt32DigitalInterrupt *)pnode->drvPvt;
-                pasynUser = pUInt32D->pasynUser;
-                if (pasynUser->reason != P_Data) {
-                    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                              "%s::%s port %s invalid pasynUser->reason %d\n",
-                              driverName, functionName, this->portName, pasynUser->reason);
-                    break;
-                }
-                pasynManager->getAddr(pasynUser, &offset);
-                if (checkOffset(offset)) {
-                    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                              "%s::%s port %s invalid offset %d, max=%d\n",
-                              driverName, functionName, this->portName, offset, modbusLength_);
-                    break;
-                }
-                mask = pUInt32D->mask;
-                newValue = data_[offset];
-                if ((mask != 0 ) && (mask != 0xFFFF)) newValue &= mask;
-                prevValue = prevData[offset];
-                if ((mask != 0 ) && (mask != 0xFFFF)) prevValue &= mask;
-                /* Set the status flag in pasynUser so I/O Intr scanned records can set alarm status */
-                pasynUser->auxStatus = ioStatus_;
-                if (forceCallback_ || (newValue != prevValue)) {
-                    uInt32Value = newValue;
-                    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                              "%s::%s, calling asynUInt32Digital client %p"
-                              " mask=0x%x, callback=%p, data=0x%x\n",
-                              driverName, functionName, pUInt32D, pUInt32D->mask, pUInt32D->callback, uInt32Value);
-                    pUInt32D->callback(pUInt32D->userPvt, pasynUser, uInt32Value);
-                }
-                pnode = (interruptNode *)ellNext(&pnode->node);
-            }
-            pasynManager->interruptEnd(asynStdInterfaces.uInt32DigitalInterruptPvt);
+            return nextDelay;
+        }
+    }
+
+    /* Read the data.  If there are several blocks they are read with pipelined transactions
+     * if the interpose driver supports it. */
+    linkError_ = false;
+    if (numActive < (int)pollTransactions_.size()) {
+        ioStatus_ = doModbusIOPipelined(&pollActive_[0], numActive);
+    } else if (pollTransactions_.size() > 1) {
+        ioStatus_ = doModbusIOPipelined(&pollTransactions_[0], (int)pollTransactions_.size());
+    } else if (coalesceGroup_) {
+        /* Use data read for another port in the group if it is less than half a poll period old */
+        ioStatus_ = coalesceGroup_->read(this, coalesceMember_, data_,
+                                         (pollDelay_ > 0.0) ? pollDelay_/2. : 0.);
+    } else {
+        ioStatus_ = doModbusIO(modbusSlave_, modbusFunction_,
+                               modbusStartAddress_, data_, modbusLength_);
+    }
+    /* Only the failures of the link are reported to the backoff, which is shared with the other ports on the
+     * octet port.  An exception reply, for example to a block with addresses that the device does not have,
+     * shows that the link works. */
+    if (linkError_) {
+        backoff_->failed(probe);
+    } else if (probe) {
+        backoff_->succeeded();
+    }
+    firstPollDone_ = true;
+
+    /* Each block keeps the status of its own read, so that a block that fails, for example because
+     * it includes addresses that the device does not have, does not stop the callbacks of the others */
+    for (i=0, j=0; i<pollBlocks_.size(); i++) {
+        if (numActive < (int)pollTransactions_.size()) {
+            if (pollBlocks_[i].active) pollBlocks_[i].status = pollActive_[j++].status;
+        } else if (pollTransactions_.size() > 1) {
+            pollBlocks_[i].status = pollTransactions_[i].status;
+        } else {
+            pollBlocks_[i].status = ioStatus_;
+        }
+    }
+
+    /* If every block has the same I/O error as the previous time, wait for the backoff before trying again.
+     * If the status of a block has changed then the callbacks for its clients are forced. */
+    anyCallbacks = pollBlocks_.empty();
+    for (i=0; i<pollBlocks_.size(); i++) {
+        if ((pollBlocks_[i].status == asynSuccess) ||
+            (pollBlocks_[i].status != pollBlocks_[i].prevStatus)) anyCallbacks = true;
+    }
+    if (!anyCallbacks) {
+        nextDelay = nextPollDelay();
+        unlock();
+        return nextDelay;
+    }
+
+    if (!interruptAccept) {
+        for (i=0; i<pollBlocks_.size(); i++) {
+            pollBlocks_[i].prevStatus = pollBlocks_[i].status;
         }
+        unlock();
+        return 0.1;
+    }
+
+    doDataCallbacks(false);
+
+    nextDelay = nextPollDelay();
+    unlock();
+    return nextDelay;
+}
+
+/** Returns true if the I/O of the last poll cycle failed without a reply, for example with a timeout */
+bool drvModbusAsyn::pollLinkFailed()
+{
+    bool failed;
+
+    lock();
+    failed = linkError_;
+    unlock();
+    return failed;
+}
+
+/** Does the callbacks to the I/O Intr clients whose data in data_ have changed since the last call,
+  * or to all clients if forceCallback_ is set.  The clients of a poll block that had the same I/O error
+  * the last time are skipped, and the callbacks of a block whose status has changed are forced.
+  * Must be called with the lock held.
+  * \param[in] changedOnly If true only the clients whose data have changed are called back, even if they
+  *            are called back on every poll, and forced callbacks are left for the next poll.
+  *            This is used for the changes made by writes between polls. */
+void drvModbusAsyn::doDataCallbacks(bool changedOnly)
+{
+    ELLLIST *pclientList;
+    interruptNode *pnode;
+    int offset;
+    int bufferLen;
+    int anyChanged;
+    int block;
+    int generation;
+    bool force;
+    asynUser *pasynUser;
+    int i;
+    size_t j;
+    epicsUInt16 newValue, prevValue, mask;
+    epicsUInt32 uInt32Value;
+    epicsInt32 int32Value;
+    epicsInt64 int64Value;
+    epicsFloat64 float64Value;
+    modbusDataType_t dataType;
+    char stringBuffer[MAX_READ_WORDS * 2];
+    std::vector<modbusCallbackEntry_t>::iterator pEntry;
+    static const char *functionName="doDataCallbacks";
+
+    /* Find which memory locations have actually changed.
+     * If none have, no need to do callbacks except those that are done on every poll.
+     * Clients whose locations have not changed are skipped. */
+    changedWords_.resize(MODBUS_DIFF_BITMAP_SIZE(modbusLength_));
+    anyChanged = modbusDiffWords(data_, prevData_, modbusLength_, &changedWords_[0]);
+    /* A change in the status of a block is also a change for the clients that are only called back on change */
+    for (j=0; j<pollBlocks_.size(); j++) {
+        if (pollBlocks_[j].status != pollBlocks_[j].prevStatus) anyChanged = 1;
+    }
+
+    /* Process callbacks to device support. */
 
-        /* See if there are any asynInt32 callbacks registered to be called.
-         * These are called even if the data has not changed, because we could be doing
-         * ADC averaging */
-        pasynManager->interruptStart(asynStdInterfaces.int32InterruptPvt, &pclientList);
+    /* See if there are any asynUInt32Digital callbacks registered to be called
+     * when data changes.  These callbacks only happen if the value has changed */
+    if (forceCallback_ || anyChanged){
+        pasynManager->interruptStart(asynStdInterfaces.uInt32DigitalInterruptPvt, &pclientList);
         pnode = (interruptNode *)ellFirst(pclientList);
+        asynUInt32DigitalInterrupt *pUInt32D;
         while (pnode) {
-            asynInt32Interrupt *pInt32;
-            pInt32 = (asynInt32Interrupt *)pnode->drvPvt;
-            pasynUser = pInt32->pasynUser;
+            pUInt32D = (asynUInt32DigitalInterrupt *)pnode->drvPvt;
+            pasynUser = pUInt32D->pasynUser;
             if (pasynUser->reason != P_Data) {
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s invalid pasynUser->reason %d\n",
@@ -1726,71 +2244,196 @@ void drvModbusAsyn::readPoller()
                 break;
             }
             pasynManager->getAddr(pasynUser, &offset);
-            if (checkOffset(offset)) {
+            if (checkOffset(offset, 1)) {
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                          "%s::%s port %s invalid memory request %d, max=%d\n",
+                          "%s::%s port %s invalid offset %d, max=%d\n",
                           driverName, functionName, this->portName, offset, modbusLength_);
                 break;
             }
-            dataType = getDataType(pasynUser);
-            readPlcInt32(dataType, offset, &int32Value, &bufferLen);
+            block = findPollBlock(offset);
+            if (!pollBlockCallbacks(block, changedOnly, &force)) {
+                pnode = (interruptNode *)ellNext(&pnode->node);
+                continue;
+            }
+            mask = pUInt32D->mask;
+            newValue = data_[offset];
+            if ((mask != 0 ) && (mask != 0xFFFF)) newValue &= mask;
+            prevValue = prevData_[offset];
+            if ((mask != 0 ) && (mask != 0xFFFF)) prevValue &= mask;
             /* Set the status flag in pasynUser so I/O Intr scanned records can set alarm status */
-            pasynUser->auxStatus = ioStatus_;
-            asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                      "%s::%s, calling asynInt32 client %p"
-                      " callback=%p, data=0x%x\n",
-                      driverName, functionName, pInt32, pInt32->callback, int32Value);
-            pInt32->callback(pInt32->userPvt, pasynUser,
-                             int32Value);
+            pasynUser->auxStatus = pollBlockStatus(block);
+            if (force || (newValue != prevValue)) {
+                uInt32Value = newValue;
+                asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+                          "%s::%s, calling asynUInt32Digital client %p"
+                          " mask=0x%x, callback=%p, data=0x%x\n",
+                          driverName, functionName, pUInt32D, pUInt32D->mask, pUInt32D->callback, uInt32Value);
+                pUInt32D->callback(pUInt32D->userPvt, pasynUser, uInt32Value);
+            }
             pnode = (interruptNode *)ellNext(&pnode->node);
         }
-        pasynManager->interruptEnd(asynStdInterfaces.int32InterruptPvt);
+        pasynManager->interruptEnd(asynStdInterfaces.uInt32DigitalInterruptPvt);
+    }
+
+    /* Do the asynInt32 callbacks from the callback table.
+     * These are called even if the data has not changed, because we could be doing
+     * ADC averaging, unless the client asked for callbacks on change only */
+    generation = epicsAtomicGetIntT(&interruptGeneration_);
+    pasynManager->interruptStart(asynStdInterfaces.int32InterruptPvt, &pclientList);
+    updateCallbackTable(&int32Callbacks_, pclientList, asynInt32Type, generation);
+    for (pEntry = int32Callbacks_.entries.begin(); pEntry != int32Callbacks_.entries.end(); ++pEntry) {
+        if (!pollBlockCallbacks(pEntry->block, changedOnly, &force)) continue;
+        if (!force && (pEntry->onChange || changedOnly) && !wordsChanged(pEntry->offset, pEntry->width)) continue;
+        asynInt32Interrupt *pInt32 = (asynInt32Interrupt *)pEntry->pInterrupt;
+        readPlcInt32(pEntry->dataType, pEntry->offset, &int32Value, &bufferLen);
+        /* Set the status flag in pasynUser so I/O Intr scanned records can set alarm status */
+        pEntry->pasynUser->auxStatus = pollBlockStatus(pEntry->block);
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+                  "%s::%s, calling asynInt32 client %p"
+                  " callback=%p, data=0x%x\n",
+                  driverName, functionName, pInt32, pInt32->callback, int32Value);
+        pInt32->callback(pInt32->userPvt, pEntry->pasynUser,
+                         int32Value);
+    }
+    pasynManager->interruptEnd(asynStdInterfaces.int32InterruptPvt);
+
+    /* Do the asynInt64 callbacks from the callback table.
+     * These are called even if the data has not changed, because we could be doing
+     * ADC averaging, unless the client asked for callbacks on change only */
+    generation = epicsAtomicGetIntT(&interruptGeneration_);
+    pasynManager->interruptStart(asynStdInterfaces.int64InterruptPvt, &pclientList);
+    updateCallbackTable(&int64Callbacks_, pclientList, asynInt64Type, generation);
+    for (pEntry = int64Callbacks_.entries.begin(); pEntry != int64Callbacks_.entries.end(); ++pEntry) {
+        if (!pollBlockCallbacks(pEntry->block, changedOnly, &force)) continue;
+        if (!force && (pEntry->onChange || changedOnly) && !wordsChanged(pEntry->offset, pEntry->width)) continue;
+        asynInt64Interrupt *pInt64 = (asynInt64Interrupt *)pEntry->pInterrupt;
+        readPlcInt64(pEntry->dataType, pEntry->offset, &int64Value, &bufferLen);
+        /* Set the status flag in pasynUser so I/O Intr scanned records can set alarm status */
+        pEntry->pasynUser->auxStatus = pollBlockStatus(pEntry->block);
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+                  "%s::%s, calling asynInt64 client %p"
+                  " callback=%p, data=0x%llx\n",
+                  driverName, functionName, pInt64, pInt64->callback, int64Value);
+        pInt64->callback(pInt64->userPvt, pEntry->pasynUser,
+                         int64Value);
+    }
+    pasynManager->interruptEnd(asynStdInterfaces.int64InterruptPvt);
+
+    /* Do the asynFloat64 callbacks from the callback table.
+     * These are called even if the data has not changed, because we could be doing
+     * ADC averaging, unless the client asked for callbacks on change only */
+    generation = epicsAtomicGetIntT(&interruptGeneration_);
+    pasynManager->interruptStart(asynStdInterfaces.float64InterruptPvt, &pclientList);
+    updateCallbackTable(&float64Callbacks_, pclientList, asynFloat64Type, generation);
+    for (pEntry = float64Callbacks_.entries.begin(); pEntry != float64Callbacks_.entries.end(); ++pEntry) {
+        if (!pollBlockCallbacks(pEntry->block, changedOnly, &force)) continue;
+        if (!force && (pEntry->onChange || changedOnly) && !wordsChanged(pEntry->offset, pEntry->width)) continue;
+        asynFloat64Interrupt *pFloat64 = (asynFloat64Interrupt *)pEntry->pInterrupt;
+        readPlcFloat(pEntry->dataType, pEntry->offset, &float64Value, &bufferLen);
+        /* Set the status flag in pasynUser so I/O Intr scanned records can set alarm status */
+        pEntry->pasynUser->auxStatus = pollBlockStatus(pEntry->block);
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+                  "%s::%s, calling asynFloat64 client %p"
+                  " callback=%p, data=%f\n",
+                  driverName, functionName, pFloat64, pFloat64->callback, float64Value);
+        pFloat64->callback(pFloat64->userPvt, pEntry->pasynUser,
+                           float64Value);
+    }
+    pasynManager->interruptEnd(asynStdInterfaces.float64InterruptPvt);
+
 
-        /* See if there are any asynInt64 callbacks registered to be called.
-         * These are called even if the data has not changed, because we could be doing
-         * ADC averaging */
-        pasynManager->interruptStart(asynStdInterfaces.int64InterruptPvt, &pclientList);
+    /* See if there are any asynInt32Array callbacks registered to be called.
+     * These are only called when data changes */
+    if (forceCallback_ || anyChanged){
+        pasynManager->interruptStart(asynStdInterfaces.int32ArrayInterruptPvt, &pclientList);
         pnode = (interruptNode *)ellFirst(pclientList);
         while (pnode) {
-            asynInt64Interrupt *pInt64;
-            pInt64 = (asynInt64Interrupt *)pnode->drvPvt;
-            pasynUser = pInt64->pasynUser;
+            asynInt32ArrayInterrupt *pInt32Array;
+            pInt32Array = (asynInt32ArrayInterrupt *)pnode->drvPvt;
+            pasynUser = pInt32Array->pasynUser;
             if (pasynUser->reason != P_Data) {
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s invalid pasynUser->reason %d\n",
                           driverName, functionName, this->portName, pasynUser->reason);
                 break;
             }
+            /* Need to copy data to epicsInt32 buffer for callback */
             pasynManager->getAddr(pasynUser, &offset);
-            if (checkOffset(offset)) {
-                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                          "%s::%s port %s invalid memory request %d, max=%d\n",
-                          driverName, functionName, this->portName, offset, modbusLength_);
-                break;
+            block = findPollBlock(offset);
+            if (!pollBlockCallbacks(block, changedOnly, &force) ||
+                (!force && !wordsChanged(offset, modbusLength_ - offset))) {
+                pnode = (interruptNode *)ellNext(&pnode->node);
+                continue;
             }
             dataType = getDataType(pasynUser);
-            readPlcInt64(dataType, offset, &int64Value, &bufferLen);
+            for (i=0; i<modbusLength_ && offset < modbusLength_; i++) {
+                readPlcInt32(dataType, offset, &int32Data_[i], &bufferLen);
+                offset += bufferLen;
+            }
             /* Set the status flag in pasynUser so I/O Intr scanned records can set alarm status */
-            pasynUser->auxStatus = ioStatus_;
+            pasynUser->auxStatus = pollBlockStatus(block);
             asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                      "%s::%s, calling asynInt64 client %p"
-                      " callback=%p, data=0x%llx\n",
-                      driverName, functionName, pInt64, pInt64->callback, int64Value);
-            pInt64->callback(pInt64->userPvt, pasynUser,
-                             int64Value);
+                      "%s::%s, calling client %p"
+                      "callback=%p\n",
+                       driverName, functionName, pInt32Array, pInt32Array->callback);
+            pInt32Array->callback(pInt32Array->userPvt, pasynUser,
+                                  int32Data_, i);
+            pnode = (interruptNode *)ellNext(&pnode->node);
+        }
+        pasynManager->interruptEnd(asynStdInterfaces.int32ArrayInterruptPvt);
+    }
+
+    /* See if there are any asynFloat64Array callbacks registered to be called.
+     * These are called even if the data has not changed, because we could be doing
+     * ADC averaging, unless the client asked for callbacks on change only */
+    pasynManager->interruptStart(asynStdInterfaces.float64ArrayInterruptPvt, &pclientList);
+    pnode = (interruptNode *)ellFirst(pclientList);
+    while (pnode) {
+        asynFloat64ArrayInterrupt *pFloat64Array;
+        pFloat64Array = (asynFloat64ArrayInterrupt *)pnode->drvPvt;
+        pasynUser = pFloat64Array->pasynUser;
+        if (pasynUser->reason != P_Data) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s::%s port %s invalid pasynUser->reason %d\n",
+                      driverName, functionName, this->portName, pasynUser->reason);
+            break;
+        }
+        /* Need to copy data to epicsFloat64 buffer for callback */
+        pasynManager->getAddr(pasynUser, &offset);
+        block = findPollBlock(offset);
+        /* Skip the clients whose data have not changed before decoding the array */
+        if (!pollBlockCallbacks(block, changedOnly, &force) ||
+            (!force && (changedOnly ? !wordsChanged(offset, modbusLength_ - offset) :
+                                      !clientDataChanged(pasynUser, offset, modbusLength_ - offset)))) {
             pnode = (interruptNode *)ellNext(&pnode->node);
+            continue;
         }
-        pasynManager->interruptEnd(asynStdInterfaces.int64InterruptPvt);
+        dataType = getDataType(pasynUser);
+        for (i=0; i<modbusLength_ && offset < modbusLength_; i++) {
+            readPlcFloat(dataType, offset, &float64Data_[i], &bufferLen);
+            offset += bufferLen;
+        }
+        /* Set the status flag in pasynUser so I/O Intr scanned records can set alarm status */
+        pasynUser->auxStatus = pollBlockStatus(block);
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+                  "%s::%s, calling client %p"
+                  "callback=%p\n",
+                   driverName, functionName, pFloat64Array, pFloat64Array->callback);
+        pFloat64Array->callback(pFloat64Array->userPvt, pasynUser,
+                              float64Data_, i);
+        pnode = (interruptNode *)ellNext(&pnode->node);
+    }
+    pasynManager->interruptEnd(asynStdInterfaces.float64ArrayInterruptPvt);
 
-        /* See if there are any asynFloat64 callbacks registered to be called.
-         * These are called even if the data has not changed, because we could be doing
-         * ADC averaging */
-        pasynManager->interruptStart(asynStdInterfaces.float64InterruptPvt, &pclientList);
+    /* See if there are any asynOctet callbacks registered to be called
+     * when data changes.  These callbacks only happen if any data in this port has changed */
+    if (forceCallback_ || anyChanged){
+        pasynManager->interruptStart(asynStdInterfaces.octetInterruptPvt, &pclientList);
         pnode = (interruptNode *)ellFirst(pclientList);
         while (pnode) {
-            asynFloat64Interrupt *pFloat64;
-            pFloat64 = (asynFloat64Interrupt *)pnode->drvPvt;
-            pasynUser = pFloat64->pasynUser;
+            asynOctetInterrupt *pOctet;
+            pOctet = (asynOctetInterrupt *)pnode->drvPvt;
+            pasynUser = pOctet->pasynUser;
             if (pasynUser->reason != P_Data) {
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s invalid pasynUser->reason %d\n",
@@ -1798,140 +2441,283 @@ void drvModbusAsyn::readPoller()
                 break;
             }
             pasynManager->getAddr(pasynUser, &offset);
-            if (checkOffset(offset)) {
+            dataType = getDataType(pasynUser);
+            if (checkOffset(offset, 1)) {
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                          "%s::%s port %s invalid memory request %d, max=%d\n",
+                          "%s::%s port %s invalid offset %d, max=%d\n",
                           driverName, functionName, this->portName, offset, modbusLength_);
                 break;
             }
-            dataType = getDataType(pasynUser);
-            readPlcFloat(dataType, offset, &float64Value, &bufferLen);
+            /* A string uses at most one register per character */
+            block = findPollBlock(offset);
+            if (!pollBlockCallbacks(block, changedOnly, &force) ||
+                (!force && !wordsChanged(offset, getStringLen(pasynUser, sizeof(stringBuffer))))) {
+                pnode = (interruptNode *)ellNext(&pnode->node);
+                continue;
+            }
+            readPlcString(dataType, offset, stringBuffer, getStringLen(pasynUser, sizeof(stringBuffer)), &bufferLen);
             /* Set the status flag in pasynUser so I/O Intr scanned records can set alarm status */
-            pFloat64->pasynUser->auxStatus = ioStatus_;
+            pasynUser->auxStatus = pollBlockStatus(block);
             asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                      "%s::%s, calling asynFloat64 client %p"
-                      " callback=%p, data=%f\n",
-                      driverName, functionName, pFloat64, pFloat64->callback, float64Value);
-            pFloat64->callback(pFloat64->userPvt, pasynUser,
-                               float64Value);
+                      "%s::%s, calling client %p"
+                      " callback=%p, data=%s\n",
+                      driverName, functionName, pOctet, pOctet->callback, stringBuffer);
+            pOctet->callback(pOctet->userPvt, pasynUser, stringBuffer, bufferLen, ASYN_EOM_CNT);
             pnode = (interruptNode *)ellNext(&pnode->node);
         }
-        pasynManager->interruptEnd(asynStdInterfaces.float64InterruptPvt);
-
-
-        /* See if there are any asynInt32Array callbacks registered to be called.
-         * These are only called when data changes */
-        if (forceCallback_ || anyChanged){
-            pasynManager->interruptStart(asynStdInterfaces.int32ArrayInterruptPvt, &pclientList);
-            pnode = (interruptNode *)ellFirst(pclientList);
-            while (pnode) {
-                asynInt32ArrayInterrupt *pInt32Array;
-                pInt32Array = (asynInt32ArrayInterrupt *)pnode->drvPvt;
-                pasynUser = pInt32Array->pasynUser;
-                if (pasynUser->reason != P_Data) {
-                    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                              "%s::%s port %s invalid pasynUser->reason %d\n",
-                              driverName, functionName, this->portName, pasynUser->reason);
-                    break;
-                }
-                /* Need to copy data to epicsInt32 buffer for callback */
-                pasynManager->getAddr(pasynUser, &offset);
-                dataType = getDataType(pasynUser);
-                for (i=0; i<modbusLength_ && offset < modbusLength_; i++) {
-                    readPlcInt32(dataType, offset, &int32Data[i], &bufferLen);
-                    offset += bufferLen;
-                }
-                /* Set the status flag in pasynUser so I/O Intr scanned records can set alarm status */
-                pasynUser->auxStatus = ioStatus_;
-                asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                          "%s::%s, calling client %p"
-                          "callback=%p\n",
-                           driverName, functionName, pInt32Array, pInt32Array->callback);
-                pInt32Array->callback(pInt32Array->userPvt, pasynUser,
-                                      int32Data, i);
-                pnode = (interruptNode *)ellNext(&pnode->node);
-            }
-            pasynManager->interruptEnd(asynStdInterfaces.int32ArrayInterruptPvt);
+        pasynManager->interruptEnd(asynStdInterfaces.octetInterruptPvt);
+    }
+
+    /* Reset the forceCallback flag and the status changes of the blocks */
+    if (!changedOnly) {
+        forceCallback_ = false;
+        for (j=0; j<pollBlocks_.size(); j++) {
+            pollBlocks_[j].prevStatus = pollBlocks_[j].status;
         }
+    }
 
-        /* See if there are any asynFloat64Array callbacks registered to be called.
-         * These are called even if the data has not changed, because we could be doing
-         * ADC averaging */
-        pasynManager->interruptStart(asynStdInterfaces.float64ArrayInterruptPvt, &pclientList);
-        pnode = (interruptNode *)ellFirst(pclientList);
-        while (pnode) {
-            asynFloat64ArrayInterrupt *pFloat64Array;
-            pFloat64Array = (asynFloat64ArrayInterrupt *)pnode->drvPvt;
-            pasynUser = pFloat64Array->pasynUser;
-            if (pasynUser->reason != P_Data) {
-                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                          "%s::%s port %s invalid pasynUser->reason %d\n",
-                          driverName, functionName, this->portName, pasynUser->reason);
+    /* Copy the new data to the previous data */
+    memcpy(prevData_, data_, modbusLength_*sizeof(epicsUInt16));
+}
+
+/* Clears the poll period statistics and the fixed rate schedule.
+ * This is done when the poll delay or the mode changes. */
+void drvModbusAsyn::resetPollStatistics()
+{
+    pollStart_ = 0.;
+    pollDeadline_ = 0.;
+    pollOverruns_ = 0;
+    numPollPeriods_ = 0;
+    pollPeriodMean_ = 0.;
+    pollPeriodM2_ = 0.;
+    pollJitterMin_ = 0.;
+    pollJitterMax_ = 0.;
+    setDoubleParam(P_PollPeriod, 0.);
+    setDoubleParam(P_PollJitterMin, 0.);
+    setDoubleParam(P_PollJitterMax, 0.);
+    setDoubleParam(P_PollJitterStdDev, 0.);
+    setIntegerParam(P_PollOverruns, 0);
+}
+
+/* Records the time at which a poll started and updates the statistics of the actual poll period.
+ * The jitter is the difference between the actual period and the poll delay. */
+void drvModbusAsyn::updatePollStatistics(double start)
+{
+    double period, jitter, delta;
+
+    if ((pollStart_ > 0.) && (pollDelay_ > 0.)) {
+        period = start - pollStart_;
+        jitter = period - pollDelay_;
+        numPollPeriods_++;
+        delta = period - pollPeriodMean_;
+        pollPeriodMean_ += delta / numPollPeriods_;
+        pollPeriodM2_ += delta * (period - pollPeriodMean_);
+        if ((numPollPeriods_ == 1) || (jitter < pollJitterMin_)) pollJitterMin_ = jitter;
+        if ((numPollPeriods_ == 1) || (jitter > pollJitterMax_)) pollJitterMax_ = jitter;
+        setDoubleParam(P_PollPeriod, period * 1000.);
+        setDoubleParam(P_PollJitterMin, pollJitterMin_ * 1000.);
+        setDoubleParam(P_PollJitterMax, pollJitterMax_ * 1000.);
+        setDoubleParam(P_PollJitterStdDev, (numPollPeriods_ > 1) ?
+                       sqrt(pollPeriodM2_ / (numPollPeriods_ - 1)) * 1000. : 0.);
+    }
+    pollStart_ = start;
+}
+
+/* Returns the phase of this port when it is computed automatically.  The ports that use the same
+ * octet port and have the same poll delay are spread evenly over the poll delay, in the order they were created. */
+double drvModbusAsyn::autoPollPhase()
+{
+    int index = 0;
+    int count = 0;
+    size_t i;
+
+    epicsMutexLock(pollPortsMutex);
+    for (i=0; i<pollPorts.size(); i++) {
+        if (pollPorts[i] == this) index = count;
+        /* The other ports may be locked by their own pollers, so their copies of the poll delay are used */
+        if ((strcmp(pollPorts[i]->octetPortName_, octetPortName_) == 0) &&
+            (pollPorts[i]->pollPortsDelay_ == pollDelay_)) count++;
+    }
+    epicsMutexUnlock(pollPortsMutex);
+    return (count > 0) ? index * pollDelay_ / count : 0.;
+}
+
+/* Returns the time until the next poll that is at the phase of this port.
+ * The phase is measured from multiples of the poll delay on the monotonic clock, so the offsets of the
+ * ports with the same poll delay do not depend on when each port started. */
+double drvModbusAsyn::pollPhaseDelay()
+{
+    double phase;
+    double now;
+    double next;
+
+    phase = (pollPhase_ >= 0.) ? pollPhase_ : autoPollPhase();
+    phase = fmod(phase, pollDelay_);
+    now = modbusPollEngine::now();
+    next = now - fmod(now, pollDelay_) + phase;
+    if (next < now) next += pollDelay_;
+    return next - now;
+}
+
+/* Returns the time until the next poll.  In fixed rate mode, which is always used with the
+ * octet port scheduler, the polls are due at multiples of the poll delay after the first poll,
+ * independent of the time taken by each poll.  If a poll ends after the next one was due then
+ * the polls that were missed are skipped and counted as overruns, rather than being run late.
+ * Must be called with the lock held. */
+double drvModbusAsyn::nextPollDelay()
+{
+    double now;
+    int skipped;
+
+    if (pollDelay_ <= 0.0) return -1.;
+    if (!pollFixedRate_ && !scheduleEntry_) return pollDelay_;
+    now = modbusPollEngine::now();
+    if (pollDeadline_ <= 0.) pollDeadline_ = pollStart_;
+    /* Advance the deadline, unless this poll was run early by wakeReadPoller() */
+    if (pollStart_ > pollDeadline_ - pollDelay_/2.) pollDeadline_ += pollDelay_;
+    if (pollDeadline_ <= now) {
+        skipped = (int)((now - pollDeadline_) / pollDelay_) + 1;
+        pollOverruns_ += skipped;
+        pollDeadline_ += skipped * pollDelay_;
+        setIntegerParam(P_PollOverruns, pollOverruns_);
+    }
+    return pollDeadline_ - now;
+}
+
+/** Adds a block of Modbus memory to be polled by the poller of this port.
+  * The block is appended to the end of the port memory, so the asyn address of its first element
+  * is the sum of the lengths of the blocks that were added before it.
+  * The block from the drvModbusAsynConfigure command is always the first block.
+  * A length of 0 is only used by the constructor, to add the first block with the existing memory.
+  * \param[in] function Modbus function code (1, 2, 3 or 4).
+  * \param[in] start Start address of the block.
+  * \param[in] length Length of the block in bits for function codes 1 and 2, or in 16-bit words
+  *            for function codes 3 and 4. */
+asynStatus drvModbusAsyn::addPollBlock(int function, int start, int length)
+{
+    modbusPollBlock_t block;
+    modbusTransaction_t transaction;
+    int maxLength;
+    size_t i;
+    static const char *functionName = "addPollBlock";
+
+    block.hasClients = false;
+    block.interested = true;
+    block.lastRead = 0.;
+    block.lastDemand = 0.;
+    block.active = true;
+    block.status = asynSuccess;
+    block.prevStatus = asynSuccess;
+    if (length == 0) {
+        block.function = function;
+        block.start = start;
+        block.length = modbusLength_;
+        block.offset = 0;
+        lock();
+        pollBlocks_.push_back(block);
+    } else {
+        if (!prevData_) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s::%s port %s does not have a poller\n",
+                      driverName, functionName, this->portName);
+            return asynError;
+        }
+        if (interruptAccept) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s::%s port %s blocks must be added before iocInit\n",
+                      driverName, functionName, this->portName);
+            return asynError;
+        }
+        switch (function) {
+            case MODBUS_READ_COILS:
+            case MODBUS_READ_DISCRETE_INPUTS:
+                maxLength = MAX_READ_WORDS * 16;
                 break;
-            }
-            /* Need to copy data to epicsFloat64 buffer for callback */
-            pasynManager->getAddr(pasynUser, &offset);
-            dataType = getDataType(pasynUser);
-            for (i=0; i<modbusLength_ && offset < modbusLength_; i++) {
-                readPlcFloat(dataType, offset, &float64Data[i], &bufferLen);
-                offset += bufferLen;
-            }
-            /* Set the status flag in pasynUser so I/O Intr scanned records can set alarm status */
-            pasynUser->auxStatus = ioStatus_;
-            asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                      "%s::%s, calling client %p"
-                      "callback=%p\n",
-                       driverName, functionName, pFloat64Array, pFloat64Array->callback);
-            pFloat64Array->callback(pFloat64Array->userPvt, pasynUser,
-                                  float64Data, i);
-            pnode = (interruptNode *)ellNext(&pnode->node);
+            case MODBUS_READ_HOLDING_REGISTERS:
+            case MODBUS_READ_INPUT_REGISTERS:
+                maxLength = MAX_READ_WORDS;
+                break;
+            default:
+                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                          "%s::%s port %s unsupported Modbus function %d\n",
+                          driverName, functionName, this->portName, function);
+                return asynError;
         }
-        pasynManager->interruptEnd(asynStdInterfaces.float64ArrayInterruptPvt);
-
-        /* See if there are any asynOctet callbacks registered to be called
-         * when data changes.  These callbacks only happen if any data in this port has changed */
-        if (forceCallback_ || anyChanged){
-            pasynManager->interruptStart(asynStdInterfaces.octetInterruptPvt, &pclientList);
-            pnode = (interruptNode *)ellFirst(pclientList);
-            while (pnode) {
-                asynOctetInterrupt *pOctet;
-                pOctet = (asynOctetInterrupt *)pnode->drvPvt;
-                pasynUser = pOctet->pasynUser;
-                if (pasynUser->reason != P_Data) {
-                    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                              "%s::%s port %s invalid pasynUser->reason %d\n",
-                              driverName, functionName, this->portName, pasynUser->reason);
-                    break;
-                }
-                pasynManager->getAddr(pasynUser, &offset);
-                dataType = getDataType(pasynUser);
-                if (checkOffset(offset)) {
-                    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                              "%s::%s port %s invalid offset %d, max=%d\n",
-                              driverName, functionName, this->portName, offset, modbusLength_);
-                    break;
-                }
-                readPlcString(dataType, offset, stringBuffer, getStringLen(pasynUser, sizeof(stringBuffer)), &bufferLen);
-                /* Set the status flag in pasynUser so I/O Intr scanned records can set alarm status */
-                pasynUser->auxStatus = ioStatus_;
-                asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                          "%s::%s, calling client %p"
-                          " callback=%p, data=%s\n",
-                          driverName, functionName, pOctet, pOctet->callback, stringBuffer);
-                pOctet->callback(pOctet->userPvt, pasynUser, stringBuffer, bufferLen, ASYN_EOM_CNT);
-                pnode = (interruptNode *)ellNext(&pnode->node);
+        if ((length < 0) || (length > maxLength)) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s::%s port %s invalid length=%d, max=%d\n",
+                      driverName, functionName, this->portName, length, maxLength);
+            return asynError;
+        }
+        if ((start < 0) || (start + length > 65536)) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s::%s port %s invalid start address %d\n",
+                      driverName, functionName, this->portName, start);
+            return asynError;
+        }
+        /* The same Modbus address in two blocks would be two copies in the port memory
+         * that are read at different times */
+        for (i=0; i<pollBlocks_.size(); i++) {
+            if ((pollBlocks_[i].function == function) &&
+                (start < pollBlocks_[i].start + pollBlocks_[i].length) &&
+                (pollBlocks_[i].start < start + length)) {
+                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                          "%s::%s port %s block function=%d start=%d length=%d overlaps block %d\n",
+                          driverName, functionName, this->portName, function, start, length, (int)i);
+                return asynError;
             }
-            pasynManager->interruptEnd(asynStdInterfaces.octetInterruptPvt);
         }
+        /* The reads of a port with several blocks are pipelined instead, it stays in the group
+         * but does not use it.  This is printed by default, because it is a configuration mistake. */
+        if (coalesceGroup_) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s::%s port %s has more than one poll block, its reads are not coalesced\n",
+                      driverName, functionName, this->portName);
+        }
+        block.function = function;
+        block.start = start;
+        block.length = length;
+        lock();
+        block.offset = modbusLength_;
+        pollBlocks_.push_back(block);
+        modbusLength_ += length;
+        data_ = (epicsUInt16 *)realloc(data_, modbusLength_ * sizeof(epicsUInt16));
+        prevData_ = (epicsUInt16 *)realloc(prevData_, modbusLength_ * sizeof(epicsUInt16));
+        int32Data_ = (epicsInt32 *)realloc(int32Data_, modbusLength_ * sizeof(epicsInt32));
+        float64Data_ = (epicsFloat64 *)realloc(float64Data_, modbusLength_ * sizeof(epicsFloat64));
+        if (!data_ || !prevData_ || !int32Data_ || !float64Data_) {
+            cantProceed("%s::%s port %s out of memory\n", driverName, functionName, this->portName);
+        }
+        memset(data_ + block.offset, 0, length * sizeof(epicsUInt16));
+        memset(prevData_ + block.offset, 0, length * sizeof(epicsUInt16));
+    }
 
-        /* Reset the forceCallback flag */
-        forceCallback_ = false;
-
-        /* Set the previous I/O status */
-        prevIOStatus = ioStatus_;
+    /* The buffers may have moved, so rebuild all of the transactions.
+     * The clients of the blocks are found again at the next poll. */
+    pollInterestGeneration_ = -1;
+    pollTransactions_.clear();
+    for (i=0; i<pollBlocks_.size(); i++) {
+        transaction.slave = modbusSlave_;
+        transaction.function = pollBlocks_[i].function;
+        transaction.start = pollBlocks_[i].start;
+        transaction.data = data_ + pollBlocks_[i].offset;
+        transaction.len = pollBlocks_[i].length;
+        transaction.status = asynSuccess;
+        pollTransactions_.push_back(transaction);
+    }
+    unlock();
+    return asynSuccess;
+}
 
-        /* Copy the new data to the previous data */
-        memcpy(prevData, data_, modbusLength_*sizeof(epicsUInt16));
+/** Wakes up the poller so that the next poll cycle is run immediately */
+void drvModbusAsyn::wakeReadPoller()
+{
+    if (scheduleEntry_) {
+        scheduler_->wakePort(scheduleEntry_);
+    } else if (pollEntry_) {
+        modbusPollEngine::getInstance()->wakePort(pollEntry_);
+    } else {
+        epicsEventSignal(readPollerEventId_);
     }
 }
 
@@ -1939,38 +2725,580 @@ void drvModbusAsyn::readPoller()
 asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
                                      epicsUInt16 *data, int len)
 {
-    modbusReadRequest *readReq;
-    modbusReadResponse *readResp;
-    modbusWriteSingleRequest *writeSingleReq;
-    /* modbusWriteSingleResponse *writeSingleResp; */
-    modbusWriteMultipleRequest *writeMultipleReq;
-    /* modbusWriteMultipleResponse *writeMultipleResp; */
-    modbusReadWriteMultipleRequest *readWriteMultipleReq;
-    modbusExceptionResponse *exceptionResp;
     int requestSize=0;
-    int replySize;
-    unsigned char  *pCharIn, *pCharOut;
-    epicsUInt16 *pShortIn, *pShortOut;
-    epicsUInt16 bitOutput;
-    int byteCount;
+    int replySize=0;
     asynStatus status=asynSuccess;
-    int i;
     epicsTimeStamp startTime, endTime;
-    size_t nwrite, nread;
+    size_t nwrite=0, nread=0;
+    int eomReason=0;
+    asynUser *pasynUserOctet, *pasynUserCommon;
+    int connection;
+    double elapsed=0.;
+    static const char *functionName = "doModbusIO";
+
+    beginTransaction();
+    connection = acquireConnection(&pasynUserOctet, &pasynUserCommon);
+    status = checkConnection(pasynUserOctet, pasynUserCommon);
+    if (status == asynSuccess) {
+        status = buildModbusRequest(slave, function, start, data, len, &requestSize, &replySize);
+    }
+    if (status == asynSuccess) {
+        /* Do the Modbus I/O as a write/read cycle */
+        epicsTimeGetCurrent(&startTime);
+        status = pasynOctetSyncIO->writeRead(pasynUserOctet,
+                                             modbusRequest_, requestSize,
+                                             modbusReply_, replySize,
+                                             MODBUS_READ_TIMEOUT,
+                                             &nwrite, &nread, &eomReason);
+        epicsTimeGetCurrent(&endTime);
+        elapsed = epicsTimeDiffInSeconds(&endTime, &startTime);
+        asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
+                  "%s::%s port %s called pasynOctetSyncIO->writeRead, status=%d, requestSize=%d, replySize=%d, nwrite=%d, nread=%d, eomReason=%d\n",
+                  driverName, functionName, this->portName, status, requestSize, replySize, (int)nwrite, (int)nread, eomReason);
+
+        updateIOStatistics(pasynUserOctet, status, &startTime, &endTime, nwrite, requestSize, nread);
+    }
+    releaseConnection(connection, status, elapsed);
+    return endTransaction(slave, function, start, data, len, status);
+}
+
+/* Does the work that must be done before every Modbus transaction, by both doModbusIO() and
+ * doModbusIOPipelined().  Queued writes are done first, so that the device sees the writes in the
+ * order they were made. */
+void drvModbusAsyn::beginTransaction()
+{
+    if (!pendingWrites_.empty()) flushWrites();
+}
+
+/* Does the work that must be done after every Modbus transaction, by both doModbusIO() and
+ * doModbusIOPipelined().  status is the status of the I/O, and if it succeeded the reply in modbusReply_
+ * is parsed.  Returns the status of the transaction. */
+asynStatus drvModbusAsyn::endTransaction(int slave, int function, int start, epicsUInt16 *data, int len,
+                                         asynStatus status)
+{
+    modbusException_ = 0;
+    /* Writes, and the read once done by write ports, may change the cached data */
+    if (function != readCacheFunction_) readCacheLength_ = 0;
+    if (status == asynSuccess) status = parseModbusReply(function, data, len);
+    if (!deltaImages_.empty()) updateDeltaImages(function, start, len, status);
+    if (status == asynSuccess) writeThrough(slave, function, start, data, len);
+    return status;
+}
+
+/* Does a set of Modbus transactions.  If the underlying Modbus/TCP interpose driver allows more than one
+ * outstanding transaction then up to pipelineDepth requests are sent before waiting for the replies,
+ * which are then processed in the order the requests were sent.  Otherwise the transactions are done
+ * one at a time with doModbusIO.  If the octet port is a connection pool all of the transactions are sent
+ * on one connection.
+ * The status of each transaction is returned in transactions[i].status, which is asynError if the
+ * transactions could not be started.
+ * The return value is asynSuccess if all transactions succeeded, otherwise the last error status. */
+asynStatus drvModbusAsyn::doModbusIOPipelined(modbusTransaction_t *transactions, int numTransactions)
+{
+    modbusTransaction_t *pTransaction;
+    asynInterface *pasynInterface;
+    asynOctet *pasynOctet;
+    void *octetPvt;
+    asynUser *pasynUserOctet, *pasynUserCommon;
+    int connection;
+    const char *octetPortName;
+    int pipelineDepth;
+    int outstanding[MODBUS_MAX_PIPELINE_DEPTH];   /* Index of each outstanding transaction */
+    int requestSize[MODBUS_MAX_PIPELINE_DEPTH];
+    int replySize[MODBUS_MAX_PIPELINE_DEPTH];
+    size_t nwrite[MODBUS_MAX_PIPELINE_DEPTH];
+    epicsTimeStamp startTime[MODBUS_MAX_PIPELINE_DEPTH];
+    epicsTimeStamp firstTime, endTime;
+    int head=0, nOutstanding=0, next=0;
+    int slot;
+    int connected;
+    size_t nread;
     int eomReason;
-    double dT;
-    int msec;
-    int bin;
-    unsigned char mask=0;
+    asynStatus status=asynSuccess;
+    int i;
+    static const char *functionName = "doModbusIOPipelined";
+
+    for (i=0; i<numTransactions; i++) {
+        transactions[i].status = asynError;
+    }
+    if (numTransactions <= 0) return asynSuccess;
+    beginTransaction();
+    connection = acquireConnection(&pasynUserOctet, &pasynUserCommon);
+    octetPortName = connectionPool_ ? connectionPool_->octetPortName(connection) : octetPortName_;
+    pipelineDepth = modbusInterposeGetPipelineDepth(octetPortName);
+    if ((pipelineDepth > 1) && (numTransactions > 1)) {
+        status = checkConnection(pasynUserOctet, pasynUserCommon);
+        if (status != asynSuccess) {
+            releaseConnection(connection, status, 0.);
+            return status;
+        }
+        pasynManager->isConnected(pasynUserOctet, &connected);
+        /* If we are not connected let doModbusIO do the I/O so that asynManager can autoconnect */
+        if (!connected) pipelineDepth = 1;
+    }
+    if ((pipelineDepth <= 1) || (numTransactions <= 1)) {
+        if (connectionPool_) connectionPool_->cancel(connection);
+        for (i=0; i<numTransactions; i++) {
+            pTransaction = &transactions[i];
+            pTransaction->status = doModbusIO(pTransaction->slave, pTransaction->function,
+                                              pTransaction->start, pTransaction->data, pTransaction->len);
+            if (pTransaction->status != asynSuccess) status = pTransaction->status;
+        }
+        return status;
+    }
+
+    /* We call the asynOctet methods directly while holding the port lock, so that no other
+     * client can do I/O on the port while our requests are outstanding. */
+    pasynInterface = pasynManager->findInterface(pasynUserOctet, asynOctetType, 1);
+    if (!pasynInterface) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s::%s port %s cannot find asynOctet interface on %s\n",
+                  driverName, functionName, this->portName, octetPortName);
+        releaseConnection(connection, asynError, 0.);
+        return asynError;
+    }
+    pasynOctet = (asynOctet *)pasynInterface->pinterface;
+    octetPvt = pasynInterface->drvPvt;
+    status = pasynManager->lockPort(pasynUserOctet);
+    if (status != asynSuccess) {
+        linkError_ = true;
+        releaseConnection(connection, status, 0.);
+        return status;
+    }
+    pasynOctet->flush(octetPvt, pasynUserOctet);
+    status = asynSuccess;
+    epicsTimeGetCurrent(&firstTime);
+
+    while ((next < numTransactions) || (nOutstanding > 0)) {
+        /* Keep the pipeline full */
+        while ((next < numTransactions) && (nOutstanding < pipelineDepth)) {
+            pTransaction = &transactions[next];
+            slot = (head + nOutstanding) % MODBUS_MAX_PIPELINE_DEPTH;
+            pTransaction->status = buildModbusRequest(pTransaction->slave, pTransaction->function,
+                                                      pTransaction->start, pTransaction->data, pTransaction->len,
+                                                      &requestSize[slot], &replySize[slot]);
+            if (pTransaction->status == asynSuccess) {
+                nwrite[slot] = 0;
+                epicsTimeGetCurrent(&startTime[slot]);
+                pTransaction->status = pasynOctet->write(octetPvt, pasynUserOctet,
+                                                         modbusRequest_, requestSize[slot], &nwrite[slot]);
+                if (pTransaction->status == asynSuccess) {
+                    outstanding[slot] = next;
+                    nOutstanding++;
+                } else {
+                    epicsTimeGetCurrent(&endTime);
+                    updateIOStatistics(pasynUserOctet, pTransaction->status, &startTime[slot], &endTime,
+                                       nwrite[slot], requestSize[slot], 0);
+                }
+            }
+            if (pTransaction->status != asynSuccess) {
+                /* The request was not sent, but the device may have received part of it */
+                pTransaction->status = endTransaction(pTransaction->slave, pTransaction->function,
+                                                      pTransaction->start, pTransaction->data, pTransaction->len,
+                                                      pTransaction->status);
+                status = pTransaction->status;
+            }
+            next++;
+        }
+        if (nOutstanding == 0) continue;
+
+        /* Wait for the reply to the oldest outstanding request */
+        pTransaction = &transactions[outstanding[head]];
+        nread = 0;
+        pTransaction->status = pasynOctet->read(octetPvt, pasynUserOctet,
+                                                modbusReply_, replySize[head], &nread, &eomReason);
+        epicsTimeGetCurrent(&endTime);
+        asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
+                  "%s::%s port %s read reply %d, status=%d, replySize=%d, nread=%d, outstanding=%d\n",
+                  driverName, functionName, this->portName, outstanding[head], pTransaction->status,
+                  replySize[head], (int)nread, nOutstanding);
+        updateIOStatistics(pasynUserOctet, pTransaction->status, &startTime[head], &endTime,
+                           nwrite[head], requestSize[head], nread);
+        pTransaction->status = endTransaction(pTransaction->slave, pTransaction->function,
+                                              pTransaction->start, pTransaction->data, pTransaction->len,
+                                              pTransaction->status);
+        if (pTransaction->status != asynSuccess) status = pTransaction->status;
+        head = (head + 1) % MODBUS_MAX_PIPELINE_DEPTH;
+        nOutstanding--;
+    }
+
+    pasynManager->unlockPort(pasynUserOctet);
+    epicsTimeGetCurrent(&endTime);
+    releaseConnection(connection, status, epicsTimeDiffInSeconds(&endTime, &firstTime));
+    return status;
+}
+
+/* Writes len consecutive registers with function code 6, one transaction per register.
+ * The transactions are pipelined if the interpose driver allows it. */
+asynStatus drvModbusAsyn::writeSingleRegisters(int start, epicsUInt16 *data, int len)
+{
+    modbusTransaction_t transactions[MAX_WRITE_WORDS];
+    int i;
+
+    if (len > MAX_WRITE_WORDS) len = MAX_WRITE_WORDS;
+    for (i=0; i<len; i++) {
+        transactions[i].slave = modbusSlave_;
+        transactions[i].function = MODBUS_WRITE_SINGLE_REGISTER;
+        transactions[i].start = start + i;
+        transactions[i].data = data + i;
+        transactions[i].len = 1;
+    }
+    return doModbusIOPipelined(transactions, len);
+}
+
+/* Writes registers with function 16.  If the WRITE_WINDOW parameter is > 0 the data are queued and
+ * success is returned at once, because asyn device support completes the record when this returns.  The writes queued in the window are then done by the write flusher
+ * thread, with one transaction for each run of contiguous registers.
+ * A register that is written again with a different value while it is still queued is not merged,
+ * the queue is written first so that the device sees both values. */
+asynStatus drvModbusAsyn::writeMultipleRegisters(int start, epicsUInt16 *data, int len)
+{
+    std::map<int, epicsUInt16>::iterator it;
+    int writeError;
+    int i;
+
+    /* After a queued write has failed the writes are done at once, so that the records get the
+     * real status, until WRITE_ERROR is cleared */
+    getIntegerParam(P_WriteError, &writeError);
+    if ((writeWindow_ <= 0.) || (modbusFunction_ != MODBUS_WRITE_MULTIPLE_REGISTERS) || writeError) {
+        return doModbusIO(modbusSlave_, modbusFunction_, start, data, len);
+    }
+    for (i=0; i<len; i++) {
+        it = pendingWrites_.find(start + i);
+        if ((it != pendingWrites_.end()) && (it->second != data[i])) {
+            flushWrites();
+            break;
+        }
+    }
+    if (pendingWrites_.empty()) {
+        writeDeadline_ = modbusPollEngine::now() + writeWindow_;
+        epicsEventSignal(writeFlushEventId_);
+    }
+    for (i=0; i<len; i++) {
+        pendingWrites_[start + i] = data[i];
+    }
+    numPendingWrites_++;
+    return asynSuccess;
+}
+
+/* Writes the registers queued by writeMultipleRegisters(), one transaction for each run of up to
+ * MAX_WRITE_WORDS contiguous registers.  The records that made the writes have already completed,
+ * so a failed transaction is counted in IOErrors, even if it failed with a Modbus exception, and sets the
+ * WRITE_ERROR parameter, which stays set until it is cleared by writing 0 to it.
+ * Returns the status of the last failed transaction, if any.  Must be called with the lock held. */
+asynStatus drvModbusAsyn::flushWrites()
+{
+    std::map<int, epicsUInt16> pending;
+    std::map<int, epicsUInt16>::iterator it;
+    epicsUInt16 buffer[MAX_WRITE_WORDS];
+    int start = 0;
+    int len = 0;
+    int numWrites = numPendingWrites_;
+    int numTransactions = 0;
+    int prevIOErrors;
+    asynStatus status;
+    asynStatus flushStatus = asynSuccess;
+    static const char *functionName = "flushWrites";
+
+    /* Empty the queue first, doModbusIO() calls this function if it is not empty */
+    pending.swap(pendingWrites_);
+    numPendingWrites_ = 0;
+    for (it = pending.begin(); ; ++it) {
+        if ((len > 0) &&
+            ((it == pending.end()) || (it->first != start + len) || (len == MAX_WRITE_WORDS))) {
+            prevIOErrors = IOErrors_;
+            status = doModbusIO(modbusSlave_, MODBUS_WRITE_MULTIPLE_REGISTERS, start, buffer, len);
+            if (status != asynSuccess) {
+                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                          "%s::%s port %s error writing %d queued registers at address 0%o\n",
+                          driverName, functionName, this->portName, len, start);
+                /* doModbusIO() only counts the errors of the link, not exceptions */
+                if (IOErrors_ == prevIOErrors) {
+                    IOErrors_++;
+                    setIntegerParam(P_IOErrors, IOErrors_);
+                }
+                setIntegerParam(P_WriteError, 1);
+                flushStatus = status;
+            }
+            numTransactions++;
+            len = 0;
+        }
+        if (it == pending.end()) break;
+        if (len == 0) start = it->first;
+        buffer[len++] = it->second;
+    }
+    if (numWrites > numTransactions) {
+        writesCoalesced_ += numWrites - numTransactions;
+        setIntegerParam(P_WriteCoalesced, writesCoalesced_);
+    }
+    callParamCallbacks();
+    return flushStatus;
+}
+
+/* Writes the registers of an array output with function 16.  If WRITE_DELTA is set, only the runs of
+ * registers that differ from the last data written to the same address range are sent, one transaction
+ * per run.  Runs separated by at most MODBUS_DELTA_MAX_GAP unchanged registers are sent together, because
+ * that costs less than the overhead of another transaction.
+ * The last data are forgotten when any other write from this port changes one of the registers, and when
+ * any transaction fails, because the device may then have been restarted.  Writes queued by
+ * writeMultipleRegisters() are done before the last data are looked up. */
+asynStatus drvModbusAsyn::writeArrayRegisters(int start, epicsUInt16 *data, int len)
+{
+    std::map<int, std::vector<epicsUInt16> >::iterator it;
+    std::vector<epicsUInt16> previous;
+    int first, last, end;
+    int numSent = 0;
+    asynStatus status;
+
+    /* The queued writes are done first, because they can change the registers of the array and
+     * so forget its last data.  If they fail the state of the device is not known, so the array is not written. */
+    if (!pendingWrites_.empty()) {
+        status = flushWrites();
+        if (status != asynSuccess) return status;
+    }
+    if (!writeDelta_ || (modbusFunction_ != MODBUS_WRITE_MULTIPLE_REGISTERS)) {
+        return doModbusIO(modbusSlave_, modbusFunction_, start, data, len);
+    }
+    /* The transactions below remove the entry, so it is copied */
+    it = deltaImages_.find(start);
+    if ((it != deltaImages_.end()) && ((int)it->second.size() == len)) previous = it->second;
+    if (previous.empty()) {
+        status = doModbusIO(modbusSlave_, modbusFunction_, start, data, len);
+        numSent = len;
+    } else {
+        status = asynSuccess;
+        first = 0;
+        while (first < len) {
+            /* Find the next changed register, then the end of the run including small gaps */
+            while ((first < len) && (data[first] == previous[first])) first++;
+            if (first == len) break;
+            last = first;
+            for (end = first + 1; (end < len) && (end - last <= MODBUS_DELTA_MAX_GAP); end++) {
+                if (data[end] != previous[end]) last = end;
+            }
+            status = doModbusIO(modbusSlave_, modbusFunction_, start + first, data + first, last - first + 1);
+            if (status != asynSuccess) break;
+            numSent += last - first + 1;
+            first = last + 1;
+        }
+    }
+    if (status != asynSuccess) return status;
+    deltaImages_[start].assign(data, data + len);
+    if (numSent < len) {
+        writeDeltaSkipped_ += len - numSent;
+        setIntegerParam(P_WriteDeltaSkipped, writeDeltaSkipped_);
+    }
+    return asynSuccess;
+}
+
+/* Forgets the last data of the array outputs that overlap the registers written by a transaction,
+ * or of all of them if the transaction failed */
+void drvModbusAsyn::updateDeltaImages(int function, int start, int len, asynStatus status)
+{
+    std::map<int, std::vector<epicsUInt16> >::iterator it;
+
+    if (status != asynSuccess) {
+        deltaImages_.clear();
+        return;
+    }
+    switch (function) {
+        case MODBUS_WRITE_SINGLE_REGISTER:
+        case MODBUS_WRITE_MULTIPLE_REGISTERS:
+        case MODBUS_WRITE_MULTIPLE_REGISTERS_F23:
+        case MODBUS_MASK_WRITE_REGISTER:
+            break;
+        default:
+            return;
+    }
+    for (it = deltaImages_.begin(); it != deltaImages_.end(); ) {
+        if ((it->first < start + len) && (start < it->first + (int)it->second.size())) {
+            deltaImages_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/* Returns 1 if the data read with a Modbus function are coils, 0 if they are holding registers,
+ * and -1 if they are neither, so that writes cannot change them */
+static int imageAddressSpace(int function)
+{
+    switch (function) {
+        case MODBUS_READ_COILS:
+            return 1;
+        case MODBUS_READ_HOLDING_REGISTERS:
+        case MODBUS_READ_INPUT_REGISTERS_F23:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/* If WRITE_THROUGH is set, passes the data of a successful write to all of the ports that hold the same
+ * coils or holding registers in data_: the ports that use the same octet port and slave, whether they are
+ * input ports or output ports that did the initial read.  Each port applies the changes in an EPICS
+ * callback thread and does callbacks to its I/O Intr clients at once, rather than at its next poll.
+ * The other ports are never locked here, so this cannot deadlock with a port that is writing to this one. */
+void drvModbusAsyn::writeThrough(int slave, int function, int start, epicsUInt16 *data, int len)
+{
+    std::vector<modbusImageUpdate_t> updates;
+    modbusImageUpdate_t update;
+    drvModbusAsyn *pPort;
+    int space;
+    int regionFunction, regionStart, regionLength, regionOffset;
+    int address;
+    size_t i, block, numRegions;
+    int j;
+
+    if (!writeThrough_ || !interruptAccept) return;
+    switch (function) {
+        case MODBUS_WRITE_SINGLE_COIL:
+        case MODBUS_WRITE_MULTIPLE_COILS:
+            space = 1;
+            break;
+        case MODBUS_WRITE_SINGLE_REGISTER:
+        case MODBUS_WRITE_MULTIPLE_REGISTERS:
+        case MODBUS_WRITE_MULTIPLE_REGISTERS_F23:
+            space = 0;
+            break;
+        case MODBUS_MASK_WRITE_REGISTER:
+            /* data[0] is the AND mask and data[1] the OR mask for a single register */
+            space = 0;
+            len = 1;
+            break;
+        default:
+            return;
+    }
+
+    epicsMutexLock(pollPortsMutex);
+    for (i=0; i<imagePorts.size(); i++) {
+        pPort = imagePorts[i];
+        if (pPort->absoluteAddressing_ || (pPort->modbusSlave_ != slave) ||
+            (strcmp(pPort->octetPortName_, octetPortName_) != 0)) continue;
+        /* Wago devices read back from a different address than is written, so only this port is known to match */
+        if ((pPort != this) && (pPort->readbackOffset_ || readbackOffset_)) continue;
+        /* An input port holds its poll blocks, an output port the data of its initial read */
+        if (pPort->pollBlocks_.empty() && !pPort->readOnceDone_) continue;
+        numRegions = pPort->pollBlocks_.empty() ? 1 : pPort->pollBlocks_.size();
+        updates.clear();
+        for (block=0; block<numRegions; block++) {
+            if (pPort->pollBlocks_.empty()) {
+                regionFunction = pPort->readOnceFunction_;
+                regionStart = pPort->modbusStartAddress_;
+                regionLength = pPort->modbusLength_;
+                regionOffset = 0;
+            } else {
+                regionFunction = pPort->pollBlocks_[block].function;
+                regionStart = pPort->pollBlocks_[block].start;
+                regionLength = pPort->pollBlocks_[block].length;
+                regionOffset = pPort->pollBlocks_[block].offset;
+            }
+            if (imageAddressSpace(regionFunction) != space) continue;
+            for (j=0; j<len; j++) {
+                address = start + j;
+                if ((address < regionStart) || (address >= regionStart + regionLength)) continue;
+                update.offset = regionOffset + address - regionStart;
+                if (function == MODBUS_MASK_WRITE_REGISTER) {
+                    update.andMask = data[0];
+                    update.orMask = data[1] & ~data[0];
+                } else {
+                    update.andMask = 0;
+                    update.orMask = (space == 1) ? (data[j] ? 1 : 0) : data[j];
+                }
+                updates.push_back(update);
+            }
+        }
+        if (!updates.empty()) pPort->queueImageUpdates(updates);
+    }
+    epicsMutexUnlock(pollPortsMutex);
+}
+
+/* Adds changes to data_ that are applied by applyImageUpdates() in an EPICS callback thread */
+void drvModbusAsyn::queueImageUpdates(const std::vector<modbusImageUpdate_t> &updates)
+{
+    bool request;
+
+    epicsMutexLock(imageUpdateMutex_);
+    imageUpdates_.insert(imageUpdates_.end(), updates.begin(), updates.end());
+    request = !imageUpdateQueued_;
+    imageUpdateQueued_ = true;
+    epicsMutexUnlock(imageUpdateMutex_);
+    if (request && (callbackRequest(&imageUpdateCallback_) != 0)) {
+        /* The callback queue is full, the changes are applied after the next write */
+        epicsMutexLock(imageUpdateMutex_);
+        imageUpdateQueued_ = false;
+        epicsMutexUnlock(imageUpdateMutex_);
+    }
+}
+
+static void imageUpdateCallbackC(CALLBACK *pCallback)
+{
+    void *pPvt;
+
+    callbackGetUser(pPvt, pCallback);
+    ((drvModbusAsyn *)pPvt)->applyImageUpdates();
+}
+
+/* Applies the changes to data_ queued by writes, and does the callbacks to the I/O Intr clients
+ * whose data changed */
+void drvModbusAsyn::applyImageUpdates()
+{
+    std::vector<modbusImageUpdate_t> updates;
+    size_t i;
+
+    lock();
+    epicsMutexLock(imageUpdateMutex_);
+    updates.swap(imageUpdates_);
+    imageUpdateQueued_ = false;
+    epicsMutexUnlock(imageUpdateMutex_);
+    for (i=0; i<updates.size(); i++) {
+        data_[updates[i].offset] = (data_[updates[i].offset] & updates[i].andMask) | updates[i].orMask;
+    }
+    /* Only ports with a poller have the previous data that the callbacks compare with */
+    if (prevData_ && firstPollDone_) doDataCallbacks(true);
+    unlock();
+}
+
+/* Returns the connection for a transaction, and its asynUsers.  If the octet port is a connection pool
+ * this is the connection with the fewest transactions in progress.  The asynUsers are returned rather
+ * than stored in the driver, so that each transaction acts on the connection it was given.
+ * releaseConnection() must be called when the transaction is done. */
+int drvModbusAsyn::acquireConnection(asynUser **ppasynUserOctet, asynUser **ppasynUserCommon)
+{
+    int connection = 0;
+
+    if (connectionPool_) {
+        connection = connectionPool_->acquire();
+        *ppasynUserOctet = poolOctetUsers_[connection];
+        *ppasynUserCommon = poolCommonUsers_[connection];
+    } else {
+        *ppasynUserOctet = pasynUserOctet_;
+        *ppasynUserCommon = pasynUserCommon_;
+    }
+    return connection;
+}
+
+/* Ends a transaction on a connection returned by acquireConnection().
+ * \param[in] elapsed The time in seconds taken by the transaction */
+void drvModbusAsyn::releaseConnection(int connection, asynStatus status, double elapsed)
+{
+    if (connectionPool_) connectionPool_->release(connection, status, elapsed);
+}
+
+/* Reconnects the connection of a transaction if the last I/O failed or it is disconnected,
+ * when the octet port does not use autoConnect */
+asynStatus drvModbusAsyn::checkConnection(asynUser *pasynUserOctet, asynUser *pasynUserCommon)
+{
     int autoConnect;
-    static const char *functionName = "doModbusIO";
+    asynStatus status;
+    static const char *functionName = "checkConnection";
 
     /* If the Octet driver is not set for autoConnect then do connection management ourselves */
-    status = pasynManager->isAutoConnect(pasynUserOctet_, &autoConnect);
+    status = pasynManager->isAutoConnect(pasynUserOctet, &autoConnect);
     if (!autoConnect) {
         /* See if we are connected */
         int itemp;
-        status = pasynManager->isConnected(pasynUserOctet_, &itemp);
+        status = pasynManager->isConnected(pasynUserOctet, &itemp);
         isConnected_ = (itemp != 0) ? true : false;
          /* If we have an I/O error or are disconnected then disconnect device and reconnect */
         if ((ioStatus_ != asynSuccess) || !isConnected_) {
@@ -1982,7 +3310,7 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s is disconnected\n",
                           driverName, functionName, this->portName);
-            status = pasynCommonSyncIO->disconnectDevice(pasynUserCommon_);
+            status = pasynCommonSyncIO->disconnectDevice(pasynUserCommon);
             if (status == asynSuccess) {
                 asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
                           "%s::%s port %s disconnect device OK\n",
@@ -1990,9 +3318,9 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
             } else {
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s disconnect error=%s\n",
-                          driverName, functionName, this->portName, pasynUserOctet_->errorMessage);
+                          driverName, functionName, this->portName, pasynUserOctet->errorMessage);
             }
-            status = pasynCommonSyncIO->connectDevice(pasynUserCommon_);
+            status = pasynCommonSyncIO->connectDevice(pasynUserCommon);
             if (status == asynSuccess) {
                 asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
                           "%s::%s port %s connect device OK\n",
@@ -2000,11 +3328,33 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
             } else {
                 asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                           "%s::%s port %s connect device error=%s\n",
-                          driverName, functionName, this->portName, pasynUserOctet_->errorMessage);
-                goto done;
+                          driverName, functionName, this->portName, pasynUserOctet->errorMessage);
+                linkError_ = true;
+                return status;
             }
         }
     }
+    return asynSuccess;
+}
+
+/* Builds the Modbus request frame in modbusRequest_ and computes the expected reply size */
+asynStatus drvModbusAsyn::buildModbusRequest(int slave, int function, int start,
+                                             epicsUInt16 *data, int len,
+                                             int *requestSize, int *replySize)
+{
+    modbusReadRequest *readReq;
+    modbusWriteSingleRequest *writeSingleReq;
+    modbusMaskWriteRequest *maskWriteReq;
+    modbusWriteMultipleRequest *writeMultipleReq;
+    modbusReadWriteMultipleRequest *readWriteMultipleReq;
+    unsigned char  *pCharOut;
+    epicsUInt16 *pShortIn, *pShortOut;
+    epicsUInt16 bitOutput;
+    int byteCount;
+    int nread;
+    int i;
+    unsigned char mask=0;
+    static const char *functionName = "buildModbusRequest";
 
     switch (function) {
         case MODBUS_READ_COILS:
@@ -2014,10 +3364,10 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
             readReq->fcode = function;
             readReq->startReg = htons((epicsUInt16)start);
             readReq->numRead = htons((epicsUInt16)len);
-            requestSize = sizeof(modbusReadRequest);
+            *requestSize = sizeof(modbusReadRequest);
             /* The -1 below is because the modbusReadResponse struct already has 1 byte of data */
-            replySize = sizeof(modbusReadResponse) - 1 + len/8;
-            if (len % 8) replySize++;
+            *replySize = sizeof(modbusReadResponse) - 1 + len/8;
+            if (len % 8) (*replySize)++;
             break;
         case MODBUS_READ_HOLDING_REGISTERS:
         case MODBUS_READ_INPUT_REGISTERS:
@@ -2026,17 +3376,17 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
             readReq->fcode = function;
             readReq->startReg = htons((epicsUInt16)start);
             readReq->numRead = htons((epicsUInt16)len);
-            requestSize = sizeof(modbusReadRequest);
+            *requestSize = sizeof(modbusReadRequest);
             /* The -1 below is because the modbusReadResponse struct already has 1 byte of data */
-            replySize = sizeof(modbusReadResponse) - 1 + len*2;
+            *replySize = sizeof(modbusReadResponse) - 1 + len*2;
             break;   
         case MODBUS_REPORT_SLAVE_ID:
             readReq = (modbusReadRequest *)modbusRequest_;
             readReq->slave = slave;
             readReq->fcode = function;
-            requestSize = 2;
+            *requestSize = 2;
             /* The -1 below is because the modbusReadResponse struct already has 1 byte of data */
-            replySize = sizeof(modbusReadResponse) - 1 + len;
+            *replySize = sizeof(modbusReadResponse) - 1 + len;
             break; 
         case MODBUS_READ_INPUT_REGISTERS_F23:
             readWriteMultipleReq = (modbusReadWriteMultipleRequest *)modbusRequest_;
@@ -2053,9 +3403,9 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
             readWriteMultipleReq->byteCount = 2;
             /* The -1 below is because the modbusReadWriteMultipleRequest struct already has 1 byte of data,
                and we don't want to send it. */
-            requestSize = sizeof(modbusReadWriteMultipleRequest) - 1;
+            *requestSize = sizeof(modbusReadWriteMultipleRequest) - 1;
             /* The -1 below is because the modbusReadResponse struct already has 1 byte of data */
-            replySize = sizeof(modbusReadResponse) - 1 + len*2;
+            *replySize = sizeof(modbusReadResponse) - 1 + len*2;
             break;
         case MODBUS_WRITE_SINGLE_COIL:
             writeSingleReq = (modbusWriteSingleRequest *)modbusRequest_;
@@ -2065,8 +3415,8 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
             if (*data) bitOutput = 0xFF00;
             else       bitOutput = 0;
             writeSingleReq->data = htons(bitOutput);
-            requestSize = sizeof(modbusWriteSingleRequest);
-            replySize = sizeof(modbusWriteSingleResponse);
+            *requestSize = sizeof(modbusWriteSingleRequest);
+            *replySize = sizeof(modbusWriteSingleResponse);
             asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
                       "%s::%s port %s WRITE_SINGLE_COIL"
                       " address=0%o value=0x%x\n",
@@ -2079,13 +3429,28 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
             writeSingleReq->startReg = htons((epicsUInt16)start);
             writeSingleReq->data = (epicsUInt16)*data;
             writeSingleReq->data = htons(writeSingleReq->data);
-            requestSize = sizeof(modbusWriteSingleRequest);
-            replySize = sizeof(modbusWriteSingleResponse);
+            *requestSize = sizeof(modbusWriteSingleRequest);
+            *replySize = sizeof(modbusWriteSingleResponse);
             asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
                       "%s::%s port %s WRITE_SINGLE_REGISTER"
                       " address=0%o value=0x%x\n",
                       driverName, functionName, this->portName, start, *data);
             break;
+        case MODBUS_MASK_WRITE_REGISTER:
+            /* data[0] is the AND mask and data[1] is the OR mask */
+            maskWriteReq = (modbusMaskWriteRequest *)modbusRequest_;
+            maskWriteReq->slave = slave;
+            maskWriteReq->fcode = function;
+            maskWriteReq->startReg = htons((epicsUInt16)start);
+            maskWriteReq->andMask = htons(data[0]);
+            maskWriteReq->orMask = htons(data[1]);
+            *requestSize = sizeof(modbusMaskWriteRequest);
+            *replySize = sizeof(modbusMaskWriteResponse);
+            asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
+                      "%s::%s port %s MASK_WRITE_REGISTER"
+                      " address=0%o andMask=0x%x orMask=0x%x\n",
+                      driverName, functionName, this->portName, start, data[0], data[1]);
+            break;
         case MODBUS_WRITE_MULTIPLE_COILS:
             writeMultipleReq = (modbusWriteMultipleRequest *)modbusRequest_;
             writeMultipleReq->slave = slave;
@@ -2112,8 +3477,8 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
                         (char *)writeMultipleReq->data, byteCount,
                         "%s::%s port %s WRITE_MULTIPLE_COILS\n",
                         driverName, functionName, this->portName);
-            requestSize = sizeof(modbusWriteMultipleRequest) + byteCount - 1;
-            replySize = sizeof(modbusWriteMultipleResponse);
+            *requestSize = sizeof(modbusWriteMultipleRequest) + byteCount - 1;
+            *replySize = sizeof(modbusWriteMultipleResponse);
             break;
         case MODBUS_WRITE_MULTIPLE_REGISTERS:
             writeMultipleReq = (modbusWriteMultipleRequest *)modbusRequest_;
@@ -2132,8 +3497,8 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
                         (char *)writeMultipleReq->data, byteCount,
                         "%s::%s port %s WRITE_MULTIPLE_REGISTERS\n",
                         driverName, functionName, this->portName);
-            requestSize = sizeof(modbusWriteMultipleRequest) + byteCount - 1;
-            replySize = sizeof(modbusWriteMultipleResponse);
+            *requestSize = sizeof(modbusWriteMultipleRequest) + byteCount - 1;
+            *replySize = sizeof(modbusWriteMultipleResponse);
             break;
         case MODBUS_WRITE_MULTIPLE_REGISTERS_F23:
             readWriteMultipleReq = (modbusReadWriteMultipleRequest *)modbusRequest_;
@@ -2158,9 +3523,9 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
                         (char *)readWriteMultipleReq->data, byteCount,
                         "%s::%s port %s WRITE_MULTIPLE_REGISTERS_F23\n",
                         driverName, functionName, this->portName);
-            requestSize = sizeof(modbusReadWriteMultipleRequest) + byteCount - 1;
+            *requestSize = sizeof(modbusReadWriteMultipleRequest) + byteCount - 1;
             /* The -1 below is because the modbusReadResponse struct already has 1 byte of data */
-            replySize = (int)(sizeof(modbusReadResponse) + 2*nread - 1);
+            *replySize = (int)(sizeof(modbusReadResponse) + 2*nread - 1);
             break;
 
 
@@ -2168,21 +3533,20 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
             asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                       "%s::%s, port %s unsupported function code %d\n",
                       driverName, functionName, this->portName, function);
-            status = asynError;
-            goto done;
+            return asynError;
     }
+    return asynSuccess;
+}
 
-    /* Do the Modbus I/O as a write/read cycle */
-    epicsTimeGetCurrent(&startTime);
-    status = pasynOctetSyncIO->writeRead(pasynUserOctet_,
-                                         modbusRequest_, requestSize,
-                                         modbusReply_, replySize,
-                                         MODBUS_READ_TIMEOUT,
-                                         &nwrite, &nread, &eomReason);
-    epicsTimeGetCurrent(&endTime);
-    asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
-              "%s::%s port %s called pasynOctetSyncIO->writeRead, status=%d, requestSize=%d, replySize=%d, nwrite=%d, nread=%d, eomReason=%d\n",
-              driverName, functionName, this->portName, status, requestSize, replySize, (int)nwrite, (int)nread, eomReason);
+/* Reports changes in the I/O status and updates the I/O counters and timing statistics */
+void drvModbusAsyn::updateIOStatistics(asynUser *pasynUserOctet, asynStatus status,
+                                       epicsTimeStamp *startTime, epicsTimeStamp *endTime,
+                                       size_t nwrite, int requestSize, size_t nread)
+{
+    double dT;
+    int msec;
+    int bin;
+    static const char *functionName = "updateIOStatistics";
 
     if (status != prevIOStatus_) {
       if (status != asynSuccess) {
@@ -2190,7 +3554,7 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
                      "%s::%s port %s error calling writeRead,"
                      " error=%s, nwrite=%d/%d, nread=%d\n",
                      driverName, functionName, this->portName,
-                     pasynUserOctet_->errorMessage, (int)nwrite, requestSize, (int)nread);
+                     pasynUserOctet->errorMessage, (int)nwrite, requestSize, (int)nread);
         } else {
             asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
                      "%s::%s port %s writeRead status back to normal having had %d errors,"
@@ -2205,10 +3569,14 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
         IOErrors_++;
         setIntegerParam(P_IOErrors, IOErrors_);
         currentIOErrors_++;
-        goto done;
+        linkError_ = true;
+        updateLinkStatistics();
+        return;
     }
+    /* Any transaction that gets a reply, even an exception, ends the backoff for all ports on the octet port */
+    if (backoff_) backoff_->succeeded();
 
-    dT = epicsTimeDiffInSeconds(&endTime, &startTime);
+    dT = epicsTimeDiffInSeconds(endTime, startTime);
     msec = (int)(dT*1000. + 0.5);
     lastIOMsec_ = msec;
     setIntegerParam(P_LastIOTime, msec);
@@ -2216,6 +3584,7 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
       maxIOMsec_ = msec;
       setIntegerParam(P_MaxIOTime, msec);
     }
+    updateLinkStatistics();
     if (enableHistogram_) {
         bin = msec /histogramMsPerBin_;
         if (bin < 0) bin = 0;
@@ -2223,11 +3592,63 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
         if (bin >= HISTOGRAM_LENGTH-1) bin = HISTOGRAM_LENGTH-1;
         timeHistogram_[bin]++;
     }
+}
+
+/* Updates the retransmission statistics of the modbusInterpose driver for Modbus/UDP,
+ * and the stale reply statistics for Modbus/TCP.  If the octet port is a connection pool the counts
+ * are summed over the connections of the pool, and the RTO is the largest of them. */
+void drvModbusAsyn::updateLinkStatistics()
+{
+    int numConnections = connectionPool_ ? connectionPool_->numConnections() : 1;
+    const char *octetPortName;
+    int retransmits, totalRetransmits = 0;
+    double rto, maxRTO = 0.;
+    int staleReplies, totalStaleReplies = 0;
+    int framingErrors, totalFramingErrors = 0;
+    int i;
+
+    for (i=0; i<numConnections; i++) {
+        octetPortName = connectionPool_ ? connectionPool_->octetPortName(i) : octetPortName_;
+        if (udpStatistics_ &&
+            (modbusInterposeGetUDPStatistics(octetPortName, &retransmits, &rto) == 0)) {
+            totalRetransmits += retransmits;
+            if (rto > maxRTO) maxRTO = rto;
+        }
+        if (tcpStatistics_ &&
+            (modbusInterposeGetTCPStatistics(octetPortName, &staleReplies, &framingErrors) == 0)) {
+            totalStaleReplies += staleReplies;
+            totalFramingErrors += framingErrors;
+        }
+    }
+    if (udpStatistics_) {
+        setIntegerParam(P_UDPRetransmits, totalRetransmits);
+        setDoubleParam(P_UDPRTO, maxRTO * 1000.);
+    }
+    if (tcpStatistics_) {
+        setIntegerParam(P_TCPStaleReplies, totalStaleReplies);
+        setIntegerParam(P_TCPFramingErrors, totalFramingErrors);
+    }
+}
+
+/* Checks the reply in modbusReply_ for a Modbus exception and decodes the data for read functions */
+asynStatus drvModbusAsyn::parseModbusReply(int function, epicsUInt16 *data, int len)
+{
+    modbusReadResponse *readResp;
+    modbusExceptionResponse *exceptionResp;
+    unsigned char  *pCharIn;
+    epicsUInt16 *pShortIn;
+    size_t nread;
+    asynStatus status=asynSuccess;
+    int i;
+    unsigned char mask=0;
+    static const char *functionName = "parseModbusReply";
 
     /* See if there is a Modbus exception */
+    modbusException_ = 0;
     readResp = (modbusReadResponse *)modbusReply_;
     if (readResp->fcode & MODBUS_EXCEPTION_FCN) {
         exceptionResp = (modbusExceptionResponse *)modbusReply_;
+        modbusException_ = exceptionResp->exception;
         if (exceptionResp->exception == 5) {
             // Exception 5 is a warning that the command will take a long time to execute,
             // but it is not an error.
@@ -2322,6 +3743,7 @@ asynStatus drvModbusAsyn::doModbusIO(int slave, int function, int start,
          * Could add error checking. */
         case MODBUS_WRITE_SINGLE_COIL:
         case MODBUS_WRITE_SINGLE_REGISTER:
+        case MODBUS_MASK_WRITE_REGISTER:
             writeOK_++;
             setIntegerParam(P_WriteOK, writeOK_);
             /* Not using value for now so comment out to avoid compiler warning
@@ -2376,6 +3798,499 @@ int drvModbusAsyn::getStringLen(asynUser *pasynUser, size_t maxLen)
     return (int)len;
 }
 
+/** Returns true if the client does callbacks on every poll, or if any of the len words
+  * starting at offset have changed since the previous poll */
+bool drvModbusAsyn::clientDataChanged(asynUser *pasynUser, int offset, int len)
+{
+    if (!pasynUser->drvUser || !((modbusDrvUser_t *)pasynUser->drvUser)->onChange) return true;
+    return wordsChanged(offset, len);
+}
+
+/** Returns true if any of the len words starting at offset changed in the most recent poll cycle.
+  * This uses the changed-word bitmap computed by readPollerCycle(), so it is cheap even for long ranges.
+  * Returns true if the bitmap has not been computed yet.  The caller must have the port locked. */
+bool drvModbusAsyn::wordsChanged(int offset, int len)
+{
+    if (offset < 0 || len <= 0) return true;
+    if (changedWords_.size() != (size_t)MODBUS_DIFF_BITMAP_SIZE(modbusLength_)) return true;
+    if (offset >= modbusLength_) return false;
+    if (offset + len > modbusLength_) len = modbusLength_ - offset;
+    return modbusDiffAnySet(&changedWords_[0], offset, len) != 0;
+}
+
+/** Returns the number of 16-bit words used by a data type for numeric conversions */
+static int dataTypeWords(modbusDataType_t dataType)
+{
+    switch (dataType) {
+        case dataTypeInt32LE:
+        case dataTypeInt32LEBS:
+        case dataTypeInt32BE:
+        case dataTypeInt32BEBS:
+        case dataTypeUInt32LE:
+        case dataTypeUInt32LEBS:
+        case dataTypeUInt32BE:
+        case dataTypeUInt32BEBS:
+        case dataTypeFloat32LE:
+        case dataTypeFloat32LEBS:
+        case dataTypeFloat32BE:
+        case dataTypeFloat32BEBS:
+            return 2;
+        case dataTypeInt64LE:
+        case dataTypeInt64LEBS:
+        case dataTypeInt64BE:
+        case dataTypeInt64BEBS:
+        case dataTypeUInt64LE:
+        case dataTypeUInt64LEBS:
+        case dataTypeUInt64BE:
+        case dataTypeUInt64BEBS:
+        case dataTypeFloat64LE:
+        case dataTypeFloat64LEBS:
+        case dataTypeFloat64BE:
+        case dataTypeFloat64BEBS:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+/** Returns the number of 16-bit words used by a string of len characters */
+static int stringWords(modbusDataType_t dataType, int len)
+{
+    switch (dataType) {
+        case dataTypeStringHighLow:
+        case dataTypeStringLowHigh:
+        case dataTypeZStringHighLow:
+        case dataTypeZStringLowHigh:
+            return (len + 1) / 2;
+        default:
+            return len;
+    }
+}
+
+static bool compareCallbackOffset(const modbusCallbackEntry_t &a, const modbusCallbackEntry_t &b)
+{
+    return a.offset < b.offset;
+}
+
+/** Rebuilds a callback table from the interrupt list if interrupt users have been added or removed
+  * since it was last built.  The address, data type and width of each client are resolved here
+  * rather than on every poll.  Must be called between interruptStart and interruptEnd, so that the
+  * list cannot change while it is being used.  generation must be read from interruptGeneration_ before
+  * interruptStart: asynManager defers the users added or removed between interruptStart and interruptEnd
+  * until interruptEnd, so a value read later could be newer than the list, and the table would not be
+  * rebuilt when the deferred change is made. */
+void drvModbusAsyn::updateCallbackTable(modbusCallbackTable_t *pTable, ELLLIST *pclientList, const char *interfaceType,
+                                        int generation)
+{
+    interruptNode *pnode;
+    modbusCallbackEntry_t entry;
+    static const char *functionName = "updateCallbackTable";
+
+    if (pTable->generation == generation) return;
+    pTable->entries.clear();
+    for (pnode = (interruptNode *)ellFirst(pclientList); pnode; pnode = (interruptNode *)ellNext(&pnode->node)) {
+        entry.pInterrupt = pnode->drvPvt;
+        if (strcmp(interfaceType, asynInt32Type) == 0) {
+            entry.pasynUser = ((asynInt32Interrupt *)pnode->drvPvt)->pasynUser;
+        } else if (strcmp(interfaceType, asynInt64Type) == 0) {
+            entry.pasynUser = ((asynInt64Interrupt *)pnode->drvPvt)->pasynUser;
+        } else {
+            entry.pasynUser = ((asynFloat64Interrupt *)pnode->drvPvt)->pasynUser;
+        }
+        if (entry.pasynUser->reason != P_Data) continue;
+        pasynManager->getAddr(entry.pasynUser, &entry.offset);
+        entry.dataType = getDataType(entry.pasynUser);
+        if (checkOffset(entry.offset, valueWords(entry.offset, entry.dataType))) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s::%s port %s invalid memory request %d, max=%d\n",
+                      driverName, functionName, this->portName, entry.offset, modbusLength_);
+            continue;
+        }
+        entry.width = dataTypeWords(entry.dataType);
+        entry.block = findPollBlock(entry.offset);
+        entry.onChange = entry.pasynUser->drvUser && ((modbusDrvUser_t *)entry.pasynUser->drvUser)->onChange;
+        pTable->entries.push_back(entry);
+    }
+    std::sort(pTable->entries.begin(), pTable->entries.end(), compareCallbackOffset);
+    pTable->generation = generation;
+}
+
+/* Marks the poll blocks that overlap the words from offset to offset+width-1 as having clients */
+void drvModbusAsyn::markPollInterest(int offset, int width)
+{
+    size_t i;
+
+    for (i=0; i<pollBlocks_.size(); i++) {
+        if ((offset < pollBlocks_[i].offset + pollBlocks_[i].length) &&
+            (offset + width > pollBlocks_[i].offset)) {
+            pollBlocks_[i].hasClients = true;
+        }
+    }
+}
+
+/* Sets hasClients for the poll blocks that have interrupt clients.  Must be called with the lock held. */
+void drvModbusAsyn::findPollClients()
+{
+    ELLLIST *pclientList;
+    interruptNode *pnode;
+    asynUser *pasynUser;
+    void *interruptPvt[7];
+    int offset;
+    size_t i, j;
+
+    interruptPvt[0] = asynStdInterfaces.int32InterruptPvt;
+    interruptPvt[1] = asynStdInterfaces.int64InterruptPvt;
+    interruptPvt[2] = asynStdInterfaces.float64InterruptPvt;
+    interruptPvt[3] = asynStdInterfaces.uInt32DigitalInterruptPvt;
+    interruptPvt[4] = asynStdInterfaces.int32ArrayInterruptPvt;
+    interruptPvt[5] = asynStdInterfaces.float64ArrayInterruptPvt;
+    interruptPvt[6] = asynStdInterfaces.octetInterruptPvt;
+    for (i=0; i<pollBlocks_.size(); i++) {
+        pollBlocks_[i].hasClients = false;
+    }
+    for (j=0; j<7; j++) {
+        pasynManager->interruptStart(interruptPvt[j], &pclientList);
+        for (pnode = (interruptNode *)ellFirst(pclientList); pnode; pnode = (interruptNode *)ellNext(&pnode->node)) {
+            switch (j) {
+                case 0: pasynUser = ((asynInt32Interrupt *)pnode->drvPvt)->pasynUser; break;
+                case 1: pasynUser = ((asynInt64Interrupt *)pnode->drvPvt)->pasynUser; break;
+                case 2: pasynUser = ((asynFloat64Interrupt *)pnode->drvPvt)->pasynUser; break;
+                case 3: pasynUser = ((asynUInt32DigitalInterrupt *)pnode->drvPvt)->pasynUser; break;
+                case 4: pasynUser = ((asynInt32ArrayInterrupt *)pnode->drvPvt)->pasynUser; break;
+                case 5: pasynUser = ((asynFloat64ArrayInterrupt *)pnode->drvPvt)->pasynUser; break;
+                default: pasynUser = ((asynOctetInterrupt *)pnode->drvPvt)->pasynUser; break;
+            }
+            if (pasynUser->reason != P_Data) continue;
+            pasynManager->getAddr(pasynUser, &offset);
+            if (j < 3) {
+                markPollInterest(offset, dataTypeWords(getDataType(pasynUser)));
+            } else if (j == 3) {
+                markPollInterest(offset, 1);
+            } else {
+                /* The length of array and string clients is not known until they are called back */
+                markPollInterest(offset, modbusLength_ - offset);
+            }
+        }
+        pasynManager->interruptEnd(interruptPvt[j]);
+    }
+}
+
+/* Finds the poll blocks that clients are interested in, and puts the transactions for the blocks
+ * to read in this poll in pollActive_.  A block is interested if it has interrupt clients, or if it has
+ * been read synchronously in the last MODBUS_DEMAND_TIMEOUT seconds.  The other blocks are read every
+ * pollIdleDelay_ seconds, or never if it is < 0.  If readAll is true then all of the blocks are read.
+ * The interrupt lists are only searched when interrupt users have been added or removed since the last search.
+ * Returns the number of blocks to read.  Must be called with the lock held. */
+int drvModbusAsyn::selectPollBlocks(double now, bool readAll)
+{
+    int numIdle = 0;
+    /* Read before findPollClients() calls interruptStart, see updateCallbackTable() */
+    int generation = epicsAtomicGetIntT(&interruptGeneration_);
+    size_t i;
+
+    if (generation != pollInterestGeneration_) {
+        findPollClients();
+        pollInterestGeneration_ = generation;
+    }
+    pollActive_.clear();
+    for (i=0; i<pollBlocks_.size(); i++) {
+        pollBlocks_[i].interested = pollBlocks_[i].hasClients ||
+                                    (now - pollBlocks_[i].lastDemand < MODBUS_DEMAND_TIMEOUT);
+        if (!pollBlocks_[i].interested) numIdle++;
+        pollBlocks_[i].active = readAll || pollBlocks_[i].interested ||
+            ((pollIdleDelay_ > 0.0) && (now - pollBlocks_[i].lastRead >= pollIdleDelay_));
+        if (pollBlocks_[i].active) {
+            pollBlocks_[i].lastRead = now;
+            pollActive_.push_back(pollTransactions_[i]);
+        }
+    }
+    setIntegerParam(P_PollIdleBlocks, numIdle);
+    return (int)pollActive_.size();
+}
+
+/* Records a synchronous read of the data at offset, so that the block containing it is read in demand mode.
+ * If the block was not being polled and was last read more than pollDelay_ seconds ago it is read now,
+ * and the poller is woken so that it starts polling the block.
+ * Returns the status of the last read of the block. */
+asynStatus drvModbusAsyn::pollDemanded(int offset)
+{
+    int block = findPollBlock(offset);
+    modbusPollBlock_t *pBlock;
+    double now;
+
+    if ((block < 0) || (pollIdleDelay_ == 0.0)) return pollBlockStatus(block);
+    pBlock = &pollBlocks_[block];
+    now = modbusPollEngine::now();
+    pBlock->lastDemand = now;
+    if (!pBlock->interested) {
+        /* The block has not been polled, so its data can be older than a poll.  Read it now. */
+        if ((pollDelay_ <= 0.0) || (now - pBlock->lastRead >= pollDelay_)) {
+            pBlock->lastRead = now;
+            pBlock->status = doModbusIO(modbusSlave_, pBlock->function, pBlock->start,
+                                        data_ + pBlock->offset, pBlock->length);
+        }
+        wakeReadPoller();
+    }
+    return pBlock->status;
+}
+
+/* Returns the index of the poll block that contains offset, or -1 if there is none */
+int drvModbusAsyn::findPollBlock(int offset)
+{
+    size_t i;
+
+    for (i=0; i<pollBlocks_.size(); i++) {
+        if ((offset >= pollBlocks_[i].offset) && (offset < pollBlocks_[i].offset + pollBlocks_[i].length)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/* Returns the status of the last read of a poll block, or ioStatus_ if block is -1.
+ * Each block has its own status, so a block that fails does not report errors for the others. */
+asynStatus drvModbusAsyn::pollBlockStatus(int block)
+{
+    if (block < 0) return ioStatus_;
+    return pollBlocks_[block].status;
+}
+
+/* Returns false if the callbacks for the clients of a poll block are skipped because the block
+ * had the same I/O error when they were last done.  *force is set to true if the callbacks must be done
+ * even if the data have not changed, because forceCallback_ is set or the status of the block changed,
+ * unless changedOnly is true. */
+bool drvModbusAsyn::pollBlockCallbacks(int block, bool changedOnly, bool *force)
+{
+    modbusPollBlock_t *pBlock;
+
+    *force = forceCallback_ && !changedOnly;
+    if (block < 0) return true;
+    pBlock = &pollBlocks_[block];
+    if ((pBlock->status != pBlock->prevStatus) && !changedOnly) *force = true;
+    return (pBlock->status == asynSuccess) || (pBlock->status != pBlock->prevStatus);
+}
+
+/* Reads len words or bits at start into data_ for absolute addressing.  If readCacheTTL_ > 0 then
+ * the data are served from readCache_ if it holds them and is younger than readCacheTTL_.  Otherwise
+ * at least readCacheSize_ words or bits are read into readCache_, so that the records for the
+ * registers that follow are served by the same transaction.  If the device replies to that read with
+ * illegal data address, because the extra registers do not exist, then only len are read, and reads at
+ * that start address do not read ahead again.  Reads for this port are serialized by the
+ * port lock, so a read that waited for another to finish uses its data rather than doing the I/O again. */
+asynStatus drvModbusAsyn::readAbsolute(int function, int start, int len)
+{
+    asynStatus status;
+    double now;
+    int readLen;
+
+    if ((readCacheTTL_ <= 0.) || (function == MODBUS_REPORT_SLAVE_ID)) {
+        return doModbusIO(modbusSlave_, function, start, data_, len);
+    }
+    /* The cache does not have the queued writes, so any that the read includes are written first.
+     * That empties the cache, because it is a write. */
+    if (!pendingWrites_.empty()) {
+        std::map<int, epicsUInt16>::iterator it = pendingWrites_.lower_bound(start);
+        if ((it != pendingWrites_.end()) && (it->first < start + len)) flushWrites();
+    }
+    now = modbusPollEngine::now();
+    if ((readCacheLength_ > 0) && (function == readCacheFunction_) &&
+        (start >= readCacheStart_) && (start + len <= readCacheStart_ + readCacheLength_) &&
+        (now - readCacheTime_ < readCacheTTL_)) {
+        memcpy(data_, readCache_ + (start - readCacheStart_), len * sizeof(epicsUInt16));
+        readCacheHits_++;
+        setIntegerParam(P_ReadCacheHits, readCacheHits_);
+        return asynSuccess;
+    }
+    /* Modbus addresses are 16 bits */
+    readLen = std::max(len, std::min(readCacheSize_, 65536 - start));
+    if (readCacheNoReadAhead_.count(std::make_pair(function, start))) readLen = len;
+    readCacheLength_ = 0;
+    readCacheFunction_ = function;
+    status = doModbusIO(modbusSlave_, function, start, readCache_, readLen);
+    if ((status != asynSuccess) && (readLen > len) && (modbusException_ == MODBUS_EXCEPTION_ILLEGAL_ADDRESS)) {
+        readCacheNoReadAhead_.insert(std::make_pair(function, start));
+        readLen = len;
+        status = doModbusIO(modbusSlave_, function, start, readCache_, readLen);
+    }
+    if (status != asynSuccess) return status;
+    readCacheStart_ = start;
+    readCacheLength_ = readLen;
+    readCacheTime_ = now;
+    memcpy(data_, readCache_, len * sizeof(epicsUInt16));
+    return asynSuccess;
+}
+
+/* These replace registerInterruptUser and cancelInterruptUser in the interfaces that have interrupt users.
+ * The generation is incremented both before and after calling the base class, so that
+ * readPollerCycle() never uses a table entry for a client after it has been removed. */
+asynStatus drvModbusAsyn::registerInterruptUserInt32(void *drvPvt, asynUser *pasynUser,
+                                                     interruptCallbackInt32 callback, void *userPvt,
+                                                     void **registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pInt32Base_->registerInterruptUser(drvPvt, pasynUser, callback, userPvt, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::cancelInterruptUserInt32(void *drvPvt, asynUser *pasynUser, void *registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pInt32Base_->cancelInterruptUser(drvPvt, pasynUser, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::registerInterruptUserInt64(void *drvPvt, asynUser *pasynUser,
+                                                     interruptCallbackInt64 callback, void *userPvt,
+                                                     void **registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pInt64Base_->registerInterruptUser(drvPvt, pasynUser, callback, userPvt, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::cancelInterruptUserInt64(void *drvPvt, asynUser *pasynUser, void *registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pInt64Base_->cancelInterruptUser(drvPvt, pasynUser, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::registerInterruptUserFloat64(void *drvPvt, asynUser *pasynUser,
+                                                       interruptCallbackFloat64 callback, void *userPvt,
+                                                       void **registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pFloat64Base_->registerInterruptUser(drvPvt, pasynUser, callback, userPvt, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::cancelInterruptUserFloat64(void *drvPvt, asynUser *pasynUser, void *registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pFloat64Base_->cancelInterruptUser(drvPvt, pasynUser, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::registerInterruptUserUInt32Digital(void *drvPvt, asynUser *pasynUser,
+                                                             interruptCallbackUInt32Digital callback, void *userPvt,
+                                                             epicsUInt32 mask, void **registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pUInt32DigitalBase_->registerInterruptUser(drvPvt, pasynUser, callback, userPvt, mask, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::cancelInterruptUserUInt32Digital(void *drvPvt, asynUser *pasynUser, void *registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pUInt32DigitalBase_->cancelInterruptUser(drvPvt, pasynUser, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::registerInterruptUserInt32Array(void *drvPvt, asynUser *pasynUser,
+                                                          interruptCallbackInt32Array callback, void *userPvt,
+                                                          void **registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pInt32ArrayBase_->registerInterruptUser(drvPvt, pasynUser, callback, userPvt, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::cancelInterruptUserInt32Array(void *drvPvt, asynUser *pasynUser, void *registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pInt32ArrayBase_->cancelInterruptUser(drvPvt, pasynUser, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::registerInterruptUserFloat64Array(void *drvPvt, asynUser *pasynUser,
+                                                            interruptCallbackFloat64Array callback, void *userPvt,
+                                                            void **registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pFloat64ArrayBase_->registerInterruptUser(drvPvt, pasynUser, callback, userPvt, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::cancelInterruptUserFloat64Array(void *drvPvt, asynUser *pasynUser, void *registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pFloat64ArrayBase_->cancelInterruptUser(drvPvt, pasynUser, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::registerInterruptUserOctet(void *drvPvt, asynUser *pasynUser,
+                                                     interruptCallbackOctet callback, void *userPvt,
+                                                     void **registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pOctetBase_->registerInterruptUser(drvPvt, pasynUser, callback, userPvt, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
+asynStatus drvModbusAsyn::cancelInterruptUserOctet(void *drvPvt, asynUser *pasynUser, void *registrarPvt)
+{
+    drvModbusAsyn *pDriver = (drvModbusAsyn *)(asynPortDriver *)drvPvt;
+    asynStatus status;
+
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    status = pDriver->pOctetBase_->cancelInterruptUser(drvPvt, pasynUser, registrarPvt);
+    epicsAtomicIncrIntT(&pDriver->interruptGeneration_);
+    return status;
+}
+
 bool drvModbusAsyn::isZeroTerminatedString(modbusDataType_t dataType)
 {
     switch (dataType) {
@@ -2392,17 +4307,48 @@ bool drvModbusAsyn::isZeroTerminatedString(modbusDataType_t dataType)
     return false;
 }
 
-asynStatus drvModbusAsyn::checkOffset(int offset)
+/* Returns asynError if the width words starting at offset are not all in the port memory,
+ * or if they are not all in the same poll block */
+asynStatus drvModbusAsyn::checkOffset(int offset, int width)
 {
+    int block;
+
     if (offset < 0) return asynError;
+    if (width < 1) width = 1;
     if (absoluteAddressing_) {
-        if (offset > 65535) return asynError;
+        if (offset + width > 65536) return asynError;
     } else {
-        if (offset >= modbusLength_) return asynError;
+        if (offset + width > modbusLength_) return asynError;
+        block = findPollBlock(offset);
+        if ((block >= 0) && (offset + width > pollBlocks_[block].offset + pollBlocks_[block].length)) return asynError;
     }
     return asynSuccess;
 }
 
+/* Returns the Modbus function of the poll block that contains offset, or modbusFunction_ if there is none */
+int drvModbusAsyn::pollBlockFunction(int offset)
+{
+    int block = absoluteAddressing_ ? -1 : findPollBlock(offset);
+
+    if (block < 0) return modbusFunction_;
+    return pollBlocks_[block].function;
+}
+
+/* Returns the number of words of port memory used by a value of dataType at offset.
+ * The bit functions use one word per value whatever the data type. */
+int drvModbusAsyn::valueWords(int offset, modbusDataType_t dataType)
+{
+    switch (pollBlockFunction(offset)) {
+        case MODBUS_READ_COILS:
+        case MODBUS_READ_DISCRETE_INPUTS:
+        case MODBUS_WRITE_SINGLE_COIL:
+        case MODBUS_WRITE_MULTIPLE_COILS:
+            return 1;
+        default:
+            return dataTypeWords(dataType);
+    }
+}
+
 asynStatus drvModbusAsyn::checkModbusFunction(int *modbusFunction)
 {
     /* If this is an initial read operation on a write function code and
@@ -3002,10 +4948,14 @@ asynStatus drvModbusAsyn::readPlcString(modbusDataType_t dataType, int offset,
                                         char *data, size_t maxChars, int *bufferLen)
 {
     size_t i;
+    int end = modbusLength_;
+    int block = findPollBlock(offset);
     asynStatus status = asynSuccess;
     static const char *functionName="readPlcString";
 
-    for (i=0; i<maxChars && offset<modbusLength_; i++, offset++) {
+    /* A string ends at the end of its poll block, the next block is not contiguous in the device */
+    if (block >= 0) end = pollBlocks_[block].offset + pollBlocks_[block].length;
+    for (i=0; i<maxChars && offset<end; i++, offset++) {
         switch (dataType) {
             case dataTypeStringHigh:
             case dataTypeZStringHigh:
@@ -3174,9 +5124,52 @@ static void drvModbusAsynConfigureCallFunc(const iocshArgBuf *args)
 }
 
 
+
+/** EPICS iocsh callable function to add a block of Modbus memory to be polled by a read port */
+asynStatus drvModbusAsynAddPollBlock(const char *portName, int modbusFunction,
+                                     int modbusStartAddress, int modbusLength)
+{
+    drvModbusAsyn *pDriver = NULL;
+    size_t i;
+
+    /* Only look at the modbus ports, findAsynPortDriver would also find ports of other drivers */
+    epicsThreadOnce(&pollPortsOnceId, pollPortsInit, NULL);
+    epicsMutexLock(pollPortsMutex);
+    for (i=0; i<imagePorts.size(); i++) {
+        if (portName && (strcmp(imagePorts[i]->portName, portName) == 0)) pDriver = imagePorts[i];
+    }
+    epicsMutexUnlock(pollPortsMutex);
+    if (!pDriver) {
+        printf("ERROR: drvModbusAsynAddPollBlock cannot find modbus port %s\n", portName ? portName : "");
+        return asynError;
+    }
+    return pDriver->addPollBlock(modbusFunction, modbusStartAddress, modbusLength);
+}
+
+static const iocshArg AddPollBlockArg0 = {"Port name",            iocshArgString};
+static const iocshArg AddPollBlockArg1 = {"Modbus function code", iocshArgInt};
+static const iocshArg AddPollBlockArg2 = {"Modbus start address", iocshArgInt};
+static const iocshArg AddPollBlockArg3 = {"Modbus length",        iocshArgInt};
+
+static const iocshArg * const drvModbusAsynAddPollBlockArgs[4] = {
+    &AddPollBlockArg0,
+    &AddPollBlockArg1,
+    &AddPollBlockArg2,
+    &AddPollBlockArg3
+};
+
+static const iocshFuncDef drvModbusAsynAddPollBlockFuncDef=
+                                                    {"drvModbusAsynAddPollBlock", 4,
+                                                     drvModbusAsynAddPollBlockArgs};
+static void drvModbusAsynAddPollBlockCallFunc(const iocshArgBuf *args)
+{
+  drvModbusAsynAddPollBlock(args[0].sval, args[1].ival, args[2].ival, args[3].ival);
+}
+
 static void drvModbusAsynRegister(void)
 {
   iocshRegister(&drvModbusAsynConfigureFuncDef,drvModbusAsynConfigureCallFunc);
+  iocshRegister(&drvModbusAsynAddPollBlockFuncDef,drvModbusAsynAddPollBlockCallFunc);
 }
 
 epicsExportRegistrar(drvModbusAsynRegister);
@@ -9,8 +9,14 @@
 #ifndef drvModbusAsyn_H
 #define drvModbusAsyn_H
 
+#include <vector>
+#include <map>
+#include <set>
+
 #include <epicsThread.h>
 #include <epicsEvent.h>
+#include <epicsTime.h>
+#include <callback.h>
 
 #include <asynPortDriver.h>
 #include "modbus.h"
@@ -34,6 +40,29 @@
 #define MODBUS_IO_ERRORS_STRING           "IO_ERRORS"
 #define MODBUS_LAST_IO_TIME_STRING        "LAST_IO_TIME"
 #define MODBUS_MAX_IO_TIME_STRING         "MAX_IO_TIME"
+#define MODBUS_UDP_RETRANSMITS_STRING     "UDP_RETRANSMITS"
+#define MODBUS_UDP_RTO_STRING             "UDP_RTO"
+#define MODBUS_TCP_STALE_REPLIES_STRING   "TCP_STALE_REPLIES"
+#define MODBUS_TCP_FRAMING_ERRORS_STRING  "TCP_FRAMING_ERRORS"
+#define MODBUS_POLL_FIXED_RATE_STRING     "POLL_FIXED_RATE"
+#define MODBUS_POLL_PERIOD_STRING         "POLL_PERIOD"
+#define MODBUS_POLL_JITTER_MIN_STRING     "POLL_JITTER_MIN"
+#define MODBUS_POLL_JITTER_MAX_STRING     "POLL_JITTER_MAX"
+#define MODBUS_POLL_JITTER_STDDEV_STRING  "POLL_JITTER_STDDEV"
+#define MODBUS_POLL_OVERRUNS_STRING       "POLL_OVERRUNS"
+#define MODBUS_POLL_PHASE_STRING          "POLL_PHASE"
+#define MODBUS_POLL_IDLE_DELAY_STRING     "POLL_IDLE_DELAY"
+#define MODBUS_POLL_IDLE_BLOCKS_STRING    "POLL_IDLE_BLOCKS"
+#define MODBUS_READ_CACHE_TTL_STRING      "READ_CACHE_TTL"
+#define MODBUS_READ_CACHE_SIZE_STRING     "READ_CACHE_SIZE"
+#define MODBUS_READ_CACHE_HITS_STRING     "READ_CACHE_HITS"
+#define MODBUS_WRITE_WINDOW_STRING        "WRITE_WINDOW"
+#define MODBUS_WRITE_COALESCED_STRING     "WRITE_COALESCED"
+#define MODBUS_WRITE_ERROR_STRING         "WRITE_ERROR"
+#define MODBUS_MASK_WRITE_STRING          "MASK_WRITE"
+#define MODBUS_WRITE_THROUGH_STRING       "WRITE_THROUGH"
+#define MODBUS_WRITE_DELTA_STRING         "WRITE_DELTA"
+#define MODBUS_WRITE_DELTA_SKIPPED_STRING "WRITE_DELTA_SKIPPED"
 
 // These are the data type strings that are used in the drvUser parameter
 // They are not registered with asynPortDriver
@@ -75,6 +104,10 @@
 #define MODBUS_ZSTRING_HIGH_LOW_STRING  "ZSTRING_HIGH_LOW"
 #define MODBUS_ZSTRING_LOW_HIGH_STRING  "ZSTRING_LOW_HIGH"
 
+// This can follow a data type string or MODBUS_DATA after an '=' sign,
+// e.g. "FLOAT32_LE=ONCHANGE", to only do callbacks when the data have changed
+#define MODBUS_ONCHANGE_STRING          "ONCHANGE"
+
 #define HISTOGRAM_LENGTH 200  /* Length of time histogram */
 
 typedef enum {
@@ -119,6 +152,63 @@ typedef enum {
 } modbusDataType_t;
 
 struct modbusDrvUser_t;
+struct modbusPollEntry_t;
+struct modbusScheduleEntry_t;
+class modbusCoalesceGroup;
+class modbusBackoff;
+class modbusConnectionPool;
+class modbusScheduler;
+
+/* A single Modbus transaction, used by doModbusIOPipelined() */
+typedef struct modbusTransaction_t {
+    int slave;
+    int function;
+    int start;
+    epicsUInt16 *data;
+    int len;
+    asynStatus status;    /* Completion status of the transaction */
+} modbusTransaction_t;
+
+/* A block of Modbus memory polled by a read port.  The blocks are stored one after
+ * the other in data_, so each block appears at a different asyn address offset. */
+typedef struct modbusPollBlock_t {
+    int function;
+    int start;
+    int length;
+    int offset;           /* Offset of the first element of the block in data_ */
+    bool hasClients;      /* The block has interrupt clients */
+    bool interested;      /* Clients were interested in the block at the last poll */
+    double lastRead;      /* Monotonic time in seconds of the last read of the block */
+    double lastDemand;    /* Monotonic time in seconds of the last synchronous read from the block */
+    bool active;          /* The block is read in this poll */
+    asynStatus status;    /* Status of the last read of the block */
+    asynStatus prevStatus; /* Status when the callbacks for the block were last done */
+} modbusPollBlock_t;
+
+/* A change to one word or bit of data_ made by a write from another port, or from this port.
+ * The new value is (old value & andMask) | orMask. */
+typedef struct modbusImageUpdate_t {
+    int offset;
+    epicsUInt16 andMask;
+    epicsUInt16 orMask;
+} modbusImageUpdate_t;
+
+/* An entry in a callback table.  The table caches what readPollerCycle() needs to know about each
+ * asynInt32, asynInt64 or asynFloat64 interrupt client, so it is not looked up on every poll. */
+typedef struct modbusCallbackEntry_t {
+    int offset;
+    int width;                  /* Number of 16-bit words converted for this client */
+    int block;                  /* Index of the poll block that contains offset, -1 if none */
+    modbusDataType_t dataType;
+    bool onChange;
+    asynUser *pasynUser;
+    void *pInterrupt;           /* asynInt32Interrupt, asynInt64Interrupt or asynFloat64Interrupt */
+} modbusCallbackEntry_t;
+
+typedef struct modbusCallbackTable_t {
+    std::vector<modbusCallbackEntry_t> entries;  /* Sorted by offset */
+    int generation;             /* Value of interruptGeneration_ when the table was built */
+} modbusCallbackTable_t;
 
 class epicsShareClass drvModbusAsyn : public asynPortDriver {
 public:
@@ -170,12 +260,51 @@ public:
 
     /* These are the methods that are new to this class */
     void readPoller();
+    double readPollerCycle();
+    bool pollLinkFailed();
+    void doDataCallbacks(bool changedOnly);
+    void applyImageUpdates();
+    void wakeReadPoller();
+    void writeFlusher();
     modbusDataType_t getDataType(asynUser *pasynUser);
     int getStringLen(asynUser *pasynUser, size_t maxChars);
+    bool clientDataChanged(asynUser *pasynUser, int offset, int len);
+    void updateCallbackTable(modbusCallbackTable_t *pTable, ELLLIST *pclientList, const char *interfaceType,
+                             int generation);
+    static asynStatus registerInterruptUserInt32(void *drvPvt, asynUser *pasynUser,
+                                                 interruptCallbackInt32 callback, void *userPvt, void **registrarPvt);
+    static asynStatus cancelInterruptUserInt32(void *drvPvt, asynUser *pasynUser, void *registrarPvt);
+    static asynStatus registerInterruptUserInt64(void *drvPvt, asynUser *pasynUser,
+                                                 interruptCallbackInt64 callback, void *userPvt, void **registrarPvt);
+    static asynStatus cancelInterruptUserInt64(void *drvPvt, asynUser *pasynUser, void *registrarPvt);
+    static asynStatus registerInterruptUserFloat64(void *drvPvt, asynUser *pasynUser,
+                                                   interruptCallbackFloat64 callback, void *userPvt, void **registrarPvt);
+    static asynStatus cancelInterruptUserFloat64(void *drvPvt, asynUser *pasynUser, void *registrarPvt);
+    static asynStatus registerInterruptUserUInt32Digital(void *drvPvt, asynUser *pasynUser,
+                                                         interruptCallbackUInt32Digital callback, void *userPvt,
+                                                         epicsUInt32 mask, void **registrarPvt);
+    static asynStatus cancelInterruptUserUInt32Digital(void *drvPvt, asynUser *pasynUser, void *registrarPvt);
+    static asynStatus registerInterruptUserInt32Array(void *drvPvt, asynUser *pasynUser,
+                                                      interruptCallbackInt32Array callback, void *userPvt,
+                                                      void **registrarPvt);
+    static asynStatus cancelInterruptUserInt32Array(void *drvPvt, asynUser *pasynUser, void *registrarPvt);
+    static asynStatus registerInterruptUserFloat64Array(void *drvPvt, asynUser *pasynUser,
+                                                        interruptCallbackFloat64Array callback, void *userPvt,
+                                                        void **registrarPvt);
+    static asynStatus cancelInterruptUserFloat64Array(void *drvPvt, asynUser *pasynUser, void *registrarPvt);
+    static asynStatus registerInterruptUserOctet(void *drvPvt, asynUser *pasynUser,
+                                                 interruptCallbackOctet callback, void *userPvt,
+                                                 void **registrarPvt);
+    static asynStatus cancelInterruptUserOctet(void *drvPvt, asynUser *pasynUser, void *registrarPvt);
     bool isZeroTerminatedString(modbusDataType_t dataType);
-    asynStatus checkOffset(int offset);
+    asynStatus checkOffset(int offset, int width);
+    int pollBlockFunction(int offset);
+    int valueWords(int offset, modbusDataType_t dataType);
     asynStatus checkModbusFunction(int *modbusFunction);
     asynStatus doModbusIO(int slave, int function, int start, epicsUInt16 *data, int len);
+    asynStatus doModbusIOPipelined(modbusTransaction_t *transactions, int numTransactions);
+    asynStatus addPollBlock(int function, int start, int length);
+    bool wordsChanged(int offset, int len);
     asynStatus readPlcInt32(modbusDataType_t dataType, int offset, epicsInt32 *value, int *bufferLen);
     asynStatus writePlcInt32(modbusDataType_t dataType, int offset, epicsInt32 value, epicsUInt16 *buffer, int *bufferLen);
     asynStatus readPlcInt64(modbusDataType_t dataType, int offset, epicsInt64 *value, int *bufferLen);
@@ -184,6 +313,7 @@ public:
     asynStatus writePlcFloat(modbusDataType_t dataType, int offset, epicsFloat64  value, epicsUInt16 *buffer, int *bufferLen);
     asynStatus readPlcString (modbusDataType_t dataType, int offset, char *value, size_t maxChars, int *bufferLen);
     asynStatus writePlcString(modbusDataType_t dataType, int offset, const char *value, size_t maxChars, size_t *nActual, int *bufferLen);
+    void stopWriteFlusher();
     bool modbusExiting_;
 
 protected:
@@ -200,8 +330,64 @@ protected:
     int P_IOErrors;
     int P_LastIOTime;
     int P_MaxIOTime;
+    int P_UDPRetransmits;
+    int P_UDPRTO;
+    int P_TCPStaleReplies;
+    int P_TCPFramingErrors;
+    int P_PollFixedRate;
+    int P_PollPeriod;
+    int P_PollJitterMin;
+    int P_PollJitterMax;
+    int P_PollJitterStdDev;
+    int P_PollOverruns;
+    int P_PollPhase;
+    int P_PollIdleDelay;
+    int P_PollIdleBlocks;
+    int P_ReadCacheTTL;
+    int P_ReadCacheSize;
+    int P_ReadCacheHits;
+    int P_WriteWindow;
+    int P_WriteCoalesced;
+    int P_WriteError;
+    int P_MaskWrite;
+    int P_WriteThrough;
+    int P_WriteDelta;
+    int P_WriteDeltaSkipped;
 
 private:
+    int acquireConnection(asynUser **ppasynUserOctet, asynUser **ppasynUserCommon);
+    void releaseConnection(int connection, asynStatus status, double elapsed);
+    void beginTransaction();
+    asynStatus endTransaction(int slave, int function, int start, epicsUInt16 *data, int len, asynStatus status);
+    asynStatus checkConnection(asynUser *pasynUserOctet, asynUser *pasynUserCommon);
+    asynStatus buildModbusRequest(int slave, int function, int start, epicsUInt16 *data, int len,
+                                  int *requestSize, int *replySize);
+    asynStatus parseModbusReply(int function, epicsUInt16 *data, int len);
+    void updateLinkStatistics();
+    void resetPollStatistics();
+    void updatePollStatistics(double start);
+    double nextPollDelay();
+    double autoPollPhase();
+    double pollPhaseDelay();
+    void markPollInterest(int offset, int width);
+    void findPollClients();
+    int selectPollBlocks(double now, bool readAll);
+    asynStatus pollDemanded(int offset);
+    int findPollBlock(int offset);
+    asynStatus pollBlockStatus(int block);
+    bool pollBlockCallbacks(int block, bool changedOnly, bool *force);
+    asynStatus readAbsolute(int function, int start, int len);
+    void updateIOStatistics(asynUser *pasynUserOctet, asynStatus status,
+                            epicsTimeStamp *startTime, epicsTimeStamp *endTime,
+                            size_t nwrite, int requestSize, size_t nread);
+    asynStatus writeSingleRegisters(int start, epicsUInt16 *data, int len);
+    asynStatus writeMultipleRegisters(int start, epicsUInt16 *data, int len);
+    asynStatus flushWrites();
+    void writeThrough(int slave, int function, int start, epicsUInt16 *data, int len);
+    void queueImageUpdates(const std::vector<modbusImageUpdate_t> &updates);
+    asynStatus writeArrayRegisters(int start, epicsUInt16 *data, int len);
+    void updateDeltaImages(int function, int start, int len, asynStatus status);
+
     /* Our data */
     bool initialized_;           /* If initialized successfully */
     char *octetPortName_;        /* asyn port name for the asyn octet port */
@@ -209,8 +395,10 @@ private:
     bool isConnected_;            /* Connection status */
     asynStatus ioStatus_;        /* I/O error status */
     asynStatus prevIOStatus_;    /* Previous I/O error status */
-    asynUser  *pasynUserOctet_;  /* asynUser for asynOctet interface to asyn octet port */
-    asynUser  *pasynUserCommon_; /* asynUser for asynCommon interface to asyn octet port */
+    asynUser  *pasynUserOctet_;  /* asynUser for asynOctet interface to asyn octet port,
+                                  * or to the first connection of a pool */
+    asynUser  *pasynUserCommon_; /* asynUser for asynCommon interface to asyn octet port,
+                                  * or to the first connection of a pool */
     asynUser  *pasynUserTrace_;  /* asynUser for asynTrace on this port */
     int modbusSlave_;            /* Modbus slave address */
     int modbusFunction_;         /* Modbus function code */
@@ -220,9 +408,12 @@ private:
     modbusDataType_t dataType_;  /* Data type */
     modbusDrvUser_t *drvUser_;   /* Drv user structure */
     epicsUInt16 *data_;          /* Memory buffer */
-    char modbusRequest_[MAX_MODBUS_FRAME_SIZE];      /* Modbus request message */
-    char modbusReply_[MAX_MODBUS_FRAME_SIZE];        /* Modbus reply message */
+    char requestFrame_[MODBUS_FRAME_HEADROOM + MAX_MODBUS_FRAME_SIZE]; /* Request message with header space */
+    char replyFrame_[MODBUS_FRAME_HEADROOM + MAX_MODBUS_FRAME_SIZE];   /* Reply message with header space */
+    char *modbusRequest_;        /* Modbus request message, in requestFrame_ after the header space */
+    char *modbusReply_;          /* Modbus reply message, in replyFrame_ after the header space */
     double pollDelay_;           /* Delay for readPoller */
+    double pollPortsDelay_;      /* Copy of pollDelay_ for the other ports, protected by pollPortsMutex */
     epicsThreadId readPollerThreadId_;
     epicsEventId readPollerEventId_;
     bool forceCallback_;
@@ -239,6 +430,87 @@ private:
     bool enableHistogram_;
     int histogramMsPerBin_;
     int readbackOffset_;  /* Readback offset for Wago devices */
+    bool udpStatistics_;  /* The octet port is a Modbus/UDP port, so UDP_RETRANSMITS and UDP_RTO are updated */
+    bool tcpStatistics_;  /* The octet port is a Modbus/TCP port, so TCP_STALE_REPLIES and TCP_FRAMING_ERRORS are updated */
+    epicsUInt16 *prevData_;      /* Previous contents of memory buffer */
+    epicsInt32 *int32Data_;      /* Buffer used for asynInt32Array callbacks */
+    epicsFloat64 *float64Data_;  /* Buffer used for asynFloat64Array callbacks */
+    bool firstPollDone_;
+    bool pollFixedRate_;         /* Poll at fixed times rather than pollDelay_ after each poll */
+    double pollStart_;           /* Monotonic time in seconds at which the last poll started */
+    double pollDeadline_;        /* Monotonic time in seconds at which the next poll is due in fixed rate mode */
+    int pollOverruns_;           /* Polls skipped because the previous poll was late */
+    int numPollPeriods_;         /* Number of periods in the statistics */
+    double pollPeriodMean_;      /* Mean and sum of squared deviations of the poll period */
+    double pollPeriodM2_;
+    double pollJitterMin_;
+    double pollJitterMax_;
+    double pollPhase_;           /* Offset of the polls within the poll period, < 0 to compute it automatically */
+    bool pollPhaseDone_;         /* The first poll after iocInit has been delayed to the phase */
+    double pollIdleDelay_;       /* Delay between reads of blocks without clients, 0 to always read them,
+                                  * < 0 to never read them */
+    std::vector<modbusTransaction_t> pollActive_; /* Transactions for the blocks read by this poll */
+    double readCacheTTL_;        /* Time in seconds absolute addressing reads are cached, 0 to not cache */
+    int readCacheSize_;          /* Number of words or bits read into the cache on a miss */
+    epicsUInt16 *readCache_;     /* Data from the last absolute addressing read */
+    int readCacheFunction_;      /* Modbus function, start address and length of the data in readCache_ */
+    int readCacheStart_;
+    int readCacheLength_;        /* 0 if the cache is empty */
+    double readCacheTime_;       /* Monotonic time in seconds at which readCache_ was read */
+    std::set<std::pair<int, int> > readCacheNoReadAhead_; /* Function and start address of reads that
+                                                           * failed with illegal address when reading ahead */
+    int readCacheHits_;
+    double writeWindow_;         /* Time in seconds writes are queued to be merged with others, 0 to not queue */
+    double writeDeadline_;       /* Monotonic time in seconds at which the queued writes are written */
+    std::map<int, epicsUInt16> pendingWrites_; /* Queued register values, indexed by Modbus address */
+    int numPendingWrites_;       /* Number of writes in pendingWrites_ */
+    int writesCoalesced_;        /* Number of writes that did not need their own transaction */
+    epicsThreadId writeFlushThreadId_;
+    epicsEventId writeFlushEventId_;
+    epicsEventId writeFlushDoneEventId_;  /* Signalled by the write flusher when it exits */
+    bool maskWrite_;             /* Use function 22 for writes with a mask, rather than read/modify/write */
+    int modbusException_;        /* Exception code in the last reply, 0 if it was not an exception */
+    bool writeThrough_;          /* Successful writes update the data_ of the ports that read the same registers */
+    epicsMutexId imageUpdateMutex_;  /* Protects imageUpdates_ and imageUpdateQueued_ */
+    std::vector<modbusImageUpdate_t> imageUpdates_; /* Changes to data_ from writes, not applied yet */
+    bool imageUpdateQueued_;     /* imageUpdateCallback_ has been requested */
+    CALLBACK imageUpdateCallback_;
+    bool writeDelta_;            /* Array writes only send the registers that changed since the last write */
+    std::map<int, std::vector<epicsUInt16> > deltaImages_; /* Last data written by each array output,
+                                                            * indexed by Modbus start address */
+    int writeDeltaSkipped_;      /* Number of registers that array writes did not need to send */
+    modbusPollEntry_t *pollEntry_; /* Entry in the shared poll engine, NULL if this port has its own thread */
+    modbusScheduler *scheduler_;   /* Scheduler for the octet port, NULL if it has none */
+    modbusScheduleEntry_t *scheduleEntry_; /* Entry in scheduler_ */
+    std::vector<modbusPollBlock_t> pollBlocks_;         /* Blocks polled by the poller */
+    std::vector<modbusTransaction_t> pollTransactions_; /* One transaction per block */
+    modbusCoalesceGroup *coalesceGroup_; /* Group of ports whose reads are coalesced, NULL if none */
+    int coalesceMember_;                 /* Index of this port in coalesceGroup_ */
+    modbusBackoff *backoff_;             /* Reconnect backoff shared with the other ports on the octet port */
+    bool linkError_;                     /* A transaction failed without a reply since this was cleared */
+    modbusConnectionPool *connectionPool_;   /* Pool of connections named by octetPortName_, NULL if none */
+    std::vector<asynUser *> poolOctetUsers_;  /* asynOctet asynUser for each connection in the pool */
+    std::vector<asynUser *> poolCommonUsers_; /* asynCommon asynUser for each connection in the pool */
+    asynInt32 int32Interface_;           /* Copies of the standard interfaces with our */
+    asynInt64 int64Interface_;           /* registerInterruptUser and cancelInterruptUser */
+    asynFloat64 float64Interface_;
+    asynUInt32Digital uInt32DigitalInterface_;
+    asynInt32Array int32ArrayInterface_;
+    asynFloat64Array float64ArrayInterface_;
+    asynOctet octetInterface_;
+    asynInt32 *pInt32Base_;              /* The original interfaces */
+    asynInt64 *pInt64Base_;
+    asynFloat64 *pFloat64Base_;
+    asynUInt32Digital *pUInt32DigitalBase_;
+    asynInt32Array *pInt32ArrayBase_;
+    asynFloat64Array *pFloat64ArrayBase_;
+    asynOctet *pOctetBase_;
+    int interruptGeneration_;            /* Incremented when interrupt users are added or removed */
+    int pollInterestGeneration_;         /* Value of interruptGeneration_ when hasClients of the blocks was set */
+    modbusCallbackTable_t int32Callbacks_;
+    modbusCallbackTable_t int64Callbacks_;
+    modbusCallbackTable_t float64Callbacks_;
+    std::vector<epicsUInt32> changedWords_; /* Bitmap of words that changed in the last poll cycle */
 };
 
 #endif /* drvModbusAsyn_H */
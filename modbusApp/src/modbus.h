@@ -20,14 +20,26 @@
 #define MODBUS_WRITE_MULTIPLE_COILS          0x0F
 #define MODBUS_WRITE_MULTIPLE_REGISTERS      0x10
 #define MODBUS_REPORT_SLAVE_ID               0x11
+#define MODBUS_MASK_WRITE_REGISTER           0x16
 #define MODBUS_READ_WRITE_MULTIPLE_REGISTERS 0x17
 
 #define MODBUS_EXCEPTION_FCN            0x80
 
+/* Modbus exception codes */
+#define MODBUS_EXCEPTION_ILLEGAL_FUNCTION    0x01
+#define MODBUS_EXCEPTION_ILLEGAL_ADDRESS     0x02
+
+#define MAX_READ_WORDS       125        /* Modbus limit on number of words to read */
+#define MAX_WRITE_WORDS      123        /* Modbus limit on number of words to write */
+
 #define MAX_MODBUS_FRAME_SIZE 600       /* Buffer size for input and output packets.
                                          * 513 (max for ASCII serial) should be enough, 
                                          * but we are being safe. */
 
+#define MODBUS_FRAME_HEADROOM 8         /* Bytes reserved in front of the request and reply buffers
+                                         * so that the interpose driver can add the Modbus/TCP header
+                                         * and receive the reply without copying the data. */
+
 
 /* Pack all structures defined here on 1-byte boundaries */
 #pragma pack(1)
@@ -104,6 +116,23 @@ typedef struct modbusWriteMultipleResponse_str
     unsigned short numOutput;
 } PACKED_STRUCTURE modbusWriteMultipleResponse;
 
+typedef struct modbusMaskWriteRequest_str
+{
+    unsigned char  slave;
+    unsigned char  fcode;
+    unsigned short startReg;
+    unsigned short andMask;
+    unsigned short orMask;
+} PACKED_STRUCTURE modbusMaskWriteRequest;
+
+typedef struct modbusMaskWriteResponse_str
+{
+    unsigned char  fcode;
+    unsigned short startReg;
+    unsigned short andMask;
+    unsigned short orMask;
+} PACKED_STRUCTURE modbusMaskWriteResponse;
+
 typedef struct modbusReadWriteMultipleRequest_str
 {
     unsigned char  slave;
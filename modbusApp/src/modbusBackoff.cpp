@@ -0,0 +1,282 @@
+/* modbusBackoff.cpp
+ *
+ *   Reconnect backoff for the drvModbusAsyn ports that share an asyn octet port.
+ *   See modbusBackoff.h for a description.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <epicsString.h>
+#include <iocsh.h>
+
+#include "drvModbusAsyn.h"
+#include "modbusBackoff.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "modbusBackoff";
+
+#define DEFAULT_MIN_DELAY 1.0
+#define DEFAULT_MAX_DELAY 30.0
+
+typedef struct modbusBackoffConfig_t {
+    std::string octetPortName;
+    double minDelay;
+    double maxDelay;
+} modbusBackoffConfig_t;
+
+/* The configured octet ports and the backoff objects.  These are only modified at startup,
+ * but they are protected by a mutex anyway. */
+static std::vector<modbusBackoffConfig_t> backoffConfigs;
+static std::vector<modbusBackoff *> backoffs;
+static epicsMutexId backoffMutex;
+static epicsThreadOnceId backoffOnceId = EPICS_THREAD_ONCE_INIT;
+
+static void backoffInit(void *arg)
+{
+    backoffMutex = epicsMutexMustCreate();
+}
+
+static double backoffNow()
+{
+    return epicsMonotonicGet() / 1.e9;
+}
+
+modbusBackoff::modbusBackoff(const char *octetPortName, double minDelay, double maxDelay)
+  : octetPortName_(octetPortName),
+    minDelay_(minDelay),
+    maxDelay_(maxDelay),
+    failing_(false),
+    probing_(false),
+    delay_(minDelay),
+    nextAttempt_(0.),
+    numFailures_(0),
+    numRecoveries_(0)
+{
+    mutex_ = epicsMutexMustCreate();
+    /* Seed differently for each octet port so that ports for different devices do not retry in step */
+    random_ = (epicsUInt32)epicsMonotonicGet() ^ (epicsUInt32)(size_t)this;
+    if (random_ == 0) random_ = 1;
+}
+
+/** Adds a port to the backoff for its octet port, creating it if needed. */
+modbusBackoff *modbusBackoff::join(drvModbusAsyn *pDriver, const char *octetPortName)
+{
+    modbusBackoff *pBackoff = NULL;
+    double minDelay = DEFAULT_MIN_DELAY;
+    double maxDelay = DEFAULT_MAX_DELAY;
+    size_t i;
+
+    epicsThreadOnce(&backoffOnceId, backoffInit, NULL);
+    epicsMutexLock(backoffMutex);
+    for (i=0; i<backoffs.size(); i++) {
+        if (backoffs[i]->octetPortName_ == octetPortName) {
+            pBackoff = backoffs[i];
+            break;
+        }
+    }
+    if (!pBackoff) {
+        for (i=0; i<backoffConfigs.size(); i++) {
+            if (backoffConfigs[i].octetPortName == octetPortName) {
+                minDelay = backoffConfigs[i].minDelay;
+                maxDelay = backoffConfigs[i].maxDelay;
+            }
+        }
+        pBackoff = new modbusBackoff(octetPortName, minDelay, maxDelay);
+        backoffs.push_back(pBackoff);
+    }
+    epicsMutexUnlock(backoffMutex);
+
+    epicsMutexLock(pBackoff->mutex_);
+    pBackoff->members_.push_back(pDriver);
+    epicsMutexUnlock(pBackoff->mutex_);
+    return pBackoff;
+}
+
+/* Returns a random time between delay/2 and delay.  Must be called with the mutex locked. */
+double modbusBackoff::jitter(double delay)
+{
+    /* xorshift32 */
+    random_ ^= random_ << 13;
+    random_ ^= random_ >> 17;
+    random_ ^= random_ << 5;
+    return delay * (0.5 + 0.5 * (random_ / 4294967296.));
+}
+
+/** Returns true if the I/O for a poll may be done now.
+  * \param[out] probe Set to true if this is the attempt after the backoff delay expired,
+  *             in which case failed() or succeeded() must be called with the result.
+  * \param[out] wait If false is returned, the time in seconds to wait before calling again. */
+bool modbusBackoff::acquire(bool *probe, double *wait)
+{
+    double now;
+    bool allowed = true;
+
+    *probe = false;
+    *wait = 0.;
+    epicsMutexLock(mutex_);
+    if (failing_) {
+        now = backoffNow();
+        if (now < nextAttempt_) {
+            *wait = nextAttempt_ - now;
+            allowed = false;
+        } else if (probing_) {
+            /* Another port is trying, we are woken if it succeeds */
+            *wait = minDelay_;
+            allowed = false;
+        } else {
+            probing_ = true;
+            *probe = true;
+        }
+    }
+    epicsMutexUnlock(mutex_);
+    return allowed;
+}
+
+/** Reports that the I/O failed.  The delay is only increased for the attempt after it expired,
+  * not for the ports whose I/O was already in progress when the first failure happened. */
+void modbusBackoff::failed(bool probe)
+{
+    epicsMutexLock(mutex_);
+    if (!failing_) {
+        failing_ = true;
+        numFailures_ = 1;
+        delay_ = minDelay_;
+        nextAttempt_ = backoffNow() + jitter(delay_);
+    } else if (probe) {
+        numFailures_++;
+        delay_ *= 2.;
+        if (delay_ > maxDelay_) delay_ = maxDelay_;
+        nextAttempt_ = backoffNow() + jitter(delay_);
+    }
+    if (probe) probing_ = false;
+    epicsMutexUnlock(mutex_);
+}
+
+/** Reports that a transaction succeeded.  If the ports were backing off they are all woken. */
+void modbusBackoff::succeeded()
+{
+    std::vector<drvModbusAsyn *> members;
+    size_t i;
+
+    epicsMutexLock(mutex_);
+    if (!failing_) {
+        epicsMutexUnlock(mutex_);
+        return;
+    }
+    failing_ = false;
+    probing_ = false;
+    numFailures_ = 0;
+    delay_ = minDelay_;
+    numRecoveries_++;
+    members = members_;
+    epicsMutexUnlock(mutex_);
+    for (i=0; i<members.size(); i++) {
+        members[i]->wakeReadPoller();
+    }
+}
+
+void modbusBackoff::report(FILE *fp, int details)
+{
+    double now = backoffNow();
+    size_t i;
+
+    epicsMutexLock(mutex_);
+    fprintf(fp, "modbusBackoff: octet port %s, ports=%d, minDelay=%.3f, maxDelay=%.3f, recoveries=%d\n",
+            octetPortName_.c_str(), (int)members_.size(), minDelay_, maxDelay_, numRecoveries_);
+    if (failing_) {
+        fprintf(fp, "  failing: failures=%d, delay=%.3f, next attempt in %.3f, probing=%d\n",
+                numFailures_, delay_, (nextAttempt_ > now) ? nextAttempt_ - now : 0., probing_);
+    }
+    if (details > 0) {
+        for (i=0; i<members_.size(); i++) {
+            fprintf(fp, "  port %s\n", members_[i]->portName);
+        }
+    }
+    epicsMutexUnlock(mutex_);
+}
+
+
+extern "C" {
+
+/** EPICS iocsh callable function to set the reconnect backoff for the ports that use an octet port.
+  * This must be called before drvModbusAsynConfigure for those ports.
+  * \param[in] octetPortName Name of the asyn octet port.
+  * \param[in] minDelayMsec The delay after the first failure.  The default is 1000.
+  * \param[in] maxDelayMsec The largest delay.  The default is 30000. */
+int modbusBackoffConfigure(const char *octetPortName, int minDelayMsec, int maxDelayMsec)
+{
+    modbusBackoffConfig_t config;
+    size_t i;
+
+    if (!octetPortName || (strlen(octetPortName) == 0)) {
+        printf("%s::modbusBackoffConfigure octet port name must be specified\n", driverName);
+        return -1;
+    }
+    config.octetPortName = octetPortName;
+    config.minDelay = (minDelayMsec > 0) ? minDelayMsec/1000. : DEFAULT_MIN_DELAY;
+    config.maxDelay = (maxDelayMsec > 0) ? maxDelayMsec/1000. : DEFAULT_MAX_DELAY;
+    if (config.maxDelay < config.minDelay) config.maxDelay = config.minDelay;
+    epicsThreadOnce(&backoffOnceId, backoffInit, NULL);
+    epicsMutexLock(backoffMutex);
+    for (i=0; i<backoffConfigs.size(); i++) {
+        if (backoffConfigs[i].octetPortName == octetPortName) {
+            backoffConfigs[i] = config;
+            epicsMutexUnlock(backoffMutex);
+            return 0;
+        }
+    }
+    backoffConfigs.push_back(config);
+    epicsMutexUnlock(backoffMutex);
+    return 0;
+}
+
+int modbusBackoffReport(int details)
+{
+    size_t i;
+
+    epicsThreadOnce(&backoffOnceId, backoffInit, NULL);
+    epicsMutexLock(backoffMutex);
+    for (i=0; i<backoffs.size(); i++) {
+        backoffs[i]->report(stdout, details);
+    }
+    epicsMutexUnlock(backoffMutex);
+    return 0;
+}
+
+/* iocsh functions */
+
+static const iocshArg ConfigureArg0 = {"Octet port name", iocshArgString};
+static const iocshArg ConfigureArg1 = {"Min delay (msec)", iocshArgInt};
+static const iocshArg ConfigureArg2 = {"Max delay (msec)", iocshArgInt};
+static const iocshArg * const modbusBackoffConfigureArgs[3] = {&ConfigureArg0, &ConfigureArg1,
+                                                               &ConfigureArg2};
+static const iocshFuncDef modbusBackoffConfigureFuncDef =
+    {"modbusBackoffConfigure", 3, modbusBackoffConfigureArgs};
+static void modbusBackoffConfigureCallFunc(const iocshArgBuf *args)
+{
+    modbusBackoffConfigure(args[0].sval, args[1].ival, args[2].ival);
+}
+
+static const iocshArg ReportArg0 = {"Details", iocshArgInt};
+static const iocshArg * const modbusBackoffReportArgs[1] = {&ReportArg0};
+static const iocshFuncDef modbusBackoffReportFuncDef =
+    {"modbusBackoffReport", 1, modbusBackoffReportArgs};
+static void modbusBackoffReportCallFunc(const iocshArgBuf *args)
+{
+    modbusBackoffReport(args[0].ival);
+}
+
+static void modbusBackoffRegister(void)
+{
+    iocshRegister(&modbusBackoffConfigureFuncDef, modbusBackoffConfigureCallFunc);
+    iocshRegister(&modbusBackoffReportFuncDef, modbusBackoffReportCallFunc);
+}
+
+epicsExportRegistrar(modbusBackoffRegister);
+
+} // extern "C"
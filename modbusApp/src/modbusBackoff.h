@@ -0,0 +1,50 @@
+/* modbusBackoff.h
+ *
+ *   Reconnect backoff shared by the drvModbusAsyn ports that use the same asyn octet port.
+ *
+ *   When the I/O on an octet port fails the ports that use it stop polling for a delay that
+ *   doubles after each failed attempt, up to a maximum, with random jitter so that the ports
+ *   for different devices do not retry in step.  When the delay has expired one port is allowed
+ *   to try the I/O; the others keep waiting.  As soon as any transaction on the octet port
+ *   succeeds the backoff is reset and all of the ports are woken to resume normal polling.
+ */
+
+#ifndef modbusBackoff_H
+#define modbusBackoff_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsTypes.h>
+#include <shareLib.h>
+
+class drvModbusAsyn;
+
+class epicsShareClass modbusBackoff {
+public:
+    static modbusBackoff *join(drvModbusAsyn *pDriver, const char *octetPortName);
+    bool acquire(bool *probe, double *wait);
+    void failed(bool probe);
+    void succeeded();
+    void report(FILE *fp, int details);
+
+private:
+    modbusBackoff(const char *octetPortName, double minDelay, double maxDelay);
+    double jitter(double delay);
+    epicsMutexId mutex_;
+    std::string octetPortName_;
+    double minDelay_;
+    double maxDelay_;
+    bool failing_;           /* The last attempt failed and the ports are backing off */
+    bool probing_;           /* A port is doing the attempt after the delay expired */
+    double delay_;           /* Current delay before the next attempt, before jitter */
+    double nextAttempt_;     /* Monotonic time in seconds at which the next attempt may be made */
+    int numFailures_;        /* Consecutive failed attempts */
+    int numRecoveries_;
+    epicsUInt32 random_;     /* State of the random number generator for the jitter */
+    std::vector<drvModbusAsyn *> members_;
+};
+
+#endif /* modbusBackoff_H */
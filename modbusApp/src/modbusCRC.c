@@ -0,0 +1,110 @@
+/* modbusCRC.c */
+
+/*
+ * CRC of Modbus RTU frames.  The 16-bit CRC uses the reflected polynomial 0xA001
+ * and an initial value of 0xFFFF, as described in the Modbus over serial line documentation.
+ */
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+
+#include <epicsExport.h>
+#include "modbusCRC.h"
+
+/* Table of CRC values for high-order byte */
+static const unsigned char CRC_Lookup_Hi[] = {
+0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81,
+0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
+0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01,
+0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81,
+0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0,
+0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01,
+0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81,
+0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
+0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01,
+0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81,
+0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
+0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01,
+0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81,
+0x40
+};
+
+/* Table of CRC values for low-order byte */
+static const unsigned char CRC_Lookup_Lo[] = {
+0x00, 0xC0, 0xC1, 0x01, 0xC3, 0x03, 0x02, 0xC2, 0xC6, 0x06, 0x07, 0xC7, 0x05, 0xC5, 0xC4,
+0x04, 0xCC, 0x0C, 0x0D, 0xCD, 0x0F, 0xCF, 0xCE, 0x0E, 0x0A, 0xCA, 0xCB, 0x0B, 0xC9, 0x09,
+0x08, 0xC8, 0xD8, 0x18, 0x19, 0xD9, 0x1B, 0xDB, 0xDA, 0x1A, 0x1E, 0xDE, 0xDF, 0x1F, 0xDD,
+0x1D, 0x1C, 0xDC, 0x14, 0xD4, 0xD5, 0x15, 0xD7, 0x17, 0x16, 0xD6, 0xD2, 0x12, 0x13, 0xD3,
+0x11, 0xD1, 0xD0, 0x10, 0xF0, 0x30, 0x31, 0xF1, 0x33, 0xF3, 0xF2, 0x32, 0x36, 0xF6, 0xF7,
+0x37, 0xF5, 0x35, 0x34, 0xF4, 0x3C, 0xFC, 0xFD, 0x3D, 0xFF, 0x3F, 0x3E, 0xFE, 0xFA, 0x3A,
+0x3B, 0xFB, 0x39, 0xF9, 0xF8, 0x38, 0x28, 0xE8, 0xE9, 0x29, 0xEB, 0x2B, 0x2A, 0xEA, 0xEE,
+0x2E, 0x2F, 0xEF, 0x2D, 0xED, 0xEC, 0x2C, 0xE4, 0x24, 0x25, 0xE5, 0x27, 0xE7, 0xE6, 0x26,
+0x22, 0xE2, 0xE3, 0x23, 0xE1, 0x21, 0x20, 0xE0, 0xA0, 0x60, 0x61, 0xA1, 0x63, 0xA3, 0xA2,
+0x62, 0x66, 0xA6, 0xA7, 0x67, 0xA5, 0x65, 0x64, 0xA4, 0x6C, 0xAC, 0xAD, 0x6D, 0xAF, 0x6F,
+0x6E, 0xAE, 0xAA, 0x6A, 0x6B, 0xAB, 0x69, 0xA9, 0xA8, 0x68, 0x78, 0xB8, 0xB9, 0x79, 0xBB,
+0x7B, 0x7A, 0xBA, 0xBE, 0x7E, 0x7F, 0xBF, 0x7D, 0xBD, 0xBC, 0x7C, 0xB4, 0x74, 0x75, 0xB5,
+0x77, 0xB7, 0xB6, 0x76, 0x72, 0xB2, 0xB3, 0x73, 0xB1, 0x71, 0x70, 0xB0, 0x50, 0x90, 0x91,
+0x51, 0x93, 0x53, 0x52, 0x92, 0x96, 0x56, 0x57, 0x97, 0x55, 0x95, 0x94, 0x54, 0x9C, 0x5C,
+0x5D, 0x9D, 0x5F, 0x9F, 0x9E, 0x5E, 0x5A, 0x9A, 0x9B, 0x5B, 0x99, 0x59, 0x58, 0x98, 0x88,
+0x48, 0x49, 0x89, 0x4B, 0x8B, 0x8A, 0x4A, 0x4E, 0x8E, 0x8F, 0x4F, 0x8D, 0x4D, 0x4C, 0x8C,
+0x44, 0x84, 0x85, 0x45, 0x87, 0x47, 0x46, 0x86, 0x82, 0x42, 0x43, 0x83, 0x41, 0x81, 0x80,
+0x40
+};
+
+/* Tables for computing the CRC 8 bytes at a time ("slicing-by-8").
+ * CRC_Slice[0] is the usual byte-at-a-time table for the reflected polynomial 0xA001,
+ * CRC_Slice[k] gives the CRC of a byte followed by k zero bytes. */
+static epicsUInt16 CRC_Slice[8][256];
+static epicsThreadOnceId CRC_OnceId = EPICS_THREAD_ONCE_INIT;
+
+static void initCRC(void *arg)
+{
+    int i, j, k;
+    epicsUInt16 crc;
+
+    for (i=0; i<256; i++) {
+        crc = (epicsUInt16)i;
+        for (j=0; j<8; j++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+        }
+        CRC_Slice[0][i] = crc;
+    }
+    for (k=1; k<8; k++) {
+        for (i=0; i<256; i++) {
+            crc = CRC_Slice[k-1][i];
+            CRC_Slice[k][i] = (crc >> 8) ^ CRC_Slice[0][crc & 0xFF];
+        }
+    }
+}
+
+void modbusComputeCRC(const char *buffer, int nchars,
+                      unsigned char *CRC_Lo, unsigned char *CRC_Hi)
+{
+    const unsigned char *p = (const unsigned char *)buffer;
+    epicsUInt16 crc = 0xFFFF;
+    int CRC_Index ;              /* will index into CRC lookup table */
+    int i;
+
+    epicsThreadOnce(&CRC_OnceId, initCRC, NULL);
+    /* Process 8 bytes at a time.  The CRC only overlaps the first 2 bytes of each block. */
+    for (i=0; i+8<=nchars; i+=8, p+=8) {
+        crc ^= (epicsUInt16)(p[0] | (p[1] << 8));
+        crc = CRC_Slice[7][crc & 0xFF] ^ CRC_Slice[6][crc >> 8] ^
+              CRC_Slice[5][p[2]] ^ CRC_Slice[4][p[3]] ^
+              CRC_Slice[3][p[4]] ^ CRC_Slice[2][p[5]] ^
+              CRC_Slice[1][p[6]] ^ CRC_Slice[0][p[7]];
+    }
+    *CRC_Hi = (unsigned char)(crc >> 8);
+    *CRC_Lo = (unsigned char)(crc & 0xFF);
+
+    /* The remaining bytes use the algorithm from the official Modbus over serial line documentation */
+    for (; i<nchars; i++, p++) {
+        CRC_Index = *CRC_Lo ^ *p;
+        *CRC_Lo = *CRC_Hi ^ CRC_Lookup_Hi[CRC_Index];
+        *CRC_Hi = CRC_Lookup_Lo[CRC_Index];
+    }
+}
@@ -0,0 +1,23 @@
+/* modbusCRC.h */
+/*
+ * Computes the CRC of Modbus RTU frames.
+ */
+
+#ifndef modbusCRC_H
+#define modbusCRC_H
+
+#include <shareLib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif  /* __cplusplus */
+
+/* Computes the CRC of the nchars bytes in buffer.  The low byte is sent first in the frame. */
+epicsShareFunc void modbusComputeCRC(const char *buffer, int nchars,
+                                     unsigned char *CRC_Lo, unsigned char *CRC_Hi);
+
+#ifdef __cplusplus
+}
+#endif  /* __cplusplus */
+
+#endif /* modbusCRC_H */
@@ -0,0 +1,290 @@
+/* modbusCoalesce.cpp
+ *
+ *   Request coalescing for drvModbusAsyn read ports.
+ *   See modbusCoalesce.h for a description.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <epicsString.h>
+#include <iocsh.h>
+
+#include "modbus.h"
+#include "drvModbusAsyn.h"
+#include "modbusCoalesce.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "modbusCoalesce";
+
+typedef struct modbusCoalesceConfig_t {
+    std::string octetPortName;
+    int maxGap;
+} modbusCoalesceConfig_t;
+
+/* The configured octet ports and the groups.  These are only modified at startup,
+ * but they are protected by a mutex anyway. */
+static std::vector<modbusCoalesceConfig_t> coalesceConfigs;
+static std::vector<modbusCoalesceGroup *> coalesceGroups;
+static epicsMutexId coalesceMutex;
+static epicsThreadOnceId coalesceOnceId = EPICS_THREAD_ONCE_INIT;
+
+static void coalesceInit(void *arg)
+{
+    coalesceMutex = epicsMutexMustCreate();
+}
+
+static bool compareMemberStart(const modbusCoalesceMember_t *a, const modbusCoalesceMember_t *b)
+{
+    return a->start < b->start;
+}
+
+modbusCoalesceGroup::modbusCoalesceGroup(const char *octetPortName, int slave, int function, int maxGap)
+  : octetPortName_(octetPortName),
+    slave_(slave),
+    function_(function),
+    maxGap_(maxGap),
+    planValid_(false)
+{
+    mutex_ = epicsMutexMustCreate();
+    if ((function == MODBUS_READ_COILS) || (function == MODBUS_READ_DISCRETE_INPUTS)) {
+        maxLength_ = MAX_READ_WORDS * 16;
+    } else {
+        maxLength_ = MAX_READ_WORDS;
+    }
+}
+
+/** Adds a port to the group for its octet port, slave and function code, creating the group if needed.
+  * Returns NULL if coalescing has not been configured for the octet port, or if the function code
+  * is not one that can be coalesced.
+  * \param[out] memberIndex The index to pass to read() */
+modbusCoalesceGroup *modbusCoalesceGroup::join(drvModbusAsyn *pDriver, const char *octetPortName,
+                                               int slave, int function, int start, int length,
+                                               int *memberIndex)
+{
+    modbusCoalesceGroup *pGroup = NULL;
+    modbusCoalesceMember_t member;
+    int maxGap = -1;
+    size_t i;
+
+    switch (function) {
+        case MODBUS_READ_COILS:
+        case MODBUS_READ_DISCRETE_INPUTS:
+        case MODBUS_READ_HOLDING_REGISTERS:
+        case MODBUS_READ_INPUT_REGISTERS:
+            break;
+        default:
+            return NULL;
+    }
+    epicsThreadOnce(&coalesceOnceId, coalesceInit, NULL);
+    epicsMutexLock(coalesceMutex);
+    for (i=0; i<coalesceConfigs.size(); i++) {
+        if (coalesceConfigs[i].octetPortName == octetPortName) maxGap = coalesceConfigs[i].maxGap;
+    }
+    if (maxGap < 0) {
+        epicsMutexUnlock(coalesceMutex);
+        return NULL;
+    }
+    for (i=0; i<coalesceGroups.size(); i++) {
+        if ((coalesceGroups[i]->octetPortName_ == octetPortName) &&
+            (coalesceGroups[i]->slave_ == slave) &&
+            (coalesceGroups[i]->function_ == function)) {
+            pGroup = coalesceGroups[i];
+            break;
+        }
+    }
+    if (!pGroup) {
+        pGroup = new modbusCoalesceGroup(octetPortName, slave, function, maxGap);
+        coalesceGroups.push_back(pGroup);
+    }
+    epicsMutexUnlock(coalesceMutex);
+
+    member.pDriver = pDriver;
+    member.start = start;
+    member.length = length;
+    member.transaction = -1;
+    epicsMutexLock(pGroup->mutex_);
+    *memberIndex = (int)pGroup->members_.size();
+    pGroup->members_.push_back(member);
+    pGroup->planValid_ = false;
+    epicsMutexUnlock(pGroup->mutex_);
+    return pGroup;
+}
+
+/* Merges the member ranges into transactions.  The ranges are sorted by start address and each
+ * range is added to the current transaction if the gap to it is no more than maxGap_ and the
+ * transaction stays within the Modbus length limit.  Otherwise a new transaction is started.
+ * Must be called with the mutex locked. */
+void modbusCoalesceGroup::buildPlan()
+{
+    std::vector<modbusCoalesceMember_t *> sorted;
+    modbusCoalesceTransaction_t *pTransaction = NULL;
+    modbusCoalesceMember_t *pMember;
+    int end;
+    size_t i;
+
+    for (i=0; i<members_.size(); i++) sorted.push_back(&members_[i]);
+    std::sort(sorted.begin(), sorted.end(), compareMemberStart);
+    transactions_.clear();
+    for (i=0; i<sorted.size(); i++) {
+        pMember = sorted[i];
+        end = pMember->start + pMember->length;
+        if (!transactions_.empty()) {
+            pTransaction = &transactions_.back();
+            if ((pMember->start <= pTransaction->start + pTransaction->length + maxGap_) &&
+                (std::max(end, pTransaction->start + pTransaction->length) - pTransaction->start <= maxLength_)) {
+                pTransaction->length = std::max(end, pTransaction->start + pTransaction->length) - pTransaction->start;
+                pMember->transaction = (int)transactions_.size() - 1;
+                continue;
+            }
+        }
+        transactions_.push_back(modbusCoalesceTransaction_t());
+        pTransaction = &transactions_.back();
+        pTransaction->start = pMember->start;
+        pTransaction->length = pMember->length;
+        pTransaction->readTime = -1.;
+        pTransaction->status = asynSuccess;
+        pTransaction->numReads = 0;
+        pMember->transaction = (int)transactions_.size() - 1;
+    }
+    for (i=0; i<transactions_.size(); i++) {
+        transactions_[i].data.resize(transactions_[i].length);
+    }
+    planValid_ = true;
+}
+
+/** Reads the range of a member port into data.
+  * The transaction that contains the range is only done if it was last done more than maxAge
+  * seconds ago, otherwise the data from that transaction are used.
+  * The I/O is done with the doModbusIO() method of the port that is reading. */
+asynStatus modbusCoalesceGroup::read(drvModbusAsyn *pDriver, int memberIndex, epicsUInt16 *data, double maxAge)
+{
+    modbusCoalesceMember_t *pMember;
+    modbusCoalesceTransaction_t *pTransaction;
+    double now;
+    asynStatus status;
+
+    epicsMutexLock(mutex_);
+    if (!planValid_) buildPlan();
+    pMember = &members_[memberIndex];
+    pTransaction = &transactions_[pMember->transaction];
+    now = epicsMonotonicGet() / 1.e9;
+    if ((pTransaction->readTime < 0.) || (now - pTransaction->readTime >= maxAge)) {
+        pTransaction->status = pDriver->doModbusIO(slave_, function_, pTransaction->start,
+                                                   &pTransaction->data[0], pTransaction->length);
+        pTransaction->readTime = now;
+        pTransaction->numReads++;
+    }
+    status = pTransaction->status;
+    if (status == asynSuccess) {
+        memcpy(data, &pTransaction->data[pMember->start - pTransaction->start],
+               pMember->length * sizeof(epicsUInt16));
+    }
+    epicsMutexUnlock(mutex_);
+    return status;
+}
+
+void modbusCoalesceGroup::report(FILE *fp, int details)
+{
+    size_t i;
+
+    epicsMutexLock(mutex_);
+    fprintf(fp, "modbusCoalesce: octet port %s, slave %d, function %d, ports=%d, maxGap=%d\n",
+            octetPortName_.c_str(), slave_, function_, (int)members_.size(), maxGap_);
+    if (details > 0) {
+        if (!planValid_) buildPlan();
+        for (i=0; i<transactions_.size(); i++) {
+            fprintf(fp, "  transaction %d: start=0%o, length=%d, reads=%d\n",
+                    (int)i, transactions_[i].start, transactions_[i].length, transactions_[i].numReads);
+        }
+        for (i=0; i<members_.size(); i++) {
+            fprintf(fp, "  port %s: start=0%o, length=%d, transaction %d\n",
+                    members_[i].pDriver->portName, members_[i].start, members_[i].length,
+                    members_[i].transaction);
+        }
+    }
+    epicsMutexUnlock(mutex_);
+}
+
+
+extern "C" {
+
+/** EPICS iocsh callable function to enable request coalescing for the read ports that use an octet port.
+  * This must be called before drvModbusAsynConfigure for those ports.
+  * \param[in] octetPortName Name of the asyn octet port.
+  * \param[in] maxGap The largest gap in words (bits for function codes 1 and 2) between the ranges of two ports
+  *            that is read rather than doing a separate transaction. */
+int modbusCoalesceConfigure(const char *octetPortName, int maxGap)
+{
+    modbusCoalesceConfig_t config;
+    size_t i;
+
+    if (!octetPortName || (strlen(octetPortName) == 0)) {
+        printf("%s::modbusCoalesceConfigure octet port name must be specified\n", driverName);
+        return -1;
+    }
+    if (maxGap < 0) maxGap = 0;
+    epicsThreadOnce(&coalesceOnceId, coalesceInit, NULL);
+    epicsMutexLock(coalesceMutex);
+    for (i=0; i<coalesceConfigs.size(); i++) {
+        if (coalesceConfigs[i].octetPortName == octetPortName) {
+            coalesceConfigs[i].maxGap = maxGap;
+            epicsMutexUnlock(coalesceMutex);
+            return 0;
+        }
+    }
+    config.octetPortName = octetPortName;
+    config.maxGap = maxGap;
+    coalesceConfigs.push_back(config);
+    epicsMutexUnlock(coalesceMutex);
+    return 0;
+}
+
+int modbusCoalesceReport(int details)
+{
+    size_t i;
+
+    epicsThreadOnce(&coalesceOnceId, coalesceInit, NULL);
+    epicsMutexLock(coalesceMutex);
+    for (i=0; i<coalesceGroups.size(); i++) {
+        coalesceGroups[i]->report(stdout, details);
+    }
+    epicsMutexUnlock(coalesceMutex);
+    return 0;
+}
+
+/* iocsh functions */
+
+static const iocshArg ConfigureArg0 = {"Octet port name", iocshArgString};
+static const iocshArg ConfigureArg1 = {"Max gap",         iocshArgInt};
+static const iocshArg * const modbusCoalesceConfigureArgs[2] = {&ConfigureArg0, &ConfigureArg1};
+static const iocshFuncDef modbusCoalesceConfigureFuncDef =
+    {"modbusCoalesceConfigure", 2, modbusCoalesceConfigureArgs};
+static void modbusCoalesceConfigureCallFunc(const iocshArgBuf *args)
+{
+    modbusCoalesceConfigure(args[0].sval, args[1].ival);
+}
+
+static const iocshArg ReportArg0 = {"Details", iocshArgInt};
+static const iocshArg * const modbusCoalesceReportArgs[1] = {&ReportArg0};
+static const iocshFuncDef modbusCoalesceReportFuncDef =
+    {"modbusCoalesceReport", 1, modbusCoalesceReportArgs};
+static void modbusCoalesceReportCallFunc(const iocshArgBuf *args)
+{
+    modbusCoalesceReport(args[0].ival);
+}
+
+static void modbusCoalesceRegister(void)
+{
+    iocshRegister(&modbusCoalesceConfigureFuncDef, modbusCoalesceConfigureCallFunc);
+    iocshRegister(&modbusCoalesceReportFuncDef, modbusCoalesceReportCallFunc);
+}
+
+epicsExportRegistrar(modbusCoalesceRegister);
+
+} // extern "C"
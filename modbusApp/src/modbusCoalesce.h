@@ -0,0 +1,65 @@
+/* modbusCoalesce.h
+ *
+ *   Request coalescing for drvModbusAsyn read ports.
+ *
+ *   If modbusCoalesceConfigure() is called for an asyn octet port before the drvModbusAsyn
+ *   ports that use it are created, then read ports that use the same octet port, slave and
+ *   function code are placed in a group.  The memory ranges of the ports in a group are merged
+ *   into as few Modbus transactions as possible.  When a port polls, the transaction that
+ *   contains its range is done (unless another port in the group did it recently enough),
+ *   and the port's range is copied out of the result.
+ */
+
+#ifndef modbusCoalesce_H
+#define modbusCoalesce_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsTypes.h>
+#include <asynDriver.h>
+#include <shareLib.h>
+
+class drvModbusAsyn;
+
+typedef struct modbusCoalesceMember_t {
+    drvModbusAsyn *pDriver;
+    int start;
+    int length;
+    int transaction;     /* Index of the transaction that contains this range */
+} modbusCoalesceMember_t;
+
+typedef struct modbusCoalesceTransaction_t {
+    int start;
+    int length;
+    std::vector<epicsUInt16> data;
+    double readTime;     /* Monotonic time in seconds of the last read, <0 if never read */
+    asynStatus status;   /* Status of the last read */
+    int numReads;
+} modbusCoalesceTransaction_t;
+
+class epicsShareClass modbusCoalesceGroup {
+public:
+    static modbusCoalesceGroup *join(drvModbusAsyn *pDriver, const char *octetPortName,
+                                     int slave, int function, int start, int length,
+                                     int *memberIndex);
+    asynStatus read(drvModbusAsyn *pDriver, int memberIndex, epicsUInt16 *data, double maxAge);
+    void report(FILE *fp, int details);
+
+private:
+    modbusCoalesceGroup(const char *octetPortName, int slave, int function, int maxGap);
+    void buildPlan();
+    epicsMutexId mutex_;
+    std::string octetPortName_;
+    int slave_;
+    int function_;
+    int maxGap_;
+    int maxLength_;
+    bool planValid_;
+    std::vector<modbusCoalesceMember_t> members_;
+    std::vector<modbusCoalesceTransaction_t> transactions_;
+};
+
+#endif /* modbusCoalesce_H */
@@ -0,0 +1,228 @@
+/* modbusConnectionPool.cpp
+ *
+ *   Pool of Modbus/TCP connections to the same device.
+ *   See modbusConnectionPool.h for a description.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsString.h>
+#include <iocsh.h>
+
+#include "modbusConnectionPool.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "modbusConnectionPool";
+
+/* The pools.  These are only created at startup, but they are protected by a mutex anyway. */
+static std::vector<modbusConnectionPool *> connectionPools;
+static epicsMutexId connectionPoolMutex;
+static epicsThreadOnceId connectionPoolOnceId = EPICS_THREAD_ONCE_INIT;
+
+static void connectionPoolInit(void *arg)
+{
+    connectionPoolMutex = epicsMutexMustCreate();
+}
+
+modbusConnectionPool::modbusConnectionPool(const char *poolName, const std::vector<std::string> &octetPortNames)
+  : poolName_(poolName),
+    next_(0)
+{
+    modbusPoolConnection_t connection;
+    size_t i;
+
+    mutex_ = epicsMutexMustCreate();
+    connection.outstanding = 0;
+    connection.numTransactions = 0;
+    connection.numErrors = 0;
+    connection.totalTime = 0.;
+    connection.maxTime = 0.;
+    for (i=0; i<octetPortNames.size(); i++) {
+        connection.octetPortName = octetPortNames[i];
+        connections_.push_back(connection);
+    }
+}
+
+/** Returns the pool with this name, or NULL if there is none */
+modbusConnectionPool *modbusConnectionPool::find(const char *poolName)
+{
+    modbusConnectionPool *pPool = NULL;
+    size_t i;
+
+    epicsThreadOnce(&connectionPoolOnceId, connectionPoolInit, NULL);
+    epicsMutexLock(connectionPoolMutex);
+    for (i=0; i<connectionPools.size(); i++) {
+        if (connectionPools[i]->poolName_ == poolName) {
+            pPool = connectionPools[i];
+            break;
+        }
+    }
+    epicsMutexUnlock(connectionPoolMutex);
+    return pPool;
+}
+
+int modbusConnectionPool::numConnections()
+{
+    return (int)connections_.size();
+}
+
+const char *modbusConnectionPool::octetPortName(int connection)
+{
+    return connections_[connection].octetPortName.c_str();
+}
+
+/** Returns the connection with the fewest transactions in progress and counts the new transaction.
+  * Ties are broken round-robin so that the connections are used equally when the load is light.
+  * release() must be called when the transaction is done. */
+int modbusConnectionPool::acquire()
+{
+    int n = (int)connections_.size();
+    int best, i, j;
+
+    epicsMutexLock(mutex_);
+    best = next_;
+    for (i=0; i<n; i++) {
+        j = (next_ + i) % n;
+        if (connections_[j].outstanding < connections_[best].outstanding) best = j;
+    }
+    connections_[best].outstanding++;
+    next_ = (best + 1) % n;
+    epicsMutexUnlock(mutex_);
+    return best;
+}
+
+/** Ends a transaction started with acquire().
+  * \param[in] elapsed The time in seconds taken by the transaction */
+void modbusConnectionPool::release(int connection, asynStatus status, double elapsed)
+{
+    modbusPoolConnection_t *pConnection = &connections_[connection];
+
+    epicsMutexLock(mutex_);
+    pConnection->outstanding--;
+    pConnection->numTransactions++;
+    if (status != asynSuccess) {
+        pConnection->numErrors++;
+    } else {
+        pConnection->totalTime += elapsed;
+        if (elapsed > pConnection->maxTime) pConnection->maxTime = elapsed;
+    }
+    epicsMutexUnlock(mutex_);
+}
+
+/** Ends a transaction started with acquire() that was not done, without counting it */
+void modbusConnectionPool::cancel(int connection)
+{
+    epicsMutexLock(mutex_);
+    connections_[connection].outstanding--;
+    epicsMutexUnlock(mutex_);
+}
+
+void modbusConnectionPool::report(FILE *fp, int details)
+{
+    modbusPoolConnection_t *pConnection;
+    int numOK;
+    size_t i;
+
+    epicsMutexLock(mutex_);
+    fprintf(fp, "modbusConnectionPool: %s, connections=%d\n", poolName_.c_str(), (int)connections_.size());
+    for (i=0; i<connections_.size(); i++) {
+        pConnection = &connections_[i];
+        numOK = pConnection->numTransactions - pConnection->numErrors;
+        fprintf(fp, "  %s: transactions=%d, errors=%d, in progress=%d, mean time=%.3f ms, max time=%.3f ms\n",
+                pConnection->octetPortName.c_str(), pConnection->numTransactions, pConnection->numErrors,
+                pConnection->outstanding, (numOK > 0) ? pConnection->totalTime * 1000. / numOK : 0.,
+                pConnection->maxTime * 1000.);
+    }
+    epicsMutexUnlock(mutex_);
+}
+
+
+/** EPICS iocsh callable function to create a connection pool.
+  * This must be called before drvModbusAsynConfigure for the ports that use the pool.
+  * \param[in] poolName Name of the pool, which is passed to drvModbusAsynConfigure as the octet port name.
+  * \param[in] octetPortNames Names of the asyn IP ports in the pool, separated by spaces or commas.
+  *            modbusInterposeConfig must have been called for each of them. */
+int modbusConnectionPoolConfigure(const char *poolName, const char *octetPortNames)
+{
+    std::vector<std::string> names;
+    char *list, *name, *last;
+    modbusConnectionPool *pPool;
+
+    if (!poolName || (strlen(poolName) == 0)) {
+        printf("%s::modbusConnectionPoolConfigure pool name must be specified\n", driverName);
+        return -1;
+    }
+    if (!octetPortNames || (strlen(octetPortNames) == 0)) {
+        printf("%s::modbusConnectionPoolConfigure octet port names must be specified\n", driverName);
+        return -1;
+    }
+    if (modbusConnectionPool::find(poolName)) {
+        printf("%s::modbusConnectionPoolConfigure pool %s already exists\n", driverName, poolName);
+        return -1;
+    }
+    list = epicsStrDup(octetPortNames);
+    for (name = epicsStrtok_r(list, " ,", &last); name; name = epicsStrtok_r(NULL, " ,", &last)) {
+        names.push_back(name);
+    }
+    free(list);
+    if (names.empty()) {
+        printf("%s::modbusConnectionPoolConfigure octet port names must be specified\n", driverName);
+        return -1;
+    }
+    pPool = new modbusConnectionPool(poolName, names);
+    epicsMutexLock(connectionPoolMutex);
+    connectionPools.push_back(pPool);
+    epicsMutexUnlock(connectionPoolMutex);
+    return 0;
+}
+
+extern "C" {
+
+int modbusConnectionPoolReport(int details)
+{
+    size_t i;
+
+    epicsThreadOnce(&connectionPoolOnceId, connectionPoolInit, NULL);
+    epicsMutexLock(connectionPoolMutex);
+    for (i=0; i<connectionPools.size(); i++) {
+        connectionPools[i]->report(stdout, details);
+    }
+    epicsMutexUnlock(connectionPoolMutex);
+    return 0;
+}
+
+/* iocsh functions */
+
+static const iocshArg ConfigureArg0 = {"Pool name",         iocshArgString};
+static const iocshArg ConfigureArg1 = {"Octet port names",  iocshArgString};
+static const iocshArg * const modbusConnectionPoolConfigureArgs[2] = {&ConfigureArg0, &ConfigureArg1};
+static const iocshFuncDef modbusConnectionPoolConfigureFuncDef =
+    {"modbusConnectionPoolConfigure", 2, modbusConnectionPoolConfigureArgs};
+static void modbusConnectionPoolConfigureCallFunc(const iocshArgBuf *args)
+{
+    modbusConnectionPoolConfigure(args[0].sval, args[1].sval);
+}
+
+static const iocshArg ReportArg0 = {"Details", iocshArgInt};
+static const iocshArg * const modbusConnectionPoolReportArgs[1] = {&ReportArg0};
+static const iocshFuncDef modbusConnectionPoolReportFuncDef =
+    {"modbusConnectionPoolReport", 1, modbusConnectionPoolReportArgs};
+static void modbusConnectionPoolReportCallFunc(const iocshArgBuf *args)
+{
+    modbusConnectionPoolReport(args[0].ival);
+}
+
+static void modbusConnectionPoolRegister(void)
+{
+    iocshRegister(&modbusConnectionPoolConfigureFuncDef, modbusConnectionPoolConfigureCallFunc);
+    iocshRegister(&modbusConnectionPoolReportFuncDef, modbusConnectionPoolReportCallFunc);
+}
+
+epicsExportRegistrar(modbusConnectionPoolRegister);
+
+} // extern "C"
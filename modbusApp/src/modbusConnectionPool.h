@@ -0,0 +1,52 @@
+/* modbusConnectionPool.h
+ *
+ *   Pool of Modbus/TCP connections to the same device.
+ *
+ *   Each asyn IP port is one socket, and all of the drvModbusAsyn ports that use it are serialized
+ *   by its port lock.  A pool is created with modbusConnectionPoolConfigure() from several asyn IP
+ *   ports to the same device, each of which has been configured with modbusInterposeConfig.
+ *   drvModbusAsyn ports that are configured with the name of the pool rather than an asyn port name
+ *   connect to all of the ports in the pool, and each transaction is sent on the connection that has
+ *   the fewest transactions in progress, so that different driver ports are polled in parallel.
+ */
+
+#ifndef modbusConnectionPool_H
+#define modbusConnectionPool_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <asynDriver.h>
+#include <shareLib.h>
+
+typedef struct modbusPoolConnection_t {
+    std::string octetPortName;
+    int outstanding;       /* Transactions in progress */
+    int numTransactions;
+    int numErrors;
+    double totalTime;      /* Seconds spent in successful transactions */
+    double maxTime;
+} modbusPoolConnection_t;
+
+class epicsShareClass modbusConnectionPool {
+public:
+    static modbusConnectionPool *find(const char *poolName);
+    int numConnections();
+    const char *octetPortName(int connection);
+    int acquire();
+    void release(int connection, asynStatus status, double elapsed);
+    void cancel(int connection);
+    void report(FILE *fp, int details);
+
+private:
+    modbusConnectionPool(const char *poolName, const std::vector<std::string> &octetPortNames);
+    friend int modbusConnectionPoolConfigure(const char *poolName, const char *octetPortNames);
+    epicsMutexId mutex_;
+    std::string poolName_;
+    int next_;             /* Where the search for the least busy connection starts */
+    std::vector<modbusPoolConnection_t> connections_;
+};
+
+#endif /* modbusConnectionPool_H */
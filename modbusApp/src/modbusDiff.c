@@ -0,0 +1,110 @@
+/* modbusDiff.c */
+
+/*
+ * Changed-word bitmap of two register images.  The poller uses this to decide which
+ * clients need callbacks, so that a poll where nothing changed costs little more than
+ * reading the data.
+ */
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MODBUS_DIFF_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define MODBUS_DIFF_SSE2
+#endif
+
+#include <epicsTypes.h>
+
+#include <epicsExport.h>
+#include "modbusDiff.h"
+
+/* Returns the bitmap of changed words for 32 words starting at newData and oldData */
+static epicsUInt32 diff32(const epicsUInt16 *newData, const epicsUInt16 *oldData)
+{
+#if defined(MODBUS_DIFF_AVX2)
+    __m256i zero = _mm256_setzero_si256();
+    epicsUInt32 equal = 0;
+    int i;
+    for (i=0; i<2; i++) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(newData + 16*i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(oldData + 16*i));
+        /* Packing puts words 0-7 in bytes 0-7 and words 8-15 in bytes 16-23 */
+        epicsUInt32 m = (epicsUInt32)_mm256_movemask_epi8(_mm256_packs_epi16(_mm256_cmpeq_epi16(a, b), zero));
+        equal |= ((m & 0xFF) | ((m >> 8) & 0xFF00)) << (16*i);
+    }
+    return ~equal;
+#elif defined(MODBUS_DIFF_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    epicsUInt32 equal = 0;
+    int i;
+    for (i=0; i<4; i++) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(newData + 8*i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(oldData + 8*i));
+        epicsUInt32 m = (epicsUInt32)_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(a, b), zero));
+        equal |= (m & 0xFF) << (8*i);
+    }
+    return ~equal;
+#else
+    epicsUInt32 changed = 0;
+    int i;
+    /* Most polls change nothing, so check that first */
+    if (memcmp(newData, oldData, 32*sizeof(epicsUInt16)) == 0) return 0;
+    for (i=0; i<32; i++) {
+        if (newData[i] != oldData[i]) changed |= 1u << i;
+    }
+    return changed;
+#endif
+}
+
+static int countBits(epicsUInt32 value)
+{
+    int n = 0;
+    while (value) {
+        value &= value - 1;
+        n++;
+    }
+    return n;
+}
+
+int modbusDiffWords(const epicsUInt16 *newData, const epicsUInt16 *oldData,
+                    int nWords, epicsUInt32 *bitmap)
+{
+    int nChanged = 0;
+    int i, j;
+    epicsUInt32 changed;
+
+    for (i=0; i+32<=nWords; i+=32) {
+        changed = diff32(newData + i, oldData + i);
+        bitmap[i/32] = changed;
+        if (changed) nChanged += countBits(changed);
+    }
+    if (i < nWords) {
+        changed = 0;
+        for (j=0; i+j<nWords; j++) {
+            if (newData[i+j] != oldData[i+j]) changed |= 1u << j;
+        }
+        bitmap[i/32] = changed;
+        nChanged += countBits(changed);
+    }
+    return nChanged;
+}
+
+int modbusDiffAnySet(const epicsUInt32 *bitmap, int offset, int nWords)
+{
+    int first = offset;
+    int last = offset + nWords - 1;
+    int i;
+    epicsUInt32 mask;
+
+    if (nWords <= 0) return 0;
+    for (i=first/32; i<=last/32; i++) {
+        mask = 0xFFFFFFFFu;
+        if (i == first/32) mask &= 0xFFFFFFFFu << (first%32);
+        if (i == last/32) mask &= 0xFFFFFFFFu >> (31 - last%32);
+        if (bitmap[i] & mask) return 1;
+    }
+    return 0;
+}
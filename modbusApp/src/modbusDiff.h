@@ -0,0 +1,33 @@
+/* modbusDiff.h */
+/*
+ * Finds the words that differ between two register images.
+ * The result is a bitmap with one bit per word, bit (i%32) of bitmap[i/32] being set if word i differs.
+ * SSE2 or AVX2 instructions are used when the compiler targets them, otherwise plain C.
+ */
+
+#ifndef modbusDiff_H
+#define modbusDiff_H
+
+#include <epicsTypes.h>
+#include <shareLib.h>
+
+/* Number of epicsUInt32 elements needed for a bitmap of nWords words */
+#define MODBUS_DIFF_BITMAP_SIZE(nWords) (((nWords) + 31) / 32)
+
+#ifdef __cplusplus
+extern "C" {
+#endif  /* __cplusplus */
+
+/* Compares nWords words of newData and oldData, writes the bitmap of changed words,
+ * and returns the number of changed words */
+epicsShareFunc int modbusDiffWords(const epicsUInt16 *newData, const epicsUInt16 *oldData,
+                                   int nWords, epicsUInt32 *bitmap);
+
+/* Returns 1 if any of the nWords words starting at offset are set in the bitmap, 0 otherwise */
+epicsShareFunc int modbusDiffAnySet(const epicsUInt32 *bitmap, int offset, int nWords);
+
+#ifdef __cplusplus
+}
+#endif  /* __cplusplus */
+
+#endif /* modbusDiff_H */
@@ -15,6 +15,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
 
 #include <cantProceed.h>
 #include <epicsAssert.h>
@@ -24,75 +25,86 @@
 #include <iocsh.h>
 
 #include <epicsThread.h>
+#include <epicsTime.h>
 #include "asynDriver.h"
 #include "asynOctet.h"
+#include "asynOption.h"
 
 #include <epicsExport.h>
 #include "modbusInterpose.h"
+#include "modbusCRC.h"
 #include "modbus.h"
 
 static char *driver="modbusInterpose";
 
 #define DEFAULT_TIMEOUT 2.0
+#define DEFAULT_UDP_MIN_RTO 0.01
+#define DEFAULT_UDP_RETRIES 4
+#define UDP_CLOCK_GRANULARITY 0.001
+#define DEFAULT_RESYNC_BUDGET 4096
 
-/* Table of CRC values for high-order byte */
-static unsigned char CRC_Lookup_Hi[] = {
-0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81,
-0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01,
-0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81,
-0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0,
-0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01,
-0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81,
-0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01,
-0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81,
-0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01,
-0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81,
-0x40
-};
+/* A Modbus/TCP request that has been sent but whose reply has not yet been returned */
+typedef struct modbusPipelineEntry {
+    int            transactionId;
+    int            received;              /* Reply arrived out of order and is stored in reply */
+    size_t         replyLen;
+    char           reply[MAX_MODBUS_FRAME_SIZE];
+} modbusPipelineEntry;
 
-/* Table of CRC values for low-order byte */
-static unsigned char CRC_Lookup_Lo[] = {
-0x00, 0xC0, 0xC1, 0x01, 0xC3, 0x03, 0x02, 0xC2, 0xC6, 0x06, 0x07, 0xC7, 0x05, 0xC5, 0xC4,
-0x04, 0xCC, 0x0C, 0x0D, 0xCD, 0x0F, 0xCF, 0xCE, 0x0E, 0x0A, 0xCA, 0xCB, 0x0B, 0xC9, 0x09,
-0x08, 0xC8, 0xD8, 0x18, 0x19, 0xD9, 0x1B, 0xDB, 0xDA, 0x1A, 0x1E, 0xDE, 0xDF, 0x1F, 0xDD,
-0x1D, 0x1C, 0xDC, 0x14, 0xD4, 0xD5, 0x15, 0xD7, 0x17, 0x16, 0xD6, 0xD2, 0x12, 0x13, 0xD3,
-0x11, 0xD1, 0xD0, 0x10, 0xF0, 0x30, 0x31, 0xF1, 0x33, 0xF3, 0xF2, 0x32, 0x36, 0xF6, 0xF7,
-0x37, 0xF5, 0x35, 0x34, 0xF4, 0x3C, 0xFC, 0xFD, 0x3D, 0xFF, 0x3F, 0x3E, 0xFE, 0xFA, 0x3A,
-0x3B, 0xFB, 0x39, 0xF9, 0xF8, 0x38, 0x28, 0xE8, 0xE9, 0x29, 0xEB, 0x2B, 0x2A, 0xEA, 0xEE,
-0x2E, 0x2F, 0xEF, 0x2D, 0xED, 0xEC, 0x2C, 0xE4, 0x24, 0x25, 0xE5, 0x27, 0xE7, 0xE6, 0x26,
-0x22, 0xE2, 0xE3, 0x23, 0xE1, 0x21, 0x20, 0xE0, 0xA0, 0x60, 0x61, 0xA1, 0x63, 0xA3, 0xA2,
-0x62, 0x66, 0xA6, 0xA7, 0x67, 0xA5, 0x65, 0x64, 0xA4, 0x6C, 0xAC, 0xAD, 0x6D, 0xAF, 0x6F,
-0x6E, 0xAE, 0xAA, 0x6A, 0x6B, 0xAB, 0x69, 0xA9, 0xA8, 0x68, 0x78, 0xB8, 0xB9, 0x79, 0xBB,
-0x7B, 0x7A, 0xBA, 0xBE, 0x7E, 0x7F, 0xBF, 0x7D, 0xBD, 0xBC, 0x7C, 0xB4, 0x74, 0x75, 0xB5,
-0x77, 0xB7, 0xB6, 0x76, 0x72, 0xB2, 0xB3, 0x73, 0xB1, 0x71, 0x70, 0xB0, 0x50, 0x90, 0x91,
-0x51, 0x93, 0x53, 0x52, 0x92, 0x96, 0x56, 0x57, 0x97, 0x55, 0x95, 0x94, 0x54, 0x9C, 0x5C,
-0x5D, 0x9D, 0x5F, 0x9F, 0x9E, 0x5E, 0x5A, 0x9A, 0x9B, 0x5B, 0x99, 0x59, 0x58, 0x98, 0x88,
-0x48, 0x49, 0x89, 0x4B, 0x8B, 0x8A, 0x4A, 0x4E, 0x8E, 0x8F, 0x4F, 0x8D, 0x4D, 0x4C, 0x8C,
-0x44, 0x84, 0x85, 0x45, 0x87, 0x47, 0x46, 0x86, 0x82, 0x42, 0x43, 0x83, 0x41, 0x81, 0x80,
-0x40
-};
+/* Request and reply buffers of a client with MODBUS_FRAME_HEADROOM bytes in front of the data,
+ * registered with modbusInterposeSetFrameBuffers() */
+typedef struct modbusFrameBuffers {
+    struct modbusFrameBuffers *next;
+    asynUser       *pasynUser;
+    char           *requestFrame;         /* Start of the header space in front of the request */
+    char           *replyFrame;           /* Start of the header space in front of the reply */
+} modbusFrameBuffers;
 
 typedef struct modbusPvt {
+    struct modbusPvt *next;
     char           *portName;
     double         timeout;
     double         writeDelay;
     asynInterface  modbusInterface;
     asynOctet      *pasynOctet;           /* Table for low level driver */
     void           *octetPvt;
+    asynInterface  optionInterface;
+    asynOption     *pasynOption;          /* Option table for low level driver, may be NULL */
+    void           *optionPvt;
     modbusLinkType linkType;
     asynUser       *pasynUser;
     int            transactionId;
+    const char     *lastFrame;            /* Last TCP/UDP frame written, resent on UDP timeouts */
     size_t         nWritten;
+    int            pipelineDepth;         /* Maximum number of outstanding TCP transactions */
+    int            pipelineHead;          /* Index of the oldest outstanding transaction */
+    int            nOutstanding;          /* Number of outstanding transactions */
+    modbusPipelineEntry pipeline[MODBUS_MAX_PIPELINE_DEPTH];
+    int            rtuTiming;             /* Use the RTU inter-frame gap instead of writeDelay */
+    double         rtuCharTime;           /* Time to send one character at the serial port settings */
+    double         rtuT35;                /* Inter-frame gap, 3.5 character times */
+    double         rtuLastActivity;       /* Time the line last carried a character, from monotonicNow() */
+    double         rtuIdleTime;           /* Total time waited to enforce the inter-frame gap */
+    int            rtuIdleCount;          /* Number of frames that had to wait */
+    double         udpSendTime;           /* Time the last UDP request was sent, from monotonicNow() */
+    double         udpSRTT;               /* Smoothed round-trip time, 0 until the first measurement */
+    double         udpRTTVAR;             /* Round-trip time variation */
+    double         udpRTO;                /* Current retransmission timeout */
+    double         udpMinRTO;
+    double         udpMaxRTO;
+    int            udpMaxRetries;         /* Maximum number of retransmissions of a request */
+    int            udpRetransmits;        /* Total number of retransmissions */
+    int            tcpResync;             /* Drain stale replies before each request and read framed replies */
+    int            resyncBudget;          /* Maximum number of stale bytes drained before each request */
+    int            tcpStaleReplies;       /* Number of stale replies discarded */
+    int            tcpStaleBytes;         /* Number of bytes in the stale replies */
+    int            tcpFramingErrors;      /* Number of times the MBAP framing was lost */
+    modbusFrameBuffers *frameBuffers;     /* Clients whose TCP and UDP frames are built and read in place */
     char           buffer[MAX_MODBUS_FRAME_SIZE];
     char           rxBuffer[MAX_MODBUS_FRAME_SIZE];
 } modbusPvt;
+
+static modbusPvt *pModbusPvtList;
     
 /* asynOctet methods */
 static asynStatus writeIt(void *ppvt,asynUser *pasynUser,
@@ -118,6 +130,15 @@ static asynOctet octet = {
     setInputEos,getInputEos,setOutputEos,getOutputEos
 };
 
+/* asynOption methods */
+static asynStatus setOption(void *ppvt, asynUser *pasynUser,
+    const char *key, const char *val);
+static asynStatus getOption(void *ppvt, asynUser *pasynUser,
+    const char *key, char *val, int sizeval);
+static asynOption option = {
+    setOption, getOption
+};
+
 
 epicsShareFunc int modbusInterposeConfig(const char *portName,
                                          modbusLinkType linkType, 
@@ -133,7 +154,14 @@ epicsShareFunc int modbusInterposeConfig(const char *portName,
     pPvt->linkType = linkType;
     pPvt->timeout = timeoutMsec/1000.;
     pPvt->writeDelay = writeDelayMsec/1000.;
+    pPvt->pipelineDepth = 1;
     if (pPvt->timeout == 0.0) pPvt->timeout = DEFAULT_TIMEOUT;
+    /* Until the round-trip time has been measured the retransmission timeout is the configured timeout */
+    pPvt->udpRTO = pPvt->timeout;
+    pPvt->udpMinRTO = DEFAULT_UDP_MIN_RTO;
+    pPvt->udpMaxRTO = pPvt->timeout;
+    pPvt->udpMaxRetries = DEFAULT_UDP_RETRIES;
+    pPvt->resyncBudget = DEFAULT_RESYNC_BUDGET;
     pPvt->modbusInterface.interfaceType = asynOctetType;
     pPvt->modbusInterface.pinterface = &octet;
     pPvt->modbusInterface.drvPvt = pPvt;
@@ -162,6 +190,24 @@ epicsShareFunc int modbusInterposeConfig(const char *portName,
     pPvt->pasynOctet = (asynOctet *)pasynInterface->pinterface;
     pPvt->octetPvt = pasynInterface->drvPvt;
 
+    /* Interpose the asynOption interface so that our options can be set with asynSetOption.
+     * Options we do not handle are passed to the underlying driver if it has an asynOption interface. */
+    pPvt->optionInterface.interfaceType = asynOptionType;
+    pPvt->optionInterface.pinterface = &option;
+    pPvt->optionInterface.drvPvt = pPvt;
+    pasynInterface = NULL;
+    status = pasynManager->interposeInterface(portName, 0,
+       &pPvt->optionInterface, &pasynInterface);
+    if(status!=asynSuccess) {
+        printf("%s interposeInterface failed for asynOption\n", portName);
+    } else if (pasynInterface) {
+        pPvt->pasynOption = (asynOption *)pasynInterface->pinterface;
+        pPvt->optionPvt = pasynInterface->drvPvt;
+    }
+
+    pPvt->next = pModbusPvtList;
+    pModbusPvtList = pPvt;
+
     return(0);
     
     bad:
@@ -171,59 +217,221 @@ epicsShareFunc int modbusInterposeConfig(const char *portName,
 }
 
 
-static void computeCRC(char *buffer, int nchars, 
-                       unsigned char *CRC_Lo, unsigned char *CRC_Hi) 
+static modbusPvt *findModbusPvt(const char *portName)
+{
+    modbusPvt *pPvt;
+
+    for (pPvt = pModbusPvtList; pPvt; pPvt = pPvt->next) {
+        if (strcmp(pPvt->portName, portName) == 0) break;
+    }
+    return pPvt;
+}
+
+epicsShareFunc int modbusInterposeGetPipelineDepth(const char *portName)
+{
+    modbusPvt *pPvt = findModbusPvt(portName);
+
+    if (!pPvt) return 1;
+    return pPvt->pipelineDepth;
+}
+
+/* Registers the request and reply buffers of a client of the interpose driver.  Each buffer has
+ * MODBUS_FRAME_HEADROOM bytes in front of the data and MAX_MODBUS_FRAME_SIZE bytes for the data.
+ * When the client writes from the request buffer or reads into the reply buffer with this asynUser,
+ * Modbus/TCP and UDP frames are built and read in place, without copying the data.
+ * Returns 0 if the port has the interpose driver, -1 otherwise. */
+epicsShareFunc int modbusInterposeSetFrameBuffers(asynUser *pasynUser, char *requestFrame, char *replyFrame)
+{
+    modbusPvt *pPvt;
+    modbusFrameBuffers *pBuffers;
+    const char *portName;
+
+    if (pasynManager->getPortName(pasynUser, &portName) != asynSuccess) return -1;
+    pPvt = findModbusPvt(portName);
+    if (!pPvt) return -1;
+    pBuffers = callocMustSucceed(1, sizeof(modbusFrameBuffers), "modbusInterposeSetFrameBuffers");
+    pBuffers->pasynUser = pasynUser;
+    pBuffers->requestFrame = requestFrame;
+    pBuffers->replyFrame = replyFrame;
+    /* The list is only used with the port locked */
+    pasynManager->lockPort(pasynUser);
+    pBuffers->next = pPvt->frameBuffers;
+    pPvt->frameBuffers = pBuffers;
+    pasynManager->unlockPort(pasynUser);
+    return 0;
+}
+
+/* Returns the registered request buffer if data is the request in it, otherwise NULL */
+static char *findRequestFrame(modbusPvt *pPvt, asynUser *pasynUser, const char *data)
+{
+    modbusFrameBuffers *pBuffers;
+
+    for (pBuffers = pPvt->frameBuffers; pBuffers; pBuffers = pBuffers->next) {
+        if ((pBuffers->pasynUser == pasynUser) &&
+            (data == pBuffers->requestFrame + MODBUS_FRAME_HEADROOM)) return pBuffers->requestFrame;
+    }
+    return NULL;
+}
+
+/* Returns the registered reply buffer if data is the reply in it, otherwise NULL */
+static char *findReplyFrame(modbusPvt *pPvt, asynUser *pasynUser, const char *data)
+{
+    modbusFrameBuffers *pBuffers;
+
+    for (pBuffers = pPvt->frameBuffers; pBuffers; pBuffers = pBuffers->next) {
+        if ((pBuffers->pasynUser == pasynUser) &&
+            (data == pBuffers->replyFrame + MODBUS_FRAME_HEADROOM)) return pBuffers->replyFrame;
+    }
+    return NULL;
+}
+
+epicsShareFunc int modbusInterposeGetTCPStatistics(const char *portName, int *staleReplies, int *framingErrors)
+{
+    modbusPvt *pPvt = findModbusPvt(portName);
+
+    if (!pPvt || (pPvt->linkType != modbusLinkTCP)) return -1;
+    *staleReplies = pPvt->tcpStaleReplies;
+    *framingErrors = pPvt->tcpFramingErrors;
+    return 0;
+}
+
+epicsShareFunc int modbusInterposeGetUDPStatistics(const char *portName, int *retransmits, double *rto)
+{
+    modbusPvt *pPvt = findModbusPvt(portName);
+
+    if (!pPvt || (pPvt->linkType != modbusLinkUDP)) return -1;
+    *retransmits = pPvt->udpRetransmits;
+    *rto = pPvt->udpRTO;
+    return 0;
+}
+
+
+/* Tables for Modbus ASCII hex conversion.  ASCII_Value is the value of a hex digit, or ASCII_INVALID
+ * if the character is not a hex digit, so that invalid characters can be detected by OR-ing the values. */
+#define ASCII_INVALID 0x10
+static const char ASCII_Digits[] = "0123456789ABCDEF";
+static unsigned char ASCII_Value[256];
+static epicsThreadOnceId ASCII_OnceId = EPICS_THREAD_ONCE_INIT;
+
+static void initASCII(void *arg)
 {
-    int CRC_Index ;              /* will index into CRC lookup table */
     int i;
 
-    /* This algorithm is taken from the official Modbus over serial line documentation */
-    *CRC_Hi = 0xFF; /* high byte of CRC initialized */
-    *CRC_Lo = 0xFF; /* low byte of CRC initialized */
+    for (i=0; i<256; i++) ASCII_Value[i] = ASCII_INVALID;
+    for (i=0; i<10; i++) ASCII_Value['0' + i] = (unsigned char)i;
+    for (i=0; i<6; i++) {
+        ASCII_Value['A' + i] = (unsigned char)(10 + i);
+        ASCII_Value['a' + i] = (unsigned char)(10 + i);
+    }
+}
+
+/* Converts nchars bytes to 2*nchars hex characters and returns the LRC of the bytes */
+static unsigned char encodeASCII(char *out, const char *in, int nchars)
+{
+    unsigned char LRC = 0;
+    unsigned char value;
+    int i;
+
     for (i=0; i<nchars; i++) {
-        CRC_Index = *CRC_Lo ^ (unsigned char)buffer[i];
-        *CRC_Lo = *CRC_Hi ^ CRC_Lookup_Hi[CRC_Index];
-        *CRC_Hi = CRC_Lookup_Lo[CRC_Index];
+        value = (unsigned char)in[i];
+        LRC += value;
+        out[2*i]   = ASCII_Digits[value >> 4];
+        out[2*i+1] = ASCII_Digits[value & 0x0F];
     }
+    return (unsigned char)-LRC;
 }
 
-static void computeLRC(char *buffer, int nchars, unsigned char *LRC) 
+/* Converts 2*nchars hex characters to nchars bytes, adding the bytes to *sum.
+ * If out is NULL the bytes are only added to the sum.
+ * Returns 0 if all of the characters are valid hex digits. */
+static int decodeASCII(char *out, const char *in, int nchars, unsigned char *sum)
 {
+    const unsigned char *pin = (const unsigned char *)in;
+    unsigned char invalid = 0;
+    unsigned char hi, lo, value;
+    unsigned char total = *sum;
     int i;
 
-    *LRC = 0;
     for (i=0; i<nchars; i++) {
-        *LRC += buffer[i];
+        hi = ASCII_Value[pin[2*i]];
+        lo = ASCII_Value[pin[2*i+1]];
+        invalid |= hi | lo;
+        value = (unsigned char)((hi << 4) | (lo & 0x0F));
+        total += value;
+        if (out) out[i] = (char)value;
     }
-    *LRC = (unsigned char) -((char)*LRC);
+    *sum = total;
+    return (invalid & ASCII_INVALID) != 0;
 }
 
-static void encodeASCII(char *buffer, unsigned char value) 
+
+static double monotonicNow(void)
 {
-    unsigned char temp;
-    
-    temp = value >> 4;
-    if (temp < 10) temp+= '0'; else temp+= 'A'-10;
-    *buffer++ = (char)temp;
-    temp = value & 0x0F;
-    if (temp < 10) temp+= '0'; else temp+= 'A'-10;
-    *buffer = (char)temp;
+    return epicsMonotonicGet() / 1.e9;
 }
 
-static void decodeASCII(char *buffer, char *value) 
+/* Computes the RTU character time and t3.5 from the baud rate and framing of the underlying
+ * serial port.  Above 19200 baud the Modbus serial line specification uses a fixed value of 1.75 ms. */
+static asynStatus computeRTUTiming(modbusPvt *pPvt, asynUser *pasynUser)
 {
-    char temp;
-    unsigned char uvalue;
-    
-    temp = *buffer++;
-    if (temp > '9') uvalue = temp - 'A' + 10; else uvalue = temp - '0';
-    uvalue = uvalue << 4;
-    temp = *buffer;
-    if (temp > '9') uvalue += temp - 'A' + 10; else uvalue += temp - '0';
-    *value = (char)uvalue;
+    char value[40];
+    int baud, dataBits=8, stopBits=1, parityBits=1;
+
+    if (!pPvt->pasynOption ||
+        (pPvt->pasynOption->getOption(pPvt->optionPvt, pasynUser, "baud", value, sizeof(value)) != asynSuccess) ||
+        (sscanf(value, "%d", &baud) != 1) || (baud <= 0)) {
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                      "%s::computeRTUTiming port %s cannot get baud rate of underlying port",
+                      driver, pPvt->portName);
+        return asynError;
+    }
+    if (pPvt->pasynOption->getOption(pPvt->optionPvt, pasynUser, "bits", value, sizeof(value)) == asynSuccess)
+        sscanf(value, "%d", &dataBits);
+    if (pPvt->pasynOption->getOption(pPvt->optionPvt, pasynUser, "stop", value, sizeof(value)) == asynSuccess)
+        sscanf(value, "%d", &stopBits);
+    if ((pPvt->pasynOption->getOption(pPvt->optionPvt, pasynUser, "parity", value, sizeof(value)) == asynSuccess) &&
+        (epicsStrCaseCmp(value, "none") == 0)) parityBits = 0;
+    /* Start bit, data bits, parity bit and stop bits */
+    pPvt->rtuCharTime = (1 + dataBits + parityBits + stopBits) / (double)baud;
+    if (baud > 19200) {
+        pPvt->rtuT35 = 1.75e-3;
+    } else {
+        pPvt->rtuT35 = 3.5 * pPvt->rtuCharTime;
+    }
+    return asynSuccess;
+}
+
+/* Waits until the line has been idle for t3.5 since the last character was sent or received */
+static void waitRTUGap(modbusPvt *pPvt)
+{
+    double wait = pPvt->rtuLastActivity + pPvt->rtuT35 - monotonicNow();
+
+    if (wait <= 0.) return;
+    epicsThreadSleep(wait);
+    pPvt->rtuIdleTime += wait;
+    pPvt->rtuIdleCount++;
+}
+
+
+/* Updates the smoothed round-trip time and the retransmission timeout with a new measurement,
+ * using the algorithm of RFC 6298 */
+static void updateUDPRTO(modbusPvt *pPvt, double rtt)
+{
+    double rto;
+
+    if (pPvt->udpSRTT == 0.) {
+        pPvt->udpSRTT = rtt;
+        pPvt->udpRTTVAR = rtt / 2.;
+    } else {
+        pPvt->udpRTTVAR = 0.75 * pPvt->udpRTTVAR + 0.25 * fabs(pPvt->udpSRTT - rtt);
+        pPvt->udpSRTT = 0.875 * pPvt->udpSRTT + 0.125 * rtt;
+    }
+    rto = pPvt->udpSRTT + ((4. * pPvt->udpRTTVAR > UDP_CLOCK_GRANULARITY) ? 4. * pPvt->udpRTTVAR : UDP_CLOCK_GRANULARITY);
+    if (rto < pPvt->udpMinRTO) rto = pPvt->udpMinRTO;
+    if (rto > pPvt->udpMaxRTO) rto = pPvt->udpMaxRTO;
+    pPvt->udpRTO = rto;
 }
 
-
 /* asynOctet methods */
 static asynStatus writeIt(void *ppvt, asynUser *pasynUser,
                           const char *data, size_t numchars,
@@ -241,34 +449,60 @@ static asynStatus writeIt(void *ppvt, asynUser *pasynUser,
     unsigned char CRC_Lo;
     unsigned char LRC;
     char *pout;
-    int i;
+    char *frame;
 
-    if (pPvt->writeDelay > 0.0) epicsThreadSleep(pPvt->writeDelay);
+    if (pPvt->rtuTiming && (pPvt->linkType == modbusLinkRTU)) {
+        waitRTUGap(pPvt);
+    } else if (pPvt->writeDelay > 0.0) {
+        epicsThreadSleep(pPvt->writeDelay);
+    }
     
     pasynUser->timeout = pPvt->timeout;
 
     switch(pPvt->linkType) {
         case modbusLinkTCP:
         case modbusLinkUDP:
+            if ((pPvt->pipelineDepth > 1) &&
+                (pPvt->nOutstanding >= pPvt->pipelineDepth)) {
+                epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                              "%s::writeIt port %s too many outstanding transactions",
+                              driver, pPvt->portName);
+                return asynError;
+            }
             /* Build the MBAP header */
             pPvt->transactionId = (pPvt->transactionId + 1) & 0xFFFF;
             mbapHeader.transactId    = htons(pPvt->transactionId);
             mbapHeader.protocolType  = htons(modbusEncoding);
             mbapHeader.cmdLength     = htons(cmdLength);
  
-            /* Copy the MBAP header to the local buffer */
-            memcpy(pPvt->buffer, &mbapHeader, mbapSize);
-
-            /* Copy the Modbus data to the local buffer */
-            memcpy(pPvt->buffer + mbapSize, data, numchars);
+            frame = findRequestFrame(pPvt, pasynUser, data);
+            if (frame) {
+                /* The caller has left space for the header in front of the data, 
+                 * so the frame is built in place */
+                frame += MODBUS_FRAME_HEADROOM - mbapSize;
+            } else {
+                /* Copy the Modbus data to the local buffer */
+                frame = pPvt->buffer;
+                memcpy(frame + mbapSize, data, numchars);
+            }
+            memcpy(frame, &mbapHeader, mbapSize);
 
             /* Send the frame with the underlying driver */
             nWrite = numchars + mbapSize;
             status = pPvt->pasynOctet->write(pPvt->octetPvt, pasynUser,
-                                             pPvt->buffer, nWrite, 
+                                             frame, nWrite, 
                                              &nbytesActual);
+            pPvt->lastFrame = frame;
             pPvt->nWritten = nWrite;
+            pPvt->udpSendTime = monotonicNow();
             *nbytesTransfered = (nbytesActual > numchars) ? numchars : nbytesActual;
+            if ((status == asynSuccess) && (pPvt->pipelineDepth > 1)) {
+                modbusPipelineEntry *pEntry = &pPvt->pipeline[(pPvt->pipelineHead + pPvt->nOutstanding) %
+                                                              MODBUS_MAX_PIPELINE_DEPTH];
+                pEntry->transactionId = pPvt->transactionId;
+                pEntry->received = 0;
+                pPvt->nOutstanding++;
+            }
             break;
 
         case modbusLinkRTU:
@@ -276,7 +510,7 @@ static asynStatus writeIt(void *ppvt, asynUser *pasynUser,
             /* Next is the Modbus data */
             memcpy(pPvt->buffer, data, numchars);
             /* Compute the CRC */
-            computeCRC(pPvt->buffer, (int)numchars, &CRC_Lo, &CRC_Hi);
+            modbusComputeCRC(pPvt->buffer, (int)numchars, &CRC_Lo, &CRC_Hi);
             pPvt->buffer[numchars] = CRC_Lo;
             pPvt->buffer[numchars+1] = CRC_Hi;
             /* Send the frame with the underlying driver */
@@ -284,25 +518,28 @@ static asynStatus writeIt(void *ppvt, asynUser *pasynUser,
             status = pPvt->pasynOctet->write(pPvt->octetPvt, pasynUser,
                                              pPvt->buffer, nWrite, 
                                              &nbytesActual);
+            /* The write returns when the frame has been queued, it is on the line until it has been sent */
+            pPvt->rtuLastActivity = monotonicNow() + nbytesActual * pPvt->rtuCharTime;
             *nbytesTransfered = (nbytesActual > numchars) ? numchars : nbytesActual;
             break;
 
         case modbusLinkASCII:
-            /* Put slave address and data in buffer to compute LRC */
-            memcpy(pPvt->buffer, data, numchars);
-            computeLRC(pPvt->buffer, (int)numchars, &LRC);
-            /* Now convert to ASCII */
-            /* First byte in the output is : */
+            /* The frame is : followed by the slave address, data and LRC in hex */
+            if (2*numchars + 3 > sizeof(pPvt->buffer)) {
+                asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                          "%s::writeIt, frame too long for ASCII, numchars=%d\n",
+                          driver, (int)numchars);
+                return asynError;
+            }
+            epicsThreadOnce(&ASCII_OnceId, initASCII, NULL);
             pout = pPvt->buffer;
             *pout = ':';
             pout++;
-            /* Next is the slave address */
-            for (i=0; i<numchars; i++) {
-                encodeASCII(pout, data[i]);
-                pout+=2;
-            }
+            /* Convert the slave address and data to ASCII and compute the LRC in the same pass */
+            LRC = encodeASCII(pout, data, (int)numchars);
+            pout += 2*numchars;
             /* Next is the LRC */
-            encodeASCII(pout, LRC);
+            encodeASCII(pout, (char *)&LRC, 1);
             pout+=2;
             /* The driver will add the CR/LF */
             /* Send the frame with the underlying driver */
@@ -318,6 +555,311 @@ static asynStatus writeIt(void *ppvt, asynUser *pasynUser,
 }
 
 
+/* Reads exactly nchars bytes from the underlying driver */
+static asynStatus readExactly(modbusPvt *pPvt, asynUser *pasynUser,
+                              char *buffer, size_t nchars, int *eomReason)
+{
+    size_t nRead = 0;
+    size_t nbytesActual;
+    asynStatus status = asynSuccess;
+
+    while (nRead < nchars) {
+        nbytesActual = 0;
+        status = pPvt->pasynOctet->read(pPvt->octetPvt, pasynUser,
+                                        buffer + nRead, nchars - nRead,
+                                        &nbytesActual, eomReason);
+        nRead += nbytesActual;
+        if (status != asynSuccess) break;
+        if (nbytesActual == 0) {
+            status = asynTimeout;
+            break;
+        }
+    }
+    return status;
+}
+
+/* Reads one Modbus RTU frame into pPvt->buffer.  The slave address and function code are read first,
+ * and the number of bytes that follow is computed from the function code, and for reads from the byte count,
+ * so that the read finishes as soon as the last byte of the frame arrives, including for exceptions.
+ * Replies to other function codes are read as before, up to maxchars + 3 bytes. */
+static asynStatus readRTUFrame(modbusPvt *pPvt, asynUser *pasynUser, size_t maxchars,
+                               size_t *frameLen, int *eomReason)
+{
+    unsigned char *frame = (unsigned char *)pPvt->buffer;
+    size_t nRead = 0;
+    size_t nbytesActual = 0;
+    size_t remaining;
+    asynStatus status;
+
+    *frameLen = 0;
+    /* Slave address and function code */
+    status = readExactly(pPvt, pasynUser, pPvt->buffer, 2, eomReason);
+    if (status != asynSuccess) return status;
+    nRead = 2;
+    if (frame[1] & MODBUS_EXCEPTION_FCN) {
+        /* Exception code and CRC */
+        remaining = 3;
+    } else {
+        switch (frame[1]) {
+            case MODBUS_READ_COILS:
+            case MODBUS_READ_DISCRETE_INPUTS:
+            case MODBUS_READ_HOLDING_REGISTERS:
+            case MODBUS_READ_INPUT_REGISTERS:
+            case MODBUS_REPORT_SLAVE_ID:
+            case MODBUS_READ_WRITE_MULTIPLE_REGISTERS:
+                /* Byte count, data and CRC */
+                status = readExactly(pPvt, pasynUser, pPvt->buffer + nRead, 1, eomReason);
+                if (status != asynSuccess) return status;
+                remaining = frame[nRead] + 2;
+                nRead++;
+                break;
+            case MODBUS_WRITE_SINGLE_COIL:
+            case MODBUS_WRITE_SINGLE_REGISTER:
+            case MODBUS_WRITE_MULTIPLE_COILS:
+            case MODBUS_WRITE_MULTIPLE_REGISTERS:
+                /* Address, value or quantity, and CRC */
+                remaining = 6;
+                break;
+            case MODBUS_MASK_WRITE_REGISTER:
+                /* Address, AND mask, OR mask and CRC */
+                remaining = 8;
+                break;
+            default:
+                status = pPvt->pasynOctet->read(pPvt->octetPvt, pasynUser,
+                                                pPvt->buffer + nRead, maxchars + 1,
+                                                &nbytesActual, eomReason);
+                *frameLen = nRead + nbytesActual;
+                return status;
+        }
+    }
+    status = readExactly(pPvt, pasynUser, pPvt->buffer + nRead, remaining, eomReason);
+    if (status != asynSuccess) return status;
+    *frameLen = nRead + remaining;
+    return asynSuccess;
+}
+
+/* Returns the number of bytes that follow the MBAP header, or 0 if the header is not valid */
+static size_t getMBAPLength(modbusPvt *pPvt, asynUser *pasynUser, const char *frame)
+{
+    int mbapSize = sizeof(modbusMBAPHeader);
+    size_t length = ((frame[4] & 0xFF)<<8) | (frame[5] & 0xFF);
+
+    if ((frame[2] != 0) || (frame[3] != 0) ||
+        (length < 2) || (length > (size_t)(MAX_MODBUS_FRAME_SIZE - mbapSize))) {
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                  "%s::getMBAPLength port %s invalid MBAP header, protocol=%d, length=%d\n",
+                  driver, pPvt->portName, ((frame[2] & 0xFF)<<8) | (frame[3] & 0xFF), (int)length);
+        return 0;
+    }
+    return length;
+}
+
+/* Reads one complete Modbus/TCP frame, using the length field in the MBAP header
+ * so that back-to-back replies are never merged or split.
+ * The frame is read into frame if it fits in frameSize bytes, otherwise into rxBuffer.
+ * *pFrame is set to the buffer that was used. */
+static asynStatus readTCPFrame(modbusPvt *pPvt, asynUser *pasynUser,
+                               char *frame, size_t frameSize, char **pFrame,
+                               size_t *frameLen, int *eomReason)
+{
+    int mbapSize = sizeof(modbusMBAPHeader);
+    size_t length;
+    asynStatus status;
+
+    *frameLen = 0;
+    *pFrame = frame;
+    status = readExactly(pPvt, pasynUser, frame, mbapSize, eomReason);
+    if (status != asynSuccess) return status;
+    length = getMBAPLength(pPvt, pasynUser, frame);
+    if (length == 0) return asynError;
+    if (mbapSize + length > frameSize) {
+        memcpy(pPvt->rxBuffer, frame, mbapSize);
+        frame = pPvt->rxBuffer;
+        *pFrame = frame;
+    }
+    status = readExactly(pPvt, pasynUser, frame + mbapSize, length, eomReason);
+    if (status != asynSuccess) return status;
+    *frameLen = mbapSize + length;
+    return asynSuccess;
+}
+
+static void copyTCPReply(const char *frame, size_t frameLen,
+                         char *data, size_t maxchars, size_t *nbytesTransfered)
+{
+    int mbapSize = sizeof(modbusMBAPHeader);
+    size_t nRead;
+
+    /* Copy bytes beyond mbapHeader and unit identifier to output buffer.
+     * Nothing is copied if the frame was read in place in front of the output buffer. */
+    nRead = frameLen - mbapSize - 1;
+    if (nRead > maxchars) nRead = maxchars;
+    if ((nRead > 0) && (frame + mbapSize + 1 != data)) memcpy(data, frame + mbapSize + 1, nRead);
+    if (nRead<maxchars) data[nRead] = 0; /*null terminate string if room*/
+    *nbytesTransfered = nRead;
+}
+
+/* Reads and discards the replies that are waiting in the socket, e.g. late replies to requests that
+ * timed out, without blocking.  If more than resyncBudget bytes are waiting, or the data are not valid
+ * Modbus/TCP frames, the rest is discarded with the flush of the underlying driver. */
+static asynStatus drainTCP(modbusPvt *pPvt, asynUser *pasynUser)
+{
+    int mbapSize = sizeof(modbusMBAPHeader);
+    double timeout = pasynUser->timeout;
+    size_t nbytesActual;
+    size_t length;
+    int nDrained = 0;
+    int eomReason;
+    asynStatus status = asynSuccess;
+
+    while (nDrained < pPvt->resyncBudget) {
+        /* A timeout of 0 only returns data that have already arrived */
+        pasynUser->timeout = 0.;
+        nbytesActual = 0;
+        pPvt->pasynOctet->read(pPvt->octetPvt, pasynUser, pPvt->rxBuffer, 1,
+                               &nbytesActual, &eomReason);
+        if (nbytesActual == 0) break;
+        /* The rest of a frame whose first byte has arrived should follow at once */
+        pasynUser->timeout = pPvt->timeout;
+        status = readExactly(pPvt, pasynUser, pPvt->rxBuffer + 1, mbapSize - 1, &eomReason);
+        if (status == asynSuccess) {
+            length = getMBAPLength(pPvt, pasynUser, pPvt->rxBuffer);
+            if (length == 0) status = asynError;
+        }
+        if (status == asynSuccess) {
+            status = readExactly(pPvt, pasynUser, pPvt->rxBuffer + mbapSize, length, &eomReason);
+        }
+        if (status != asynSuccess) {
+            pPvt->tcpFramingErrors++;
+            break;
+        }
+        pPvt->tcpStaleReplies++;
+        pPvt->tcpStaleBytes += (int)(mbapSize + length);
+        nDrained += (int)(mbapSize + length);
+    }
+    pasynUser->timeout = timeout;
+    if ((status != asynSuccess) || (nDrained >= pPvt->resyncBudget)) {
+        return pPvt->pasynOctet->flush(pPvt->octetPvt, pasynUser);
+    }
+    return asynSuccess;
+}
+
+/* Reads complete Modbus/TCP frames until the reply to the last request is found.
+ * Stale replies are discarded and counted.  If the frames are not valid the rest of the input is
+ * flushed and an error is returned at once, rather than waiting for the timeout. */
+static asynStatus readResync(modbusPvt *pPvt, asynUser *pasynUser,
+                             char *data, size_t maxchars, size_t *nbytesTransfered,
+                             int *eomReason)
+{
+    int mbapSize = sizeof(modbusMBAPHeader);
+    char *frame;
+    size_t frameSize;
+    size_t frameLen;
+    asynStatus status;
+    int id;
+
+    frame = findReplyFrame(pPvt, pasynUser, data);
+    if (frame) {
+        frame += MODBUS_FRAME_HEADROOM - mbapSize - 1;
+        frameSize = maxchars + mbapSize + 1;
+    } else {
+        frame = pPvt->rxBuffer;
+        frameSize = sizeof(pPvt->rxBuffer);
+    }
+    for (;;) {
+        status = readTCPFrame(pPvt, pasynUser, frame, frameSize, &frame, &frameLen, eomReason);
+        if (status == asynError) {
+            pPvt->tcpFramingErrors++;
+            pPvt->pasynOctet->flush(pPvt->octetPvt, pasynUser);
+        }
+        if (status != asynSuccess) return status;
+        id = ((frame[0] & 0xFF)<<8) | (frame[1] & 0xFF);
+        if (id == pPvt->transactionId) break;
+        pPvt->tcpStaleReplies++;
+        pPvt->tcpStaleBytes += (int)frameLen;
+    }
+    copyTCPReply(frame, frameLen, data, maxchars, nbytesTransfered);
+    return asynSuccess;
+}
+
+/* Returns the reply to the oldest outstanding transaction.
+ * Replies to other outstanding transactions that arrive first are saved until they are requested.
+ * Replies whose transaction ID is not outstanding (e.g. late replies to requests that timed out)
+ * are discarded. */
+static asynStatus readPipelined(modbusPvt *pPvt, asynUser *pasynUser,
+                                char *data, size_t maxchars, size_t *nbytesTransfered,
+                                int *eomReason)
+{
+    modbusPipelineEntry *pHead;
+    modbusPipelineEntry *pEntry;
+    int mbapSize = sizeof(modbusMBAPHeader);
+    char *frame;
+    size_t frameSize;
+    size_t frameLen;
+    asynStatus status;
+    int id;
+    int i;
+
+    if (pPvt->nOutstanding == 0) {
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                      "%s::readPipelined port %s no transaction outstanding",
+                      driver, pPvt->portName);
+        return asynError;
+    }
+    pHead = &pPvt->pipeline[pPvt->pipelineHead];
+    if (pHead->received) {
+        copyTCPReply(pHead->reply, pHead->replyLen, data, maxchars, nbytesTransfered);
+        goto done;
+    }
+    frame = findReplyFrame(pPvt, pasynUser, data);
+    if (frame) {
+        /* Read the reply in place, in the header space in front of the output buffer */
+        frame += MODBUS_FRAME_HEADROOM - mbapSize - 1;
+        frameSize = maxchars + mbapSize + 1;
+    } else {
+        frame = pPvt->rxBuffer;
+        frameSize = sizeof(pPvt->rxBuffer);
+    }
+    for (;;) {
+        status = readTCPFrame(pPvt, pasynUser, frame, frameSize, &frame, &frameLen, eomReason);
+        if (status != asynSuccess) {
+            if (status == asynTimeout) {
+                /* Give up on this transaction, a late reply to it will be discarded */
+                pPvt->pipelineHead = (pPvt->pipelineHead + 1) % MODBUS_MAX_PIPELINE_DEPTH;
+                pPvt->nOutstanding--;
+            } else {
+                /* The connection was lost or the stream is no longer framed correctly */
+                pPvt->nOutstanding = 0;
+                pPvt->pasynOctet->flush(pPvt->octetPvt, pasynUser);
+            }
+            return status;
+        }
+        id = ((frame[0] & 0xFF)<<8) | (frame[1] & 0xFF);
+        if (id == pHead->transactionId) {
+            copyTCPReply(frame, frameLen, data, maxchars, nbytesTransfered);
+            goto done;
+        }
+        for (i=1; i<pPvt->nOutstanding; i++) {
+            pEntry = &pPvt->pipeline[(pPvt->pipelineHead + i) % MODBUS_MAX_PIPELINE_DEPTH];
+            if ((pEntry->transactionId == id) && !pEntry->received) {
+                memcpy(pEntry->reply, frame, frameLen);
+                pEntry->replyLen = frameLen;
+                pEntry->received = 1;
+                break;
+            }
+        }
+        if (i == pPvt->nOutstanding) {
+            asynPrint(pasynUser, ASYN_TRACE_WARNING,
+                      "%s::readPipelined port %s discarding reply with unexpected transaction ID %d\n",
+                      driver, pPvt->portName, id);
+        }
+    }
+
+    done:
+    pPvt->pipelineHead = (pPvt->pipelineHead + 1) % MODBUS_MAX_PIPELINE_DEPTH;
+    pPvt->nOutstanding--;
+    return asynSuccess;
+}
+
 static asynStatus readIt(void *ppvt, asynUser *pasynUser,
                          char *data, size_t maxchars, size_t *nbytesTransfered,
                          int *eomReason)
@@ -330,9 +872,13 @@ static asynStatus readIt(void *ppvt, asynUser *pasynUser,
     unsigned char CRC_Hi;
     unsigned char CRC_Lo;
     unsigned char LRC;
-    int i;
     char *pin;
+    int nFrame, nData;
+    int invalid;
+    char receivedLRC;
+    unsigned char sumNoLRC;
     int retries = 0;
+    char *frame;
 
     pasynUser->timeout = pPvt->timeout;
 
@@ -342,21 +888,40 @@ static asynStatus readIt(void *ppvt, asynUser *pasynUser,
     switch(pPvt->linkType) {
         case modbusLinkTCP:
         case modbusLinkUDP:
+            if ((pPvt->pipelineDepth > 1) || (pPvt->nOutstanding > 0)) {
+                return readPipelined(pPvt, pasynUser, data, maxchars, nbytesTransfered, eomReason);
+            }
+            if ((pPvt->linkType == modbusLinkTCP) && pPvt->tcpResync) {
+                return readResync(pPvt, pasynUser, data, maxchars, nbytesTransfered, eomReason);
+            }
             nRead = maxchars + mbapSize + 1;
+            frame = findReplyFrame(pPvt, pasynUser, data);
+            if (frame) {
+                /* Read the reply in place, in the header space in front of the output buffer */
+                frame += MODBUS_FRAME_HEADROOM - mbapSize - 1;
+            } else {
+                frame = pPvt->rxBuffer;
+            }
+            if (pPvt->linkType == modbusLinkUDP) pasynUser->timeout = pPvt->udpRTO;
             for (;;) {
                 status = pPvt->pasynOctet->read(pPvt->octetPvt, pasynUser,
-                                                pPvt->rxBuffer, nRead, 
+                                                frame, nRead, 
                                                 &nbytesActual, eomReason);
                 /* If the returned status is asynTimeout this can be because the interposeEOS
                  * interface is being used and we received fewer bytes than expected due to a Modbus exception. 
-                 * In this case nbytesActual will be 9 and rxBuffer[7] will have the MODBUS_EXCEPTION_FCN bit set 
+                 * In this case nbytesActual will be 9 and frame[7] will have the MODBUS_EXCEPTION_FCN bit set 
                  * We want to return the data read in this case so the exception can be reported. */
-                if ((nbytesActual == 9) && (pPvt->rxBuffer[7] & MODBUS_EXCEPTION_FCN)) status = asynSuccess;
+                if ((nbytesActual == 9) && (frame[7] & MODBUS_EXCEPTION_FCN)) status = asynSuccess;
                 if (status != asynSuccess) {
-                    if ((pPvt->linkType == modbusLinkUDP) && (++retries < 5)) {
+                    if ((pPvt->linkType == modbusLinkUDP) && (retries++ < pPvt->udpMaxRetries)) {
                         size_t nResent;
+                        /* Back off the retransmission timeout and resend the request */
+                        pPvt->udpRTO *= 2.;
+                        if (pPvt->udpRTO > pPvt->udpMaxRTO) pPvt->udpRTO = pPvt->udpMaxRTO;
+                        pasynUser->timeout = pPvt->udpRTO;
+                        pPvt->udpRetransmits++;
                         pPvt->pasynOctet->write(pPvt->octetPvt, pasynUser,
-                                                pPvt->buffer, pPvt->nWritten, 
+                                                pPvt->lastFrame, pPvt->nWritten, 
                                                 &nResent);
                         continue;
                     }
@@ -364,32 +929,37 @@ static asynStatus readIt(void *ppvt, asynUser *pasynUser,
                     return status;
                 }
                 if (nbytesActual >= 2) {
-                    int id = ((pPvt->rxBuffer[0] & 0xFF)<<8)|(pPvt->rxBuffer[1]&0xFF);
-                    if (id == pPvt->transactionId) break;
+                    int id = ((frame[0] & 0xFF)<<8)|(frame[1]&0xFF);
+                    if (id == pPvt->transactionId) {
+                        /* The round-trip time is ambiguous if the request was resent */
+                        if ((pPvt->linkType == modbusLinkUDP) && (retries == 0)) {
+                            updateUDPRTO(pPvt, monotonicNow() - pPvt->udpSendTime);
+                        }
+                        break;
+                    }
                 }
             }
-            /* Copy bytes beyond mbapHeader to output buffer */
+            /* Copy bytes beyond mbapHeader to output buffer, unless they were read in place */
             nRead = nbytesActual;
             nRead = nRead - mbapSize - 1;
             if ((int)nRead < 0) nRead = 0;
             if (nRead > maxchars) nRead = maxchars;
-            if (nRead > 0) memcpy(data, pPvt->rxBuffer + mbapSize + 1, nRead);
+            if ((nRead > 0) && (frame == pPvt->rxBuffer)) memcpy(data, frame + mbapSize + 1, nRead);
             if(nRead<maxchars) data[nRead] = 0; /*null terminate string if room*/
             *nbytesTransfered = nRead;
             break;
 
         case modbusLinkRTU:
-            nRead = maxchars + 3;
-            status = pPvt->pasynOctet->read(pPvt->octetPvt, pasynUser,
-                                            pPvt->buffer, nRead,
-                                            &nbytesActual, eomReason);
+            status = readRTUFrame(pPvt, pasynUser, maxchars, &nbytesActual, eomReason);
+            /* Also after a timeout, since a late reply may still be arriving */
+            pPvt->rtuLastActivity = monotonicNow();
             if (status != asynSuccess) {
                 *nbytesTransfered = nbytesActual;
                 return status;
             }
             /* Compute and check the CRC including the CRC bytes themselves, 
              * should be 0 */
-            computeCRC(pPvt->buffer, (int)nbytesActual, &CRC_Lo, &CRC_Hi);
+            modbusComputeCRC(pPvt->buffer, (int)nbytesActual, &CRC_Lo, &CRC_Hi);
             if ((CRC_Lo != 0) || (CRC_Hi != 0)) {
                 asynPrint(pasynUser, ASYN_TRACE_ERROR,
                           "%s::readIt, CRC error\n",
@@ -410,6 +980,7 @@ static asynStatus readIt(void *ppvt, asynUser *pasynUser,
             /* The maximum number of characters is 2*maxchars + 7 
              * (7= :(1), address(2), LRC(2), CR/LF(2) */
             nRead = maxchars*2 + 7;
+            if (nRead > sizeof(pPvt->buffer)) nRead = sizeof(pPvt->buffer);
             status = pPvt->pasynOctet->read(pPvt->octetPvt, pasynUser,
                                             pPvt->buffer, nRead,
                                             &nbytesActual, eomReason);
@@ -418,27 +989,34 @@ static asynStatus readIt(void *ppvt, asynUser *pasynUser,
                 return status;
             }
             pin = pPvt->buffer;
-            if (*pin != ':') return asynError;
+            /* There must be at least the :, the address and the LRC */
+            if ((nbytesActual < 5) || (*pin != ':')) return asynError;
             pin += 1;
-            for (i=0; i<(nbytesActual-1)/2; i++) {
-                decodeASCII(pin, &data[i]);
-                pin+=2;
+            epicsThreadOnce(&ASCII_OnceId, initASCII, NULL);
+            /* The frame is the address, the data and the LRC.  The data are decoded directly into the
+             * output buffer, and the LRC is checked by summing all of the bytes including the LRC,
+             * which must give 0.  Data that do not fit in the output buffer are only summed. */
+            nFrame = (int)(nbytesActual-1)/2;
+            nData = nFrame - 2;
+            nRead = (nData > (int)maxchars) ? maxchars : (size_t)nData;
+            LRC = 0;
+            invalid = decodeASCII(NULL, pin, 1, &LRC);
+            invalid |= decodeASCII(data, pin + 2, (int)nRead, &LRC);
+            invalid |= decodeASCII(NULL, pin + 2 + 2*nRead, nData - (int)nRead, &LRC);
+            sumNoLRC = LRC;
+            invalid |= decodeASCII(&receivedLRC, pin + 2 + 2*nData, 1, &LRC);
+            if (invalid) {
+                asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                          "%s::readIt, invalid character in ASCII frame\n",
+                          driver);
+                return asynError;
             }
-            /* Number of bytes in buffer for computing LRC is i */
-            nRead = i;
-            computeLRC(data, (int)nRead, &LRC);
-            if (LRC != data[i]) {
+            if (LRC != 0) {
                 asynPrint(pasynUser, ASYN_TRACE_ERROR,
                           "%s::readIt, LRC error, nRead=%d, received LRC=0x%x, computed LRC=0x%x\n",
-                          driver, (int)nRead, data[i], LRC);
+                          driver, nFrame, (unsigned char)receivedLRC, (unsigned char)-sumNoLRC);
                 return asynError;
             }
-            /* The buffer now contains binary data, but the first byte is address.  
-             * and last byte is LRC; Copy over buffer so first byte is function code */
-            nRead = nRead - 2;
-            if ((int)nRead < 0) nRead = 0;
-            if (nRead > maxchars) nRead = maxchars;
-            if (nRead > 0) memmove(data, data + 1, nRead);
             if (nRead<maxchars) data[nRead] = 0; /*null terminate string if room*/
             *nbytesTransfered = nRead;
             break;
@@ -451,6 +1029,9 @@ static asynStatus readIt(void *ppvt, asynUser *pasynUser,
 static asynStatus flushIt(void *ppvt, asynUser *pasynUser)
 {
     modbusPvt *pPvt = (modbusPvt *)ppvt;
+    /* Replies to any outstanding transactions are discarded by the flush */
+    pPvt->nOutstanding = 0;
+    if ((pPvt->linkType == modbusLinkTCP) && pPvt->tcpResync) return drainTCP(pPvt, pasynUser);
     return pPvt->pasynOctet->flush(pPvt->octetPvt, pasynUser);
 }
 
@@ -502,6 +1083,183 @@ static asynStatus getOutputEos(void *ppvt, asynUser *pasynUser,
                                      eos, eossize, eoslen);
 }
 
+
+/* asynOption methods */
+static asynStatus setOption(void *ppvt, asynUser *pasynUser,
+    const char *key, const char *val)
+{
+    modbusPvt *pPvt = (modbusPvt *)ppvt;
+    int ival;
+
+    if (epicsStrCaseCmp(key, "pipelineDepth") == 0) {
+        if (sscanf(val, "%d", &ival) != 1) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "Bad number");
+            return asynError;
+        }
+        if (ival < 1) ival = 1;
+        if (ival > MODBUS_MAX_PIPELINE_DEPTH) ival = MODBUS_MAX_PIPELINE_DEPTH;
+        if ((ival > 1) && (pPvt->linkType != modbusLinkTCP)) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "pipelineDepth > 1 is only supported for TCP");
+            return asynError;
+        }
+        pPvt->pipelineDepth = ival;
+        pPvt->nOutstanding = 0;
+        return asynSuccess;
+    }
+    if ((epicsStrCaseCmp(key, "udpMinRTO") == 0) || (epicsStrCaseCmp(key, "udpMaxRTO") == 0) ||
+        (epicsStrCaseCmp(key, "udpRetries") == 0)) {
+        if (pPvt->linkType != modbusLinkUDP) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "%s is only supported for UDP", key);
+            return asynError;
+        }
+        if ((sscanf(val, "%d", &ival) != 1) || (ival < 0)) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "Bad number");
+            return asynError;
+        }
+        if (epicsStrCaseCmp(key, "udpMinRTO") == 0) pPvt->udpMinRTO = ival/1000.;
+        else if (epicsStrCaseCmp(key, "udpMaxRTO") == 0) pPvt->udpMaxRTO = ival/1000.;
+        else pPvt->udpMaxRetries = ival;
+        if (pPvt->udpMaxRTO < pPvt->udpMinRTO) pPvt->udpMaxRTO = pPvt->udpMinRTO;
+        if (pPvt->udpRTO < pPvt->udpMinRTO) pPvt->udpRTO = pPvt->udpMinRTO;
+        if (pPvt->udpRTO > pPvt->udpMaxRTO) pPvt->udpRTO = pPvt->udpMaxRTO;
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "tcpResync") == 0) {
+        if (pPvt->linkType != modbusLinkTCP) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "tcpResync is only supported for TCP");
+            return asynError;
+        }
+        if (epicsStrCaseCmp(val, "Y") == 0) {
+            pPvt->tcpResync = 1;
+        } else if (epicsStrCaseCmp(val, "N") == 0) {
+            pPvt->tcpResync = 0;
+        } else {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "Invalid tcpResync value, must be Y or N");
+            return asynError;
+        }
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "resyncBudget") == 0) {
+        if ((sscanf(val, "%d", &ival) != 1) || (ival < 0)) {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "Bad number");
+            return asynError;
+        }
+        pPvt->resyncBudget = ival;
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "rtuTiming") == 0) {
+        if (epicsStrCaseCmp(val, "Y") == 0) {
+            if (pPvt->linkType != modbusLinkRTU) {
+                epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                              "rtuTiming is only supported for RTU");
+                return asynError;
+            }
+            if (computeRTUTiming(pPvt, pasynUser) != asynSuccess) return asynError;
+            pPvt->rtuTiming = 1;
+        } else if (epicsStrCaseCmp(val, "N") == 0) {
+            pPvt->rtuTiming = 0;
+        } else {
+            epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                          "Invalid rtuTiming value, must be Y or N");
+            return asynError;
+        }
+        return asynSuccess;
+    }
+    if (pPvt->pasynOption) {
+        asynStatus status = pPvt->pasynOption->setOption(pPvt->optionPvt, pasynUser, key, val);
+        /* The serial port settings determine the RTU timing */
+        if ((status == asynSuccess) && pPvt->rtuTiming &&
+            ((epicsStrCaseCmp(key, "baud") == 0) || (epicsStrCaseCmp(key, "bits") == 0) ||
+             (epicsStrCaseCmp(key, "parity") == 0) || (epicsStrCaseCmp(key, "stop") == 0))) {
+            status = computeRTUTiming(pPvt, pasynUser);
+        }
+        return status;
+    }
+    epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                  "Unsupported key \"%s\"", key);
+    return asynError;
+}
+
+static asynStatus getOption(void *ppvt, asynUser *pasynUser,
+    const char *key, char *val, int sizeval)
+{
+    modbusPvt *pPvt = (modbusPvt *)ppvt;
+
+    if (epicsStrCaseCmp(key, "pipelineDepth") == 0) {
+        epicsSnprintf(val, sizeval, "%d", pPvt->pipelineDepth);
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "tcpResync") == 0) {
+        epicsSnprintf(val, sizeval, "%c", pPvt->tcpResync ? 'Y' : 'N');
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "resyncBudget") == 0) {
+        epicsSnprintf(val, sizeval, "%d", pPvt->resyncBudget);
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "tcpStaleReplies") == 0) {
+        epicsSnprintf(val, sizeval, "%d", pPvt->tcpStaleReplies);
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "tcpStaleBytes") == 0) {
+        epicsSnprintf(val, sizeval, "%d", pPvt->tcpStaleBytes);
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "tcpFramingErrors") == 0) {
+        epicsSnprintf(val, sizeval, "%d", pPvt->tcpFramingErrors);
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "rtuTiming") == 0) {
+        epicsSnprintf(val, sizeval, "%c", pPvt->rtuTiming ? 'Y' : 'N');
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "rtuT35") == 0) {
+        epicsSnprintf(val, sizeval, "%.3f", pPvt->rtuT35 * 1000.);
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "rtuIdleTime") == 0) {
+        epicsSnprintf(val, sizeval, "%.3f %d", pPvt->rtuIdleTime * 1000., pPvt->rtuIdleCount);
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "udpMinRTO") == 0) {
+        epicsSnprintf(val, sizeval, "%d", (int)(pPvt->udpMinRTO * 1000. + 0.5));
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "udpMaxRTO") == 0) {
+        epicsSnprintf(val, sizeval, "%d", (int)(pPvt->udpMaxRTO * 1000. + 0.5));
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "udpRetries") == 0) {
+        epicsSnprintf(val, sizeval, "%d", pPvt->udpMaxRetries);
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "udpRTO") == 0) {
+        epicsSnprintf(val, sizeval, "%.3f", pPvt->udpRTO * 1000.);
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "udpSRTT") == 0) {
+        epicsSnprintf(val, sizeval, "%.3f", pPvt->udpSRTT * 1000.);
+        return asynSuccess;
+    }
+    if (epicsStrCaseCmp(key, "udpRetransmits") == 0) {
+        epicsSnprintf(val, sizeval, "%d", pPvt->udpRetransmits);
+        return asynSuccess;
+    }
+    if (pPvt->pasynOption) {
+        return pPvt->pasynOption->getOption(pPvt->optionPvt, pasynUser, key, val, sizeval);
+    }
+    epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                  "Unsupported key \"%s\"", key);
+    return asynError;
+}
+
 
 /* register modbusInterposeConfig*/
 static const iocshArg modbusInterposeConfigArg0 = { "portName", iocshArgString };
@@ -9,6 +9,7 @@
 #define modbusInterpose_H
 
 #include <shareLib.h>
+#include <asynDriver.h>
 
 typedef enum {
     modbusLinkTCP,
@@ -17,6 +18,9 @@ typedef enum {
     modbusLinkUDP
 } modbusLinkType;
 
+/* Maximum number of Modbus/TCP transactions that can be outstanding at once */
+#define MODBUS_MAX_PIPELINE_DEPTH 16
+
 #ifdef __cplusplus
 extern "C" {
 #endif  /* __cplusplus */
@@ -24,6 +28,10 @@ extern "C" {
 epicsShareFunc int modbusInterposeConfig(const char *portName, 
                                          modbusLinkType linkType, 
                                          int timeoutMsec, int writeDelayMsec);
+epicsShareFunc int modbusInterposeGetPipelineDepth(const char *portName);
+epicsShareFunc int modbusInterposeSetFrameBuffers(asynUser *pasynUser, char *requestFrame, char *replyFrame);
+epicsShareFunc int modbusInterposeGetTCPStatistics(const char *portName, int *staleReplies, int *framingErrors);
+epicsShareFunc int modbusInterposeGetUDPStatistics(const char *portName, int *retransmits, double *rto);
 #ifdef __cplusplus
 }
 #endif  /* __cplusplus */
@@ -0,0 +1,300 @@
+/* modbusPollEngine.cpp
+ *
+ *   Shared pool of poller threads for drvModbusAsyn.
+ *   See modbusPollEngine.h for a description.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <epicsThread.h>
+#include <epicsStdio.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <epicsExit.h>
+#include <errlog.h>
+#include <cantProceed.h>
+#include <iocsh.h>
+
+#include "drvModbusAsyn.h"
+#include "modbusPollEngine.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "modbusPollEngine";
+
+static modbusPollEngine *pPollEngine = NULL;
+
+static void pollWorkerC(void *drvPvt)
+{
+    modbusPollEngine *pEngine = (modbusPollEngine *)drvPvt;
+
+    pEngine->worker();
+}
+
+static void pollEngineExitCallback(void *drvPvt)
+{
+    modbusPollEngine *pEngine = (modbusPollEngine *)drvPvt;
+
+    pEngine->shutdown();
+}
+
+modbusPollEngine::modbusPollEngine(int numThreads)
+  : numThreads_(numThreads),
+    numFailingBusy_(0),
+    starvationWarned_(false),
+    exiting_(false)
+{
+    char threadName[100];
+    int i;
+
+    mutex_ = epicsMutexMustCreate();
+    wakeEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    for (i=0; i<numThreads_; i++) {
+        epicsSnprintf(threadName, sizeof(threadName), "modbusPoll%d", i);
+        epicsThreadCreate(threadName,
+                          epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          (EPICSTHREADFUNC)pollWorkerC,
+                          this);
+    }
+    epicsAtExit(pollEngineExitCallback, this);
+}
+
+/** Returns the poll engine, or NULL if modbusPollEngineConfigure has not been called */
+modbusPollEngine *modbusPollEngine::getInstance()
+{
+    return pPollEngine;
+}
+
+double modbusPollEngine::now()
+{
+    return epicsMonotonicGet() / 1.e9;
+}
+
+/** Adds a port to the engine.  The first poll cycle is run after initialDelay seconds,
+  * or when wakePort() is called if initialDelay is <= 0. */
+modbusPollEntry_t *modbusPollEngine::addPort(drvModbusAsyn *pDriver, double initialDelay)
+{
+    modbusPollEntry_t *pEntry;
+
+    pEntry = (modbusPollEntry_t *)callocMustSucceed(1, sizeof(modbusPollEntry_t), "modbusPollEngine::addPort");
+    pEntry->pDriver = pDriver;
+    epicsMutexLock(mutex_);
+    if (initialDelay > 0.0) {
+        pEntry->deadline = now() + initialDelay;
+    } else {
+        pEntry->parked = true;
+    }
+    entries_.push_back(pEntry);
+    epicsMutexUnlock(mutex_);
+    epicsEventSignal(wakeEvent_);
+    return pEntry;
+}
+
+/** Requests that the poll cycle of a port be run as soon as possible */
+void modbusPollEngine::wakePort(modbusPollEntry_t *pEntry)
+{
+    epicsMutexLock(mutex_);
+    if (pEntry->busy) {
+        pEntry->wakeRequested = true;
+    } else {
+        pEntry->parked = false;
+        pEntry->deadline = now();
+    }
+    epicsMutexUnlock(mutex_);
+    epicsEventSignal(wakeEvent_);
+}
+
+/* Returns the idle port with the earliest deadline if that deadline has passed.
+ * Otherwise returns NULL and the time until the earliest deadline in waitTime,
+ * or -1 if no port is scheduled.
+ * The I/O of a port whose link is failing blocks a worker for the I/O timeout, so failing ports
+ * may only use numThreads-1 workers.  The last worker is kept for the ports that still work.
+ * Must be called with the mutex locked. */
+modbusPollEntry_t *modbusPollEngine::nextDue(double *waitTime)
+{
+    modbusPollEntry_t *pNext = NULL;
+    modbusPollEntry_t *pEntry;
+    size_t i;
+    double t;
+
+    for (i=0; i<entries_.size(); i++) {
+        pEntry = entries_[i];
+        if (pEntry->busy || pEntry->parked) continue;
+        if (pEntry->failing && (numThreads_ > 1) && (numFailingBusy_ >= numThreads_ - 1)) continue;
+        if (!pNext || (pEntry->deadline < pNext->deadline)) pNext = pEntry;
+    }
+    if (!pNext) {
+        *waitTime = -1.;
+        return NULL;
+    }
+    t = now();
+    if (pNext->deadline > t) {
+        *waitTime = pNext->deadline - t;
+        return NULL;
+    }
+    *waitTime = 0.;
+    return pNext;
+}
+
+void modbusPollEngine::worker()
+{
+    modbusPollEntry_t *pEntry;
+    double waitTime;
+    double delay;
+    bool failing;
+
+    epicsMutexLock(mutex_);
+    while (!exiting_) {
+        pEntry = nextDue(&waitTime);
+        if (!pEntry) {
+            epicsMutexUnlock(mutex_);
+            if (waitTime > 0.) {
+                epicsEventWaitWithTimeout(wakeEvent_, waitTime);
+            } else {
+                epicsEventWait(wakeEvent_);
+            }
+            epicsMutexLock(mutex_);
+            continue;
+        }
+        pEntry->busy = true;
+        if (pEntry->failing) numFailingBusy_++;
+        pEntry->wakeRequested = false;
+        pEntry->numPolls++;
+        pEntry->lateness += now() - pEntry->deadline;
+        /* If another port is also due then wake another worker to run it */
+        if (nextDue(&waitTime)) epicsEventSignal(wakeEvent_);
+        epicsMutexUnlock(mutex_);
+
+        delay = pEntry->pDriver->readPollerCycle();
+        failing = pEntry->pDriver->pollLinkFailed();
+
+        epicsMutexLock(mutex_);
+        pEntry->busy = false;
+        if (pEntry->failing) numFailingBusy_--;
+        if (failing != pEntry->failing) {
+            pEntry->failing = failing;
+            checkStarvation();
+        }
+        if (pEntry->wakeRequested) {
+            pEntry->deadline = now();
+        } else if (delay < 0.) {
+            pEntry->parked = true;
+        } else {
+            pEntry->deadline = now() + delay;
+        }
+    }
+    epicsMutexUnlock(mutex_);
+    /* Let the next worker see that we are exiting */
+    epicsEventSignal(wakeEvent_);
+}
+
+/* Prints a message when the number of ports whose link is failing reaches the number of threads,
+ * and when it drops below it again.  Must be called with the mutex locked. */
+void modbusPollEngine::checkStarvation()
+{
+    int numFailing = 0;
+    size_t i;
+
+    for (i=0; i<entries_.size(); i++) {
+        if (entries_[i]->failing) numFailing++;
+    }
+    if (!starvationWarned_ && (numFailing >= numThreads_)) {
+        starvationWarned_ = true;
+        errlogPrintf("%s: %d ports are failing and there are %d threads; "
+                     "the polls of the ports that work may be delayed by the I/O timeout\n",
+                     driverName, numFailing, numThreads_);
+    } else if (starvationWarned_ && (numFailing < numThreads_)) {
+        starvationWarned_ = false;
+        errlogPrintf("%s: %d ports are failing, fewer than the %d threads\n",
+                     driverName, numFailing, numThreads_);
+    }
+}
+
+void modbusPollEngine::shutdown()
+{
+    epicsMutexLock(mutex_);
+    exiting_ = true;
+    epicsMutexUnlock(mutex_);
+    epicsEventSignal(wakeEvent_);
+}
+
+void modbusPollEngine::report(FILE *fp, int details)
+{
+    modbusPollEntry_t *pEntry;
+    size_t i;
+
+    epicsMutexLock(mutex_);
+    fprintf(fp, "modbusPollEngine: threads=%d, ports=%d, failing ports polling=%d\n",
+            numThreads_, (int)entries_.size(), numFailingBusy_);
+    if (details > 0) {
+        for (i=0; i<entries_.size(); i++) {
+            pEntry = entries_[i];
+            fprintf(fp, "  port %s polls=%d, mean start latency=%f ms%s%s\n",
+                    pEntry->pDriver->portName, pEntry->numPolls,
+                    pEntry->numPolls ? 1000.*pEntry->lateness/pEntry->numPolls : 0.,
+                    pEntry->parked ? " (waiting for trigger)" : "",
+                    pEntry->failing ? " (failing)" : "");
+        }
+    }
+    epicsMutexUnlock(mutex_);
+}
+
+
+extern "C" {
+
+/** EPICS iocsh callable function to create the shared poller threads.
+  * This must be called before drvModbusAsynConfigure for the ports that are to use it. */
+int modbusPollEngineConfigure(int numThreads)
+{
+    if (pPollEngine) {
+        printf("%s::modbusPollEngineConfigure already configured\n", driverName);
+        return -1;
+    }
+    if (numThreads < 1) numThreads = 1;
+    if (numThreads > MODBUS_MAX_POLL_THREADS) numThreads = MODBUS_MAX_POLL_THREADS;
+    pPollEngine = new modbusPollEngine(numThreads);
+    return 0;
+}
+
+int modbusPollEngineReport(int details)
+{
+    if (!pPollEngine) {
+        printf("%s is not configured\n", driverName);
+        return -1;
+    }
+    pPollEngine->report(stdout, details);
+    return 0;
+}
+
+/* iocsh functions */
+
+static const iocshArg ConfigureArg0 = {"Number of threads", iocshArgInt};
+static const iocshArg * const modbusPollEngineConfigureArgs[1] = {&ConfigureArg0};
+static const iocshFuncDef modbusPollEngineConfigureFuncDef =
+    {"modbusPollEngineConfigure", 1, modbusPollEngineConfigureArgs};
+static void modbusPollEngineConfigureCallFunc(const iocshArgBuf *args)
+{
+    modbusPollEngineConfigure(args[0].ival);
+}
+
+static const iocshArg ReportArg0 = {"Details", iocshArgInt};
+static const iocshArg * const modbusPollEngineReportArgs[1] = {&ReportArg0};
+static const iocshFuncDef modbusPollEngineReportFuncDef =
+    {"modbusPollEngineReport", 1, modbusPollEngineReportArgs};
+static void modbusPollEngineReportCallFunc(const iocshArgBuf *args)
+{
+    modbusPollEngineReport(args[0].ival);
+}
+
+static void modbusPollEngineRegister(void)
+{
+    iocshRegister(&modbusPollEngineConfigureFuncDef, modbusPollEngineConfigureCallFunc);
+    iocshRegister(&modbusPollEngineReportFuncDef, modbusPollEngineReportCallFunc);
+}
+
+epicsExportRegistrar(modbusPollEngineRegister);
+
+} // extern "C"
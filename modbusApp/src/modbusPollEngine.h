@@ -0,0 +1,60 @@
+/* modbusPollEngine.h
+ *
+ *   Shared pool of poller threads for drvModbusAsyn.
+ *
+ *   By default each drvModbusAsyn read port creates its own poller thread.
+ *   If modbusPollEngineConfigure() is called before the ports are created then the
+ *   ports are instead polled by a fixed number of worker threads.  Each worker runs
+ *   the poll cycle of the port whose next poll is due soonest, so the number of threads
+ *   does not grow with the number of ports.
+ */
+
+#ifndef modbusPollEngine_H
+#define modbusPollEngine_H
+
+#include <stdio.h>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <shareLib.h>
+
+#define MODBUS_MAX_POLL_THREADS 64
+
+class drvModbusAsyn;
+
+struct modbusPollEntry_t {
+    drvModbusAsyn *pDriver;
+    double deadline;     /* Monotonic time in seconds of the next poll */
+    bool busy;           /* A worker is running the poll cycle */
+    bool parked;         /* Waiting for wakePort() because the poll delay is <= 0 */
+    bool wakeRequested;  /* wakePort() was called while the poll cycle was running */
+    bool failing;        /* The I/O of the last poll cycle failed without a reply */
+    int numPolls;
+    double lateness;     /* Sum of the time the polls started after their deadline */
+};
+
+class epicsShareClass modbusPollEngine {
+public:
+    modbusPollEngine(int numThreads);
+    static modbusPollEngine *getInstance();
+    modbusPollEntry_t *addPort(drvModbusAsyn *pDriver, double initialDelay);
+    void wakePort(modbusPollEntry_t *pEntry);
+    void report(FILE *fp, int details);
+    void worker();
+    void shutdown();
+    static double now();
+
+private:
+    modbusPollEntry_t *nextDue(double *waitTime);
+    void checkStarvation();
+    epicsMutexId mutex_;
+    epicsEventId wakeEvent_;
+    std::vector<modbusPollEntry_t *> entries_;
+    int numThreads_;
+    int numFailingBusy_;     /* Number of busy entries that are failing */
+    bool starvationWarned_;  /* The number of failing ports reached numThreads_ */
+    bool exiting_;
+};
+
+#endif /* modbusPollEngine_H */
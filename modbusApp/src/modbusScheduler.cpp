@@ -0,0 +1,410 @@
+/* modbusScheduler.cpp
+ *
+ *   Deadline scheduler for the drvModbusAsyn ports that use the same asyn octet port.
+ *   See modbusScheduler.h for a description.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <epicsThread.h>
+#include <epicsStdio.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <epicsString.h>
+#include <epicsExit.h>
+#include <cantProceed.h>
+#include <errlog.h>
+#include <iocsh.h>
+
+#include "drvModbusAsyn.h"
+#include "modbusScheduler.h"
+
+#include <epicsExport.h>
+
+static const char *driverName = "modbusScheduler";
+
+#define DEFAULT_MAX_LOAD 0.9
+/* Weight of the last poll cycle in the running average of the cycle time */
+#define CYCLE_TIME_WEIGHT 0.125
+
+static const char *priorityNames[MAX_MODBUS_PRIORITIES] = {"interlock", "fast", "slow"};
+
+typedef struct modbusPriorityConfig_t {
+    std::string portName;
+    modbusPriority_t priority;
+} modbusPriorityConfig_t;
+
+/* The schedulers and the priorities of the drvModbusAsyn ports.  These are only created at startup,
+ * but they are protected by a mutex anyway. */
+static std::vector<modbusScheduler *> schedulers;
+static std::vector<modbusPriorityConfig_t> priorityConfigs;
+static epicsMutexId schedulerMutex;
+static epicsThreadOnceId schedulerOnceId = EPICS_THREAD_ONCE_INIT;
+
+static void schedulerInit(void *arg)
+{
+    schedulerMutex = epicsMutexMustCreate();
+}
+
+static double schedulerNow()
+{
+    return epicsMonotonicGet() / 1.e9;
+}
+
+static void schedulerThreadC(void *drvPvt)
+{
+    modbusScheduler *pScheduler = (modbusScheduler *)drvPvt;
+
+    pScheduler->scheduler();
+}
+
+static void schedulerExitCallback(void *drvPvt)
+{
+    modbusScheduler *pScheduler = (modbusScheduler *)drvPvt;
+
+    pScheduler->shutdown();
+}
+
+modbusScheduler::modbusScheduler(const char *octetPortName, double maxLoad)
+  : octetPortName_(octetPortName),
+    maxLoad_(maxLoad),
+    load_(0.),
+    overloaded_(false),
+    numOverloads_(0),
+    exiting_(false)
+{
+    char threadName[100];
+
+    mutex_ = epicsMutexMustCreate();
+    wakeEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    epicsSnprintf(threadName, sizeof(threadName), "%sSched", octetPortName);
+    epicsThreadCreate(threadName,
+                      epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackSmall),
+                      (EPICSTHREADFUNC)schedulerThreadC,
+                      this);
+    epicsAtExit(schedulerExitCallback, this);
+}
+
+/** Returns the scheduler for an octet port, or NULL if modbusSchedulerConfigure has not been called for it */
+modbusScheduler *modbusScheduler::find(const char *octetPortName)
+{
+    modbusScheduler *pScheduler = NULL;
+    size_t i;
+
+    epicsThreadOnce(&schedulerOnceId, schedulerInit, NULL);
+    epicsMutexLock(schedulerMutex);
+    for (i=0; i<schedulers.size(); i++) {
+        if (schedulers[i]->octetPortName_ == octetPortName) {
+            pScheduler = schedulers[i];
+            break;
+        }
+    }
+    epicsMutexUnlock(schedulerMutex);
+    return pScheduler;
+}
+
+/** Adds a port to the scheduler.  The first poll cycle is run after initialDelay seconds,
+  * or when wakePort() is called if initialDelay is <= 0.
+  * The priority class is the one set with modbusSchedulerPriority, or fast if none was set. */
+modbusScheduleEntry_t *modbusScheduler::addPort(drvModbusAsyn *pDriver, double initialDelay)
+{
+    modbusScheduleEntry_t *pEntry;
+    size_t i;
+
+    pEntry = (modbusScheduleEntry_t *)callocMustSucceed(1, sizeof(modbusScheduleEntry_t), "modbusScheduler::addPort");
+    pEntry->pDriver = pDriver;
+    pEntry->priority = modbusPriorityFast;
+    epicsMutexLock(schedulerMutex);
+    for (i=0; i<priorityConfigs.size(); i++) {
+        if (priorityConfigs[i].portName == pDriver->portName) pEntry->priority = priorityConfigs[i].priority;
+    }
+    epicsMutexUnlock(schedulerMutex);
+    epicsMutexLock(mutex_);
+    if (initialDelay > 0.0) {
+        pEntry->deadline = schedulerNow() + initialDelay;
+        pEntry->period = initialDelay;
+    } else {
+        pEntry->parked = true;
+    }
+    entries_.push_back(pEntry);
+    epicsMutexUnlock(mutex_);
+    epicsEventSignal(wakeEvent_);
+    return pEntry;
+}
+
+/** Requests that the poll cycle of a port be run as soon as possible */
+void modbusScheduler::wakePort(modbusScheduleEntry_t *pEntry)
+{
+    epicsMutexLock(mutex_);
+    if (pEntry->busy) {
+        pEntry->wakeRequested = true;
+    } else {
+        pEntry->parked = false;
+        pEntry->deadline = schedulerNow();
+    }
+    epicsMutexUnlock(mutex_);
+    epicsEventSignal(wakeEvent_);
+}
+
+/* Returns the port whose deadline has passed that has the highest priority class, and among those
+ * the earliest deadline.  Otherwise returns NULL and the time until the earliest deadline in waitTime,
+ * or -1 if no port is scheduled.
+ * Must be called with the mutex locked. */
+modbusScheduleEntry_t *modbusScheduler::nextDue(double *waitTime)
+{
+    modbusScheduleEntry_t *pNext = NULL;
+    modbusScheduleEntry_t *pFirst = NULL;
+    modbusScheduleEntry_t *pEntry;
+    double t = schedulerNow();
+    size_t i;
+
+    for (i=0; i<entries_.size(); i++) {
+        pEntry = entries_[i];
+        if (pEntry->busy || pEntry->parked) continue;
+        if (!pFirst || (pEntry->deadline < pFirst->deadline)) pFirst = pEntry;
+        if (pEntry->deadline > t) continue;
+        if (!pNext || (pEntry->priority < pNext->priority) ||
+            ((pEntry->priority == pNext->priority) && (pEntry->deadline < pNext->deadline))) {
+            pNext = pEntry;
+        }
+    }
+    if (pNext) {
+        *waitTime = 0.;
+    } else if (pFirst) {
+        *waitTime = pFirst->deadline - t;
+    } else {
+        *waitTime = -1.;
+    }
+    return pNext;
+}
+
+/* Updates the fraction of the time the octet port is busy and reports when it exceeds the limit.
+ * Parked ports are not included because they are only polled on demand.
+ * Must be called with the mutex locked. */
+void modbusScheduler::checkLoad()
+{
+    modbusScheduleEntry_t *pEntry;
+    static const char *functionName = "checkLoad";
+    size_t i;
+
+    load_ = 0.;
+    for (i=0; i<entries_.size(); i++) {
+        pEntry = entries_[i];
+        if (pEntry->parked || (pEntry->period <= 0.)) continue;
+        load_ += pEntry->cycleTime / pEntry->period;
+    }
+    if (!overloaded_ && (load_ > maxLoad_)) {
+        overloaded_ = true;
+        numOverloads_++;
+        errlogPrintf("%s::%s octet port %s is overloaded, load=%.0f%%, limit=%.0f%%; "
+                     "lower priority ports will be polled late\n",
+                     driverName, functionName, octetPortName_.c_str(), load_*100., maxLoad_*100.);
+    } else if (overloaded_ && (load_ < 0.9*maxLoad_)) {
+        overloaded_ = false;
+        errlogPrintf("%s::%s octet port %s is no longer overloaded, load=%.0f%%\n",
+                     driverName, functionName, octetPortName_.c_str(), load_*100.);
+    }
+}
+
+void modbusScheduler::scheduler()
+{
+    modbusScheduleEntry_t *pEntry;
+    double waitTime;
+    double start;
+    double late;
+    double end;
+    double cycleTime;
+    double delay;
+
+    epicsMutexLock(mutex_);
+    while (!exiting_) {
+        pEntry = nextDue(&waitTime);
+        if (!pEntry) {
+            epicsMutexUnlock(mutex_);
+            if (waitTime > 0.) {
+                epicsEventWaitWithTimeout(wakeEvent_, waitTime);
+            } else {
+                epicsEventWait(wakeEvent_);
+            }
+            epicsMutexLock(mutex_);
+            continue;
+        }
+        pEntry->busy = true;
+        pEntry->wakeRequested = false;
+        pEntry->numPolls++;
+        start = schedulerNow();
+        late = start - pEntry->deadline;
+        pEntry->lateness += late;
+        if (late > pEntry->maxLateness) pEntry->maxLateness = late;
+        epicsMutexUnlock(mutex_);
+
+        delay = pEntry->pDriver->readPollerCycle();
+
+        epicsMutexLock(mutex_);
+        end = schedulerNow();
+        cycleTime = end - start;
+        if (pEntry->numPolls == 1) {
+            pEntry->cycleTime = cycleTime;
+        } else {
+            pEntry->cycleTime += CYCLE_TIME_WEIGHT * (cycleTime - pEntry->cycleTime);
+        }
+        pEntry->busy = false;
+        /* The ports use fixed rate polling, so the delay is the time until the next fixed deadline */
+        if (pEntry->wakeRequested) {
+            pEntry->deadline = end;
+        } else if (delay < 0.) {
+            pEntry->parked = true;
+        } else {
+            pEntry->deadline = end + delay;
+            pEntry->period = cycleTime + delay;
+        }
+        checkLoad();
+    }
+    epicsMutexUnlock(mutex_);
+}
+
+void modbusScheduler::shutdown()
+{
+    epicsMutexLock(mutex_);
+    exiting_ = true;
+    epicsMutexUnlock(mutex_);
+    epicsEventSignal(wakeEvent_);
+}
+
+void modbusScheduler::report(FILE *fp, int details)
+{
+    modbusScheduleEntry_t *pEntry;
+    size_t i;
+
+    epicsMutexLock(mutex_);
+    fprintf(fp, "modbusScheduler: octet port %s, ports=%d, load=%.0f%%, limit=%.0f%%, overloads=%d%s\n",
+            octetPortName_.c_str(), (int)entries_.size(), load_*100., maxLoad_*100., numOverloads_,
+            overloaded_ ? " (overloaded)" : "");
+    if (details > 0) {
+        for (i=0; i<entries_.size(); i++) {
+            pEntry = entries_[i];
+            fprintf(fp, "  port %s priority=%s, period=%.3f ms, cycle time=%.3f ms, polls=%d, "
+                        "mean start latency=%.3f ms, max start latency=%.3f ms%s\n",
+                    pEntry->pDriver->portName, priorityNames[pEntry->priority],
+                    pEntry->period*1000., pEntry->cycleTime*1000., pEntry->numPolls,
+                    pEntry->numPolls ? 1000.*pEntry->lateness/pEntry->numPolls : 0.,
+                    pEntry->maxLateness*1000., pEntry->parked ? " (waiting for trigger)" : "");
+        }
+    }
+    epicsMutexUnlock(mutex_);
+}
+
+extern "C" {
+
+/** EPICS iocsh callable function to create the scheduler for an octet port.
+  * This must be called before drvModbusAsynConfigure for the ports that use the octet port.
+  * \param[in] octetPortName Name of the asyn octet port.
+  * \param[in] maxLoadPercent The percentage of the time the octet port may be busy before it is reported
+  *            as overloaded.  The default is 90. */
+int modbusSchedulerConfigure(const char *octetPortName, int maxLoadPercent)
+{
+    modbusScheduler *pScheduler;
+
+    if (!octetPortName || (strlen(octetPortName) == 0)) {
+        printf("%s::modbusSchedulerConfigure octet port name must be specified\n", driverName);
+        return -1;
+    }
+    if (modbusScheduler::find(octetPortName)) {
+        printf("%s::modbusSchedulerConfigure octet port %s already has a scheduler\n", driverName, octetPortName);
+        return -1;
+    }
+    pScheduler = new modbusScheduler(octetPortName, (maxLoadPercent > 0) ? maxLoadPercent/100. : DEFAULT_MAX_LOAD);
+    epicsMutexLock(schedulerMutex);
+    schedulers.push_back(pScheduler);
+    epicsMutexUnlock(schedulerMutex);
+    return 0;
+}
+
+/** EPICS iocsh callable function to set the priority class of a drvModbusAsyn port.
+  * This must be called before drvModbusAsynConfigure for the port.
+  * \param[in] portName Name of the drvModbusAsyn port.
+  * \param[in] priorityClass "interlock", "fast" or "slow". */
+int modbusSchedulerPriority(const char *portName, const char *priorityClass)
+{
+    modbusPriorityConfig_t config;
+    int i;
+
+    if (!portName || (strlen(portName) == 0)) {
+        printf("%s::modbusSchedulerPriority port name must be specified\n", driverName);
+        return -1;
+    }
+    for (i=0; i<MAX_MODBUS_PRIORITIES; i++) {
+        if (priorityClass && (epicsStrCaseCmp(priorityClass, priorityNames[i]) == 0)) break;
+    }
+    if (i == MAX_MODBUS_PRIORITIES) {
+        printf("%s::modbusSchedulerPriority unknown priority class %s, must be interlock, fast or slow\n",
+               driverName, priorityClass ? priorityClass : "");
+        return -1;
+    }
+    config.portName = portName;
+    config.priority = (modbusPriority_t)i;
+    epicsThreadOnce(&schedulerOnceId, schedulerInit, NULL);
+    epicsMutexLock(schedulerMutex);
+    priorityConfigs.push_back(config);
+    epicsMutexUnlock(schedulerMutex);
+    return 0;
+}
+
+int modbusSchedulerReport(int details)
+{
+    size_t i;
+
+    epicsThreadOnce(&schedulerOnceId, schedulerInit, NULL);
+    epicsMutexLock(schedulerMutex);
+    for (i=0; i<schedulers.size(); i++) {
+        schedulers[i]->report(stdout, details);
+    }
+    epicsMutexUnlock(schedulerMutex);
+    return 0;
+}
+
+/* iocsh functions */
+
+static const iocshArg ConfigureArg0 = {"Octet port name",  iocshArgString};
+static const iocshArg ConfigureArg1 = {"Max load percent", iocshArgInt};
+static const iocshArg * const modbusSchedulerConfigureArgs[2] = {&ConfigureArg0, &ConfigureArg1};
+static const iocshFuncDef modbusSchedulerConfigureFuncDef =
+    {"modbusSchedulerConfigure", 2, modbusSchedulerConfigureArgs};
+static void modbusSchedulerConfigureCallFunc(const iocshArgBuf *args)
+{
+    modbusSchedulerConfigure(args[0].sval, args[1].ival);
+}
+
+static const iocshArg PriorityArg0 = {"Port name",      iocshArgString};
+static const iocshArg PriorityArg1 = {"Priority class", iocshArgString};
+static const iocshArg * const modbusSchedulerPriorityArgs[2] = {&PriorityArg0, &PriorityArg1};
+static const iocshFuncDef modbusSchedulerPriorityFuncDef =
+    {"modbusSchedulerPriority", 2, modbusSchedulerPriorityArgs};
+static void modbusSchedulerPriorityCallFunc(const iocshArgBuf *args)
+{
+    modbusSchedulerPriority(args[0].sval, args[1].sval);
+}
+
+static const iocshArg ReportArg0 = {"Details", iocshArgInt};
+static const iocshArg * const modbusSchedulerReportArgs[1] = {&ReportArg0};
+static const iocshFuncDef modbusSchedulerReportFuncDef =
+    {"modbusSchedulerReport", 1, modbusSchedulerReportArgs};
+static void modbusSchedulerReportCallFunc(const iocshArgBuf *args)
+{
+    modbusSchedulerReport(args[0].ival);
+}
+
+static void modbusSchedulerRegister(void)
+{
+    iocshRegister(&modbusSchedulerConfigureFuncDef, modbusSchedulerConfigureCallFunc);
+    iocshRegister(&modbusSchedulerPriorityFuncDef, modbusSchedulerPriorityCallFunc);
+    iocshRegister(&modbusSchedulerReportFuncDef, modbusSchedulerReportCallFunc);
+}
+
+epicsExportRegistrar(modbusSchedulerRegister);
+
+} // extern "C"
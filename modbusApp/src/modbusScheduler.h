@@ -0,0 +1,78 @@
+/* modbusScheduler.h
+ *
+ *   Deadline scheduler for the drvModbusAsyn ports that use the same asyn octet port.
+ *
+ *   If modbusSchedulerConfigure() is called for an octet port before the ports that use it
+ *   are created then those ports are polled by a single thread for the octet port, instead of
+ *   each port having its own poller thread that contends for the octet port lock.
+ *   The thread runs the poll cycle whose deadline has passed and that has the highest priority
+ *   class, and among those the one with the earliest deadline.  The ports always use fixed rate
+ *   polling, so the period does not drift with the I/O time.
+ *   The scheduler measures the time each poll cycle takes and flags the octet port as overloaded
+ *   when the total load exceeds the configured limit.  An interlock port then still waits for
+ *   at most one poll cycle of another port.
+ */
+
+#ifndef modbusScheduler_H
+#define modbusScheduler_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <shareLib.h>
+
+class drvModbusAsyn;
+
+typedef enum {
+    modbusPriorityInterlock,
+    modbusPriorityFast,
+    modbusPrioritySlow,
+    MAX_MODBUS_PRIORITIES
+} modbusPriority_t;
+
+struct modbusScheduleEntry_t {
+    drvModbusAsyn *pDriver;
+    modbusPriority_t priority;
+    double deadline;     /* Monotonic time in seconds of the next poll */
+    double period;       /* Time in seconds from the start of the last poll to the next, <= 0 if parked */
+    bool busy;           /* The poll cycle is running */
+    bool parked;         /* Waiting for wakePort() because the poll delay is <= 0 */
+    bool wakeRequested;  /* wakePort() was called while the poll cycle was running */
+    int numPolls;
+    double cycleTime;    /* Running average of the time taken by the poll cycle */
+    double lateness;     /* Sum of the time the polls started after their deadline */
+    double maxLateness;
+};
+
+/* Declared here with C linkage so that it can be the friend of modbusScheduler */
+extern "C" int modbusSchedulerConfigure(const char *octetPortName, int maxLoadPercent);
+
+class epicsShareClass modbusScheduler {
+public:
+    static modbusScheduler *find(const char *octetPortName);
+    modbusScheduleEntry_t *addPort(drvModbusAsyn *pDriver, double initialDelay);
+    void wakePort(modbusScheduleEntry_t *pEntry);
+    void report(FILE *fp, int details);
+    void scheduler();
+    void shutdown();
+
+private:
+    modbusScheduler(const char *octetPortName, double maxLoad);
+    friend int modbusSchedulerConfigure(const char *octetPortName, int maxLoadPercent);
+    modbusScheduleEntry_t *nextDue(double *waitTime);
+    void checkLoad();
+    epicsMutexId mutex_;
+    epicsEventId wakeEvent_;
+    std::string octetPortName_;
+    double maxLoad_;       /* Fraction of the time the octet port may be busy */
+    double load_;          /* Measured fraction of the time the octet port is busy */
+    bool overloaded_;
+    int numOverloads_;
+    std::vector<modbusScheduleEntry_t *> entries_;
+    bool exiting_;
+};
+
+#endif /* modbusScheduler_H */
@@ -0,0 +1,96 @@
+/* modbusCRCTest.c */
+
+/*
+ * Tests modbusComputeCRC, which computes the CRC 8 bytes at a time with tables, against the
+ * bit-at-a-time definition of the CRC from the Modbus over serial line documentation.
+ */
+
+#include <stdlib.h>
+
+#include <epicsTypes.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "modbusCRC.h"
+
+#define NUM_RANDOM_FRAMES 10000
+#define MAX_FRAME_SIZE 256
+
+/* The bitwise CRC from the Modbus over serial line specification, with the reflected polynomial 0xA001.
+ * It does not use tables, so it is independent of the tables in modbusCRC.c. */
+static void referenceCRC(const char *buffer, int nchars, unsigned char *CRC_Lo, unsigned char *CRC_Hi)
+{
+    const unsigned char *p = (const unsigned char *)buffer;
+    unsigned int crc = 0xFFFF;
+    int i, bit;
+
+    for (i=0; i<nchars; i++, p++) {
+        crc ^= *p;
+        for (bit=0; bit<8; bit++) {
+            if (crc & 1) {
+                crc = (crc >> 1) ^ 0xA001;
+            } else {
+                crc >>= 1;
+            }
+        }
+    }
+    *CRC_Lo = crc & 0xFF;
+    *CRC_Hi = (crc >> 8) & 0xFF;
+}
+
+/* Returns 1 if modbusComputeCRC and the reference give the same CRC for the first nchars bytes of buffer */
+static int sameCRC(const char *buffer, int nchars)
+{
+    unsigned char lo, hi, refLo, refHi;
+
+    modbusComputeCRC(buffer, nchars, &lo, &hi);
+    referenceCRC(buffer, nchars, &refLo, &refHi);
+    if ((lo == refLo) && (hi == refHi)) return 1;
+    testDiag("length %d: CRC %02X %02X, expected %02X %02X", nchars, lo, hi, refLo, refHi);
+    return 0;
+}
+
+MAIN(modbusCRCTest)
+{
+    /* Read Holding Registers, slave 1, address 0, 10 registers */
+    static const char request[] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x0A};
+    char buffer[MAX_FRAME_SIZE];
+    unsigned char lo, hi;
+    int nchars, i, n;
+    int ok;
+
+    testPlan(4 + MAX_FRAME_SIZE + 1);
+
+    modbusComputeCRC(request, sizeof(request), &lo, &hi);
+    testOk(lo == 0xC5 && hi == 0xCD, "reference frame 01 03 00 00 00 0A has CRC C5 CD, got %02X %02X", lo, hi);
+    modbusComputeCRC(request, 0, &lo, &hi);
+    testOk(lo == 0xFF && hi == 0xFF, "empty frame has CRC FF FF, got %02X %02X", lo, hi);
+
+    srand(12345);
+    for (i=0; i<MAX_FRAME_SIZE; i++) {
+        buffer[i] = (char)(rand() & 0xFF);
+    }
+    /* Every length, so that lengths 0-7 and the lengths that are not multiples of 8 are all covered */
+    for (nchars=0; nchars<=MAX_FRAME_SIZE; nchars++) {
+        testOk(sameCRC(buffer, nchars), "length %d", nchars);
+    }
+
+    /* Random frames of random length */
+    ok = 1;
+    for (n=0; n<NUM_RANDOM_FRAMES; n++) {
+        nchars = rand() % (MAX_FRAME_SIZE + 1);
+        for (i=0; i<nchars; i++) {
+            buffer[i] = (char)(rand() & 0xFF);
+        }
+        if (!sameCRC(buffer, nchars)) ok = 0;
+    }
+    testOk(ok, "%d random frames", NUM_RANDOM_FRAMES);
+
+    /* All bytes 0xFF, so that sign extension of the data would show */
+    for (i=0; i<MAX_FRAME_SIZE; i++) {
+        buffer[i] = (char)0xFF;
+    }
+    testOk(sameCRC(buffer, MAX_FRAME_SIZE), "frame of 0xFF bytes");
+
+    return testDone();
+}